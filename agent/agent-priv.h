@@ -56,6 +56,9 @@ uint32_t n_input_msg_iter_get_n_valid_msgs(n_input_msg_iter_t * iter);
 #define _AGENT_TIMER_TA_DEFAULT 20      /* timer Ta, msecs (impl. defined) */
 #define NICE_AGENT_TIMER_TR_DEFAULT 25000   /* timer Tr, msecs (impl. defined) */
 #define NICE_AGENT_TIMER_TR_MIN     15000   /* timer Tr, msecs (ICE ID-19) */
+#define NICE_AGENT_TIMER_TR_SLACK       2000    /* keepalive timer slack, msecs */
+#define NICE_AGENT_TIMER_REFRESH_SLACK  5000    /* TURN refresh timer slack, msecs */
+#define NICE_AGENT_TIMER_RETRANS_SLACK  20      /* keepalive retransmission slack, msecs */
 #define _AGENT_MAX_CONNECTIVITY_CHECKS 100 /* see spec 5.7.3 (ID-19) */
 
 #define N_EVENT_COMP_STATE_CHANGED        (1<<31)
@@ -95,15 +98,20 @@ struct _agent_st
     int32_t disc_timer;
     int32_t cocheck_timer;
     int32_t keepalive_timer;
+    int32_t timer_loop;             /* timer loop all agent timers are bound to */
     n_slist_t * refresh_list;        /* list of n_cand_refresh_t items */
     uint64_t tie_breaker;            /* tie breaker (ICE sect 5.2 "Determining Role" ID-19) */
     int32_t media_after_tick;       /* Received media after keepalive tick */
     int32_t reliable;               /* property: reliable */
+    uint32_t rx_shards;             /* SO_REUSEPORT sockets per host candidate */
+    int32_t rx_steer;               /* steer the shards by source address */
+    int32_t io_uring;               /* host candidates on io_uring sockets */
     int32_t keepalive_conncheck;    /* property: keepalive_conncheck */
     n_queue_t pending_signals;
     int use_ice_udp;
     int use_ice_tcp;
     int32_t n_event;
+    pthread_mutex_t agent_mutex;    /* agent lock, see "Locking" below */
     /* XXX: add pointer to internal data struct for ABI-safe extensions */
 };
 
@@ -111,8 +119,41 @@ int32_t agent_find_comp(n_agent_t * agent, uint32_t stream_id, uint32_t componen
 n_stream_t * agent_find_stream(n_agent_t * agent, uint32_t stream_id);
 void agent_gathering_done(n_agent_t * agent);
 void agent_sig_gathering_done(n_agent_t * agent);
-void agent_lock(void);
-void agent_unlock(void);
+
+/*
+ * Locking
+ *
+ * Every agent, stream and component has its own recursive mutex. They are
+ * always taken in the order agent -> stream -> component: a thread holding
+ * a component lock never takes its stream or agent lock, and a thread
+ * holding a stream lock never takes the agent lock. To go up, drop the
+ * lower lock first and take them all again from the top. Dropping only
+ * works when it was held once, so the receive path takes the component
+ * lock a single time.
+ *
+ * The agent lock guards the stream list, candidates, check lists,
+ * discovery and refresh items and the agent timers. The stream lock guards
+ * the credentials and ToS of the stream. The component lock guards the
+ * socket sources, the selected pair, the pseudo-TCP socket and its clock
+ * and the queued TCP packets. Control paths change that state with the
+ * upper locks held as well, so the data paths (n_agent_send(),
+ * agent_recv_packet() and the pseudo-TCP clock) only need the component
+ * lock and components progress in parallel. n_agent_send() takes the agent
+ * lock for the lookup only.
+ *
+ * I/O callbacks are emitted with the component lock released at every
+ * depth, see comp_unlock_all(). The data paths must not look the
+ * component up again afterwards, that walks the stream list without the
+ * agent lock. The component memory outlives them, component_free() waits
+ * for the I/O and delivery threads, so they check comp->closed instead,
+ * which component_close() sets under the component lock. The socket read
+ * itself runs without the component lock, so the receive shards of a
+ * component only meet on the processing; a socket source detached meanwhile
+ * is freed by its last reader, see comp_release_source().
+ */
+void agent_mutex_init(pthread_mutex_t * mutex);
+void agent_lock(n_agent_t * agent);
+void agent_unlock(n_agent_t * agent);
 //void agent_unlock_and_emit(n_agent_t * agent);
 
 void agent_sig_new_selected_pair(n_agent_t * agent, uint32_t stream_id, uint32_t component_id, n_cand_t * lcandidate, n_cand_t * rcandidate);
@@ -34,6 +34,8 @@
 #include "nqueue.h"
 #include "event.h"
 #include "timer.h"
+#include "reactor.h"
+#include "executor.h"
 #include "pthread.h"
 
 /* Maximum size of a UDP packet's payload, as the packet's length field is 16b
@@ -46,22 +48,21 @@
 #define MAX_TCP_MTU 1400 /* Use 1400 because of VPNs and we assume IEE 802.3 */
 #define TCP_HEADER_SIZE 24 /* bytes */
 
-static void n_debug_input_msg(const n_input_msg_t * messages,  uint32_t n_messages);
+#define AGENT_SEND_RETRY_US 1000 /* n_agent_send_all() retry interval without pseudo-TCP */
 
-static pthread_t worker_tid;
+static void n_debug_input_msg(const n_input_msg_t * messages,  uint32_t n_messages);
 
 
 //G_DEFINE_TYPE(n_agent_t, nice_agent, G_TYPE_OBJECT);
 
 static void n_agent_init(n_agent_t * self);
 
-static pthread_mutex_t agent_mutex;    /* Mutex used for thread-safe lib */
-
 static void pst_opened(pst_socket_t * sock, void * user_data);
 static void pst_readable(pst_socket_t * sock, void * user_data);
 static void pst_writable(pst_socket_t * sock, void * user_data);
 static void pst_closed(pst_socket_t * sock, uint32_t err, void * user_data);
 static pst_wret_e pst_write_packet(pst_socket_t * sock, char * buffer, uint32_t len, void * user_data);
+static void pst_flush_packets(pst_socket_t * sock, void * user_data);
 static void adjust_tcp_clock(n_agent_t * agent, n_stream_t * stream, n_comp_t * component);
 //static void n_agent_dispose(GObject * object);
 
@@ -163,16 +164,24 @@ int _poll(struct pollfd * fds, nfds_t numfds, int timeout)
     return rc;
 }
 
-void agent_lock(void)
+void agent_mutex_init(pthread_mutex_t * mutex)
 {
-	//nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    //pthread_mutex_lock(&agent_mutex);
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void agent_lock(n_agent_t * agent)
+{
+    pthread_mutex_lock(&agent->agent_mutex);
 }
 
-void agent_unlock(void)
+void agent_unlock(n_agent_t * agent)
 {
-	//nice_debug("[%s]: agent_unlock-------------------", G_STRFUNC);
-    //pthread_mutex_unlock(&agent_mutex);
+    pthread_mutex_unlock(&agent->agent_mutex);
 }
 
 n_stream_t * agent_find_stream(n_agent_t * agent, uint32_t stream_id)
@@ -239,8 +248,12 @@ static void n_agent_init(n_agent_t * agent)
     agent->disc_timer = 0;
     agent->cocheck_timer = 0;
     agent->keepalive_timer = 0;
+    agent->timer_loop = timer_loop_pick();
 
     agent->reliable = TRUE;
+    agent->rx_shards = 1;
+    agent->rx_steer = FALSE;
+    agent->io_uring = FALSE;
     agent->use_ice_udp = TRUE;
     agent->use_ice_tcp = FALSE;
     agent->full_mode = TRUE;
@@ -248,7 +261,7 @@ static void n_agent_init(n_agent_t * agent)
     agent->rng = nice_rng_new();
     _generate_tie_breaker(agent);
 
-    pthread_mutex_init(&agent_mutex, NULL);
+    agent_mutex_init(&agent->agent_mutex);
     n_queue_init(&agent->pending_signals);
 }
 
@@ -284,6 +297,18 @@ static void n_agent_reset_all_stun_agents(n_agent_t * agent, int32_t only_softwa
     }
 }
 
+/* Hands an event payload to the application queue, which owns it from
+ * then on and releases it with n_free(); a payload the full queue refuses
+ * is released here the same way */
+static void agent_post_event(n_agent_t * agent, int32_t event, void * data)
+{
+    if (event_post(agent->n_event, event, data) < 0)
+    {
+        nice_debug("[%s] event queue full, dropping event [%x]", G_STRFUNC, event);
+        n_free(data);
+    }
+}
+
 static void agent_signal_socket_writable(n_agent_t * agent, n_comp_t * comp)
 {
     //g_cancellable_cancel(comp->tcp_writable_cancellable);
@@ -295,7 +320,50 @@ static void agent_signal_socket_writable(n_agent_t * agent, n_comp_t * comp)
         ev_trans_writable->stream_id = comp->stream->id;
 
         nice_debug("[%s] event_post stream_id [%d]", G_STRFUNC, ev_trans_writable->stream_id);
-        event_post(agent->n_event, N_EVENT_NEW_REMOTE_CAND, ev_trans_writable);
+        agent_post_event(agent, N_EVENT_RELIABLE_TRANSPORT_WRITABLE, ev_trans_writable);
+    }
+}
+
+/* Free send space a component has to reach before a stalled sender is
+ * told, never more than the send buffer holds */
+static uint32_t _agent_writable_low_water(n_comp_t * comp)
+{
+    uint32_t sbuf_len = 0;
+
+    pst_get_property(comp->tcp, PROP_SND_BUF, &sbuf_len);
+    if (sbuf_len > 0 && comp->writable_low_water > sbuf_len)
+        return sbuf_len;
+    return MAX(comp->writable_low_water, 1);
+}
+
+/* Edge of the writable notification: a send ran short earlier and the
+ * free space is back at the low-water mark. Wakes n_agent_send_all() and
+ * calls the writable callback once. Called with the component lock held,
+ * after pseudo-TCP has processed ACKs or its clock. */
+static void _agent_check_writable(n_comp_t * comp)
+{
+    n_agent_writable_func func;
+    void * data;
+    int32_t depth;
+
+    if (!comp->writable_armed || comp->tcp == NULL || pst_is_closed(comp->tcp))
+        return;
+    if (pst_get_available_send_space(comp->tcp) < _agent_writable_low_water(comp))
+        return;
+
+    comp->writable_armed = FALSE;
+    pthread_cond_broadcast(&comp->writable_cond);
+
+    func = comp->writable_cb;
+    data = comp->writable_data;
+    if (func)
+    {
+        /* the callback may send, do not hold our lock across it */
+        uint32_t stream_id = comp->stream->id, comp_id = comp->id;
+
+        depth = comp_unlock_all(comp);
+        func(comp->agent, stream_id, comp_id, data);
+        comp_relock(comp, depth);
     }
 }
 
@@ -308,7 +376,8 @@ static void pst_create(n_agent_t * agent, n_stream_t * stream, n_comp_t * comp)
         pst_readable,
         pst_writable,
         pst_closed,
-        pst_write_packet
+        pst_write_packet,
+        pst_flush_packets
     };
     comp->tcp = pst_new(0x8989, &tcp_callbacks);
     nice_debug("[%s]: create pst 0x%p", G_STRFUNC, comp->tcp);
@@ -329,6 +398,9 @@ static void _pseudo_tcp_error(n_agent_t * agent, n_stream_t * stream, n_comp_t *
         pst_close(comp->tcp, TRUE);
     }
 
+    /* blocked senders give up */
+    pthread_cond_broadcast(&comp->writable_cond);
+
     if (comp->tcp_clock != 0)
     {
         /*g_source_destroy(comp->tcp_clock);
@@ -349,17 +421,36 @@ static void pst_opened(pst_socket_t * sock, void * user_data)
     nice_debug("[%s]: s%d:%d pseudo Tcp socket Opened", G_STRFUNC,  stream->id, comp->id);
 
     agent_signal_socket_writable(agent, comp);
+    /* senders that ran into the handshake go now */
+    _agent_check_writable(comp);
+}
+
+/* Copies spans into the delivery ring as long as it is under its
+ * high-water mark, returns the bytes taken */
+static uint32_t _agent_deliver_spans(n_comp_t * comp, const pst_span_t * spans, uint32_t n_spans)
+{
+    uint32_t i, off, n, taken = 0;
+
+    for (i = 0; i < n_spans; i++)
+    {
+        for (off = 0; off < spans[i].len; off += n)
+        {
+            n = MIN(spans[i].len - off, MIN(comp_deliver_room(comp->deliver), COMP_DELIVER_CHUNK));
+            if (n == 0 || !comp_deliver_push(comp, spans[i].data + off, n))
+                return taken;
+            taken += n;
+        }
+    }
+    return taken;
 }
 
-/* This is called with the agent lock held. */
+/* This is called with the component lock held. */
 static void pst_readable(pst_socket_t * sock, void * user_data)
 {
     n_comp_t * comp = user_data;
     n_agent_t * agent = comp->agent;
     n_stream_t * stream = comp->stream;
     int32_t has_io_callback = 1;
-    uint32_t stream_id = stream->id;
-    uint32_t comp_id = comp->id;
     int ret;
 
 //    g_object_ref(agent);
@@ -371,19 +462,22 @@ static void pst_readable(pst_socket_t * sock, void * user_data)
     //has_io_callback = component_has_io_callback(comp);
 
     /* Only dequeue pseudo-TCP data if we can reliably inform the client. The
-     * agent lock is held here, so has_io_callback can only change during
-     * comp_emit_io_cb(), after which it's re-queried. This ensures
-     * no data loss of packets already received and dequeued. */
+     * component lock is held here, but comp_emit_io_cb() drops it for the
+     * callback, so the component may be closed by the time it returns. The
+     * caller keeps the memory alive, see "Locking" in agent-priv.h, so
+     * comp->closed is checked once the lock is back. This ensures no data
+     * loss of packets already received and dequeued. */
     if (has_io_callback)
     {
         do
         {
-            uint8_t buf[MAX_BUFFER_SIZE];
+            pst_span_t spans[2];
+            uint32_t n_spans, i;
             int32_t len;
 
-            /* FIXME: Why copy into a temporary buffer here? Why can't the I/O
-             * callbacks be emitted directly from the pseudo-TCP receive buffer? */
-            len = pst_recv(sock, (char *) buf, sizeof(buf));
+            /* The I/O callbacks are emitted straight from the pseudo-TCP
+             * receive buffer, which is released once they have returned. */
+            len = pst_recv_spans(sock, spans, &n_spans);
 
             nice_debug("%s: I/O callback case: recv %d bytes", G_STRFUNC, len);
 
@@ -420,18 +514,42 @@ static void pst_readable(pst_socket_t * sock, void * user_data)
                 break;
             }
 
-            comp_emit_io_cb(comp, buf, len);
-
-            if (!agent_find_comp(agent, stream_id, comp_id, &stream, &comp))
+            if (comp->deliver != NULL && comp->deliver->high_water > 0)
             {
-                nice_debug("n_stream_t or n_comp_t disappeared during the callback");
-                goto out;
+                uint32_t taken = _agent_deliver_spans(comp, spans, n_spans);
+
+                pst_recv_release(sock, taken);
+                if (taken == (uint32_t)len)
+                    continue;
+
+                /* Past the high-water mark the rest stays in the receive
+                 * buffer, so the window advertised to the sender shrinks.
+                 * The delivery thread calls us again once it drained the
+                 * ring, unless it did so before seeing the flag. */
+                atomic_int_set(&comp->deliver->throttled, TRUE);
+                comp->recv_stats.deliver_throttled++;
+                if (comp_deliver_queued(comp->deliver) == 0)
+                    continue;
+                break;
             }
-            if (pst_is_closed(comp->tcp))
+
+            for (i = 0; i < n_spans; i++)
             {
-                nice_debug("PseudoTCP socket got destroyed in readable callback!");
-                goto out;
+                comp_emit_io_cb(comp, spans[i].data, spans[i].len);
+
+                if (comp->closed)
+                {
+                    nice_debug("n_stream_t or n_comp_t disappeared during the callback");
+                    goto out;
+                }
+                if (pst_is_closed(comp->tcp))
+                {
+                    nice_debug("PseudoTCP socket got destroyed in readable callback!");
+                    pst_recv_release(sock, len);
+                    goto out;
+                }
             }
+            pst_recv_release(sock, len);
 
             //has_io_callback = component_has_io_callback(comp);
         }
@@ -514,6 +632,75 @@ static void pst_closed(pst_socket_t * sock, uint32_t err, void * user_data)
 }
 
 
+/* Sends every held back segment, one batch per run of segments sharing the
+ * socket and the destination. Called with the component lock held. */
+static void _agent_send_batch_flush(n_comp_t * comp)
+{
+    n_send_batch_t * batch = &comp->send_batch;
+    uint32_t i, j, k, n_calls;
+    int32_t ret;
+
+    for (i = 0; i < batch->n_bufs; i = j)
+    {
+        for (j = i + 1; j < batch->n_bufs; j++)
+        {
+            if (batch->socks[j] != batch->socks[i] || !nice_address_equal(&batch->to[j], &batch->to[i]))
+                break;
+        }
+
+        /* Segments which could not be sent are dropped, as in
+         * pst_write_packet(), and recovered by the pseudo-TCP retransmits. */
+        ret = nice_socket_send_batch(batch->socks[i], &batch->to[i], batch->bufs + i, j - i, &n_calls);
+        comp->send_stats.syscalls += n_calls;
+        for (k = 0; ret > 0 && k < (uint32_t)ret; k++)
+        {
+            comp->send_stats.bytes += batch->bufs[i + k].size;
+        }
+        if (ret > 0)
+        {
+            comp->send_stats.packets += ret;
+            if ((uint32_t)ret > comp->send_stats.max_batch)
+                comp->send_stats.max_batch = ret;
+        }
+    }
+
+    batch->n_bufs = 0;
+    batch->used = 0;
+}
+
+static int32_t _agent_send_batch_add(n_comp_t * comp, n_socket_t * sock, n_addr_t * to, const char * buf, uint32_t len)
+{
+    n_send_batch_t * batch = &comp->send_batch;
+    n_outvector_t * vec;
+
+    if (len > COMP_SEND_BATCH_DATA)
+        return -1;
+    if (batch->data == NULL && (batch->data = n_slice_alloc(COMP_SEND_BATCH_DATA)) == NULL)
+        return -1;
+
+    if (batch->n_bufs == NICE_SOCKET_SEND_BATCH || batch->used + len > COMP_SEND_BATCH_DATA)
+        _agent_send_batch_flush(comp);
+
+    vec = &batch->bufs[batch->n_bufs];
+    memcpy(batch->data + batch->used, buf, len);
+    vec->buffer = batch->data + batch->used;
+    vec->size = len;
+    batch->socks[batch->n_bufs] = sock;
+    batch->to[batch->n_bufs] = *to;
+    batch->n_bufs++;
+    batch->used += len;
+
+    return 0;
+}
+
+static void pst_flush_packets(pst_socket_t * psocket, void * user_data)
+{
+    n_comp_t * comp = user_data;
+
+    if (comp->send_batch.n_bufs > 0)
+        _agent_send_batch_flush(comp);
+}
+
 static pst_wret_e pst_write_packet(pst_socket_t * psocket, char * buffer, uint32_t len, void * user_data)
 {
     n_comp_t * comp = user_data;
@@ -536,6 +723,13 @@ static pst_wret_e pst_write_packet(pst_socket_t * psocket, char * buffer, uint32
                        &sock->sock_fd, tmpbuf, n_addr_get_port(addr));
         }
 
+        /* Hold the segment back until pseudo-TCP flushes the burst, it then
+         * goes out with the rest of the burst in one sendmmsg()/GSO send. */
+        if (_agent_send_batch_add(comp, sock, addr, buffer, len) == 0)
+        {
+            return WR_SUCCESS;
+        }
+
         /* Send the segment. nice_socket_send() returns 0 on EWOULDBLOCK; in that
          * case the segment is not sent on the wire, but we return WR_SUCCESS
          * anyway. This effectively drops the segment. The pseudo-TCP state machine
@@ -559,14 +753,10 @@ static pst_wret_e pst_write_packet(pst_socket_t * psocket, char * buffer, uint32
 static int notify_pst_clock(void * user_data)
 {
     n_comp_t * component = user_data;
-    n_stream_t * stream;
-    n_agent_t * agent;
-
-    //nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    n_stream_t * stream = component->stream;
+    n_agent_t * agent = component->agent;
 
-    stream = component->stream;
-    agent = component->agent;
+    comp_lock(component);
 
     /*
         if (g_source_is_destroyed(g_main_current_source()))
@@ -577,9 +767,14 @@ static int notify_pst_clock(void * user_data)
         }*/
 
     pst_notify_clock(component->tcp);
+    /* the timer just went off, so the next deadline has to be armed even
+     * when it is the one that fired: the wheel fires within the deadline's
+     * millisecond, and pseudo-TCP may not consider it due yet */
+    component->last_clock_timeout = 0;
     adjust_tcp_clock(agent, stream, component);
+    _agent_check_writable(component);
 
-    agent_unlock();
+    comp_unlock(component);
 
     return TRUE;
 }
@@ -610,7 +805,7 @@ static void adjust_tcp_clock(n_agent_t * agent, n_stream_t * stream, n_comp_t *
                         interval = INT_MAX;
                     /*agent_timeout_add(agent, &comp->tcp_clock, "Pseudo-TCP clock", interval, notify_pst_clock, comp);*/
 
-                    comp->tcp_clock = timer_create();
+                    comp->tcp_clock = timer_create_on(agent->timer_loop);
                     timer_init(comp->tcp_clock, 0, interval, (notifycallback)notify_pst_clock, (void *)comp, "pseudo-tcp clock");
                     timer_start(comp->tcp_clock);
                 }
@@ -631,21 +826,20 @@ static void _tcp_sock_is_writable(n_socket_t * sock, void * user_data)
     n_agent_t * agent = component->agent;
     n_stream_t * stream = component->stream;
 
-    nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    comp_lock(component);
 
     /* Don't signal writable if the socket that has become writable is not
      * the selected pair */
     if (component->selected_pair.local == NULL || component->selected_pair.local->sockptr != sock)
     {
-        agent_unlock();
+        comp_unlock(component);
         return;
     }
 
     nice_debug("[%s]: s%d:%d Tcp socket writable", G_STRFUNC, stream->id, component->id);
     agent_signal_socket_writable(agent, component);
 
-    agent_unlock();
+    comp_unlock(component);
 }
 
 static const char * _transport_to_string(n_cand_trans_e type)
@@ -727,7 +921,7 @@ void agent_sig_gathering_done(n_agent_t * agent)
                 uint32_t  * id = n_slice_new0(uint32_t);
                 *id = stream->id;
                 nice_debug("[%s] event_post n_event_cand_gathering_done [%d]", G_STRFUNC, *id);
-                event_post(agent->n_event, N_EVENT_CAND_GATHERING_DONE, id);
+                agent_post_event(agent, N_EVENT_CAND_GATHERING_DONE, id);
             }
         }
     }
@@ -744,7 +938,7 @@ void agent_sig_initial_binding_request_received(n_agent_t * agent, n_stream_t *
             uint32_t  * id = n_slice_new0(uint32_t);
             *id = stream->id;
             nice_debug("[%s] event_post stream->id [%d]", G_STRFUNC, *id);
-            event_post(agent->n_event, N_EVENT_INITIAL_BINDING_REQUEST_RECEIVED, id);
+            agent_post_event(agent, N_EVENT_INITIAL_BINDING_REQUEST_RECEIVED, id);
         }
     }
 }
@@ -753,12 +947,11 @@ void agent_sig_initial_binding_request_received(n_agent_t * agent, n_stream_t *
  * it couldn??t receive before due to not being able to send out ACKs (or
  * SYNACKs, for the initial SYN packet), handle them now.
  *
- * Must be called with the agent lock held. */
+ * Must be called with the component lock held. */
 static void process_queued_tcp_packets(n_agent_t * agent, n_stream_t * stream, n_comp_t * comp)
 {
-    n_outvector_t * vec;
-    uint32_t stream_id = stream->id;
-    uint32_t comp_id = comp->id;
+    n_early_queue_t * q = &comp->early_queue;
+    int32_t fed = 0;
 
     //g_assert(agent->reliable);
 
@@ -769,14 +962,16 @@ static void process_queued_tcp_packets(n_agent_t * agent, n_stream_t * stream, n
 
     //nice_debug("[%s]: sending outstanding packets", G_STRFUNC);
 
-    while ((vec = n_queue_peek_head(&comp->queued_tcp_packets)) != NULL)
+    /* the whole ring goes in before the clock is adjusted once */
+    while (q->count > 0)
     {
         int32_t retval;
 
-        nice_debug("[%s]: sending queued %u bytes for n_outvector_t %p", G_STRFUNC, vec->size, vec);
-        retval =  pst_notify_packet(comp->tcp, vec->buffer, vec->size);
+        nice_debug("[%s]: sending queued %u bytes", G_STRFUNC, q->lens[q->head]);
+        retval = pst_notify_packet(comp->tcp, (const char *)q->pool + q->head * COMP_EARLY_SLOT_SIZE, q->lens[q->head]);
 
-        if (!agent_find_comp(agent, stream_id, comp_id, &stream, &comp))
+        /* the readable callback may have dropped the lock meanwhile */
+        if (comp->closed)
         {
             nice_debug("n_stream_t or n_comp_t disappeared during pst_notify_packet");
             return;
@@ -788,18 +983,18 @@ static void process_queued_tcp_packets(n_agent_t * agent, n_stream_t * stream, n
             return;
         }
 
-        adjust_tcp_clock(agent, stream, comp);
-
+        fed++;
         if (!retval)
         {
             /* Failed to send; try again later. */
             break;
         }
 
-        n_queue_pop_head(&comp->queued_tcp_packets);
-        n_free((void *) vec->buffer);
-        n_slice_free(n_outvector_t, vec);
+        comp_early_pop(comp);
     }
+
+    if (fed > 0)
+        adjust_tcp_clock(agent, stream, comp);
 }
 
 void agent_sig_new_selected_pair(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, n_cand_t * lcand, n_cand_t * rcand)
@@ -817,6 +1012,7 @@ void agent_sig_new_selected_pair(n_agent_t * agent, uint32_t stream_id, uint32_t
 
     if (agent->reliable)
     {
+        comp_lock(comp);
         if (!comp->tcp)
             pst_create(agent, stream, comp);
         process_queued_tcp_packets(agent, stream, comp);
@@ -824,6 +1020,7 @@ void agent_sig_new_selected_pair(n_agent_t * agent, uint32_t stream_id, uint32_t
         pst_connect(comp->tcp);
         pst_notify_mtu(comp->tcp, MAX_TCP_MTU);
         adjust_tcp_clock(agent, stream, comp);
+        comp_unlock(comp);
     }
 
     if (nice_debug_is_enabled())
@@ -870,7 +1067,7 @@ void agent_sig_new_selected_pair(n_agent_t * agent, uint32_t stream_id, uint32_t
         ev_new_pair_full->rcandidate = rcand;
 
         //nice_debug("[%s] event_post stream_id [%d]", G_STRFUNC, ev_new_pair_full->stream_id);
-        event_post(agent->n_event, N_EVENT_NEW_SELECTED_PAIR_FULL, ev_new_pair_full);
+        agent_post_event(agent, N_EVENT_NEW_SELECTED_PAIR_FULL, ev_new_pair_full);
     }
 
     /*agent_queue_signal(agent, signals[SIGNAL_NEW_SELECTED_PAIR],
@@ -884,7 +1081,7 @@ void agent_sig_new_selected_pair(n_agent_t * agent, uint32_t stream_id, uint32_t
         strncpy(ev_new_pair->rfoundation, rcand->foundation, CAND_MAX_FOUNDATION);
 
         //nice_debug("[%s] event_post stream_id [%d]", G_STRFUNC, ev_new_pair->stream_id);
-        event_post(agent->n_event, N_EVENT_NEW_SELECTED_PAIR, ev_new_pair);
+        agent_post_event(agent, N_EVENT_NEW_SELECTED_PAIR, ev_new_pair);
     }
 
 	/*????
@@ -902,7 +1099,7 @@ void agent_sig_new_cand(n_agent_t * agent, n_cand_t * candidate)
         n_cand_t * cand = n_slice_new0(n_cand_t);
         memcpy(cand, candidate, sizeof(n_cand_t));
         nice_debug("[%s] event_post N_EVENT_NEW_CAND_FULL [%x]\n", G_STRFUNC, N_EVENT_NEW_CAND_FULL);
-        event_post(agent->n_event, N_EVENT_NEW_CAND_FULL, cand);
+        agent_post_event(agent, N_EVENT_NEW_CAND_FULL, cand);
     }
     /*agent_queue_signal(agent, signals[SIGNAL_NEW_CANDIDATE],
                        candidate->stream_id, candidate->component_id, candidate->foundation);*/
@@ -915,7 +1112,7 @@ void agent_sig_new_cand(n_agent_t * agent, n_cand_t * candidate)
         strncpy(ev_new_cand->foundation, candidate->foundation, CAND_MAX_FOUNDATION);
 
         nice_debug("[%s] event_post N_EVENT_NEW_CAND [%x]\n", G_STRFUNC, N_EVENT_NEW_CAND);
-        event_post(agent->n_event, N_EVENT_NEW_CAND, ev_new_cand);
+        agent_post_event(agent, N_EVENT_NEW_CAND, ev_new_cand);
     }
 
 }
@@ -929,7 +1126,7 @@ void agent_sig_new_remote_cand(n_agent_t * agent, n_cand_t * candidate)
         n_cand_t * cand = n_slice_new0(n_cand_t);
         memcpy(cand, candidate, sizeof(n_cand_t));
         nice_debug("[%s] event_post stream_id [%d]", G_STRFUNC, cand->stream_id);
-        event_post(agent->n_event, N_EVENT_NEW_REMOTE_CAND_FULL, cand);
+        agent_post_event(agent, N_EVENT_NEW_REMOTE_CAND_FULL, cand);
     }
 
     /*agent_queue_signal(agent, signals[SIGNAL_NEW_REMOTE_CANDIDATE],
@@ -943,7 +1140,7 @@ void agent_sig_new_remote_cand(n_agent_t * agent, n_cand_t * candidate)
         strncpy(ev_new_cand->foundation, candidate->foundation, CAND_MAX_FOUNDATION);
 
         nice_debug("[%s] event_post stream_id [%d]", G_STRFUNC, ev_new_cand->stream_id);
-        event_post(agent->n_event, N_EVENT_NEW_REMOTE_CAND, ev_new_cand);
+        agent_post_event(agent, N_EVENT_NEW_REMOTE_CAND, ev_new_cand);
     }
 }
 
@@ -986,7 +1183,11 @@ void agent_sig_comp_state_change(n_agent_t * agent, uint32_t stream_id, uint32_t
         component->state = state;
 
         if (agent->reliable)
+        {
+            comp_lock(component);
             process_queued_tcp_packets(agent, stream, component);
+            comp_unlock(component);
+        }
 
         /*agent_queue_signal(agent, signals[SIGNAL_COMP_STATE_CHANGED], stream_id, component_id, state);*/
 
@@ -998,7 +1199,7 @@ void agent_sig_comp_state_change(n_agent_t * agent, uint32_t stream_id, uint32_t
             ev_state_changed->state = state;
 
             nice_debug("[%s] event_post state [%d]", G_STRFUNC, state);
-            event_post(agent->n_event, N_EVENT_COMP_STATE_CHANGED, ev_state_changed);
+            agent_post_event(agent, N_EVENT_COMP_STATE_CHANGED, ev_state_changed);
         }
     }
 }
@@ -1066,7 +1267,7 @@ uint32_t n_agent_add_stream(n_agent_t * agent, uint32_t n_comps)
     uint32_t ret = 0;
     uint32_t i;
 
-    agent_lock();
+    agent_lock(agent);
     stream = stream_new(agent, n_comps);
 
     agent->streams_list = n_slist_append(agent->streams_list, stream);
@@ -1078,7 +1279,8 @@ uint32_t n_agent_add_stream(n_agent_t * agent, uint32_t n_comps)
         n_comp_t * comp = stream_find_comp_by_id(stream, i + 1);
         if (comp)
         {
-            pst_create(agent, stream, comp);
+            if (agent->reliable)
+                pst_create(agent, stream, comp);
         }
         else
         {
@@ -1090,7 +1292,7 @@ uint32_t n_agent_add_stream(n_agent_t * agent, uint32_t n_comps)
 
     ret = stream->id;
 
-    agent_unlock();
+    agent_unlock(agent);
     return ret;
 }
 
@@ -1103,7 +1305,7 @@ int agent_set_relay_info(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id
     int32_t ret = TRUE;
     turn_server_t * turn;
 
-    agent_lock();
+    agent_lock(agent);
 
     if (!agent_find_comp(agent, stream_id, comp_id, &stream, &comp))
     {
@@ -1144,7 +1346,7 @@ int agent_set_relay_info(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id
     }
 
 done:
-    agent_unlock();
+    agent_unlock(agent);
     return ret;
 }
 
@@ -1155,19 +1357,19 @@ int n_agent_gather_cands(n_agent_t * agent, uint32_t stream_id)
     n_slist_t * l, * local_addresses = NULL;
     n_stream_t * stream;
 
-    agent_lock();
+    agent_lock(agent);
 
     stream = agent_find_stream(agent, stream_id);
     if (stream == NULL)
     {
-        agent_unlock();
+        agent_unlock(agent);
         return FALSE;
     }
 
     if (stream->gathering_started)
     {
         /* n_stream_t is already gathering, ignore this call */
-        agent_unlock();
+        agent_unlock(agent);
         return TRUE;
     }
 
@@ -1348,7 +1550,7 @@ error:
         }
         disc_prune_stream(agent, stream_id);
     }
-    agent_unlock();
+    agent_unlock(agent);
     return ret;
 }
 
@@ -1383,12 +1585,12 @@ void n_agent_remove_stream(n_agent_t * agent, uint32_t stream_id)
 
     n_stream_t * stream;
 
-    agent_lock();
+    agent_lock(agent);
     stream = agent_find_stream(agent, stream_id);
 
     if (!stream)
     {
-        agent_unlock();
+        agent_unlock(agent);
         return;
     }
 
@@ -1399,14 +1601,16 @@ void n_agent_remove_stream(n_agent_t * agent, uint32_t stream_id)
 
     /* Remove the stream and signal its removal. */
     agent->streams_list = n_slist_remove(agent->streams_list, stream);
+    stream_lock(stream);
     stream_close(stream);
+    stream_unlock(stream);
 
     if (!agent->streams_list)
         _remove_keepalive_timer(agent);
 
     /*agent_queue_signal(agent, signals[SIGNAL_STREAMS_REMOVED], g_memdup(stream_ids, sizeof(stream_ids)));*/
 
-    agent_unlock();
+    agent_unlock(agent);
 
     /* Actually free the stream. This should be done with the lock released, as
      * it could end up disposing of a NiceIOStream, which tries to take the
@@ -1421,7 +1625,7 @@ void agent_set_port_range(n_agent_t * agent, uint32_t stream_id, uint32_t comp_i
     n_stream_t * stream;
     n_comp_t * comp;
 
-    agent_lock();
+    agent_lock(agent);
 
     if (agent_find_comp(agent, stream_id, comp_id, &stream, &comp))
     {
@@ -1436,20 +1640,58 @@ void agent_set_port_range(n_agent_t * agent, uint32_t stream_id, uint32_t comp_i
         }
     }
 
-    agent_unlock();
+    agent_unlock(agent);
+}
+
+int32_t n_agent_set_reliable(n_agent_t * agent, int32_t reliable)
+{
+    int32_t ret = FALSE;
+
+    agent_lock(agent);
+    /* streams already created kept the pseudo-TCP sockets of the old mode */
+    if (agent->streams_list == NULL)
+    {
+        agent->reliable = reliable ? TRUE : FALSE;
+        ret = TRUE;
+    }
+    agent_unlock(agent);
+
+    return ret;
+}
+
+int32_t n_agent_set_rx_shards(n_agent_t * agent, uint32_t n_shards, int32_t steer)
+{
+    if (n_shards == 0 || n_shards > EXECUTOR_MAX_THREADS)
+        return FALSE;
+
+    agent_lock(agent);
+    agent->rx_shards = n_shards;
+    agent->rx_steer = steer ? TRUE : FALSE;
+    agent_unlock(agent);
+
+    return TRUE;
+}
+
+int32_t n_agent_set_io_uring(n_agent_t * agent, int32_t enable)
+{
+    agent_lock(agent);
+    agent->io_uring = enable ? TRUE : FALSE;
+    agent_unlock(agent);
+
+    return TRUE;
 }
 
 int32_t n_agent_add_local_addr(n_agent_t * agent, n_addr_t * addr)
 {
     n_addr_t * dupaddr;
 
-    agent_lock();
+    agent_lock(agent);
 
     dupaddr = nice_address_dup(addr);
     nice_address_set_port(dupaddr, 0);
     agent->local_addresses = n_slist_append(agent->local_addresses, dupaddr);
 
-    agent_unlock();
+    agent_unlock(agent);
     return TRUE;
 }
 
@@ -1575,24 +1817,23 @@ int32_t n_agent_set_remote_credentials(n_agent_t * agent, uint32_t stream_id, co
     //g_return_val_if_fail(NICE_IS_AGENT(agent), FALSE);
     //g_return_val_if_fail(stream_id >= 1, FALSE);
 
-    nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    //agent_lock();
+    agent_lock(agent);
 
     stream = agent_find_stream(agent, stream_id);
     /* note: oddly enough, ufrag and pwd can be empty strings */
     if (stream && ufrag && pwd)
     {
-
+        stream_lock(stream);
         strncpy(stream->remote_ufrag, ufrag, N_STREAM_MAX_UFRAG);
         strncpy(stream->remote_password, pwd, N_STREAM_MAX_PWD);
+        stream_unlock(stream);
 
         ret = TRUE;
         goto done;
     }
 
 done:
-    //agent_unlock();
-    nice_debug("[%s]: agent_unlock+++++++++++", G_STRFUNC);
+    agent_unlock(agent);
     return ret;
 }
 
@@ -1605,22 +1846,24 @@ int32_t n_agent_set_local_credentials(n_agent_t * agent, uint32_t stream_id, con
     //g_return_val_if_fail(stream_id >= 1, FALSE);
 
     nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(agent);
 
     stream = agent_find_stream(agent, stream_id);
 
     /* note: oddly enough, ufrag and pwd can be empty strings */
     if (stream && ufrag && pwd)
     {
+        stream_lock(stream);
         strncpy(stream->local_ufrag, ufrag, N_STREAM_MAX_UFRAG);
         strncpy(stream->local_password, pwd, N_STREAM_MAX_PWD);
+        stream_unlock(stream);
 
         ret = TRUE;
         goto done;
     }
 
 done:
-    agent_unlock();
+    agent_unlock(agent);
     return ret;
 }
 
@@ -1633,7 +1876,7 @@ int32_t n_agent_get_local_credentials(n_agent_t * agent, uint32_t stream_id, cha
     //g_return_val_if_fail(stream_id >= 1, FALSE);
 
     //nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(agent);
 
     stream = agent_find_stream(agent, stream_id);
     if (stream == NULL)
@@ -1646,12 +1889,14 @@ int32_t n_agent_get_local_credentials(n_agent_t * agent, uint32_t stream_id, cha
         goto done;
     }
 
+    stream_lock(stream);
     *ufrag = n_strdup(stream->local_ufrag);
     *pwd = n_strdup(stream->local_password);
+    stream_unlock(stream);
     ret = TRUE;
 
 done:
-    agent_unlock();
+    agent_unlock(agent);
     return ret;
 }
 
@@ -1698,8 +1943,7 @@ int32_t n_agent_set_remote_cands(n_agent_t * agent, uint32_t stream_id, uint32_t
 
     nice_debug("[%s]: set_remote_candidates %d %d", G_STRFUNC, stream_id, component_id);
 
-    //nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    /*agent_lock();*/
+    agent_lock(agent);
 
     if (!agent_find_comp(agent, stream_id, component_id, &stream, &component))
     {
@@ -1711,7 +1955,7 @@ int32_t n_agent_set_remote_cands(n_agent_t * agent, uint32_t stream_id, uint32_t
     added = _set_remote_cands_locked(agent, stream, component, candidates);
 
 done:
-    /*agent_unlock();*/
+    agent_unlock(agent);
 
     return added;
 }
@@ -1880,26 +2124,78 @@ uint32_t n_input_msg_iter_get_n_valid_msgs(n_input_msg_iter_t * iter)
         return iter->message + 1;
 }
 
-int32_t n_agent_send(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, uint32_t len, const char * buf)
+/* Unreliable mode: every message is one datagram on the selected pair, a
+ * message spread over several vectors is gathered first */
+static int32_t _agent_send_dgrams(n_comp_t * comp, const n_output_msg_t * msgs, uint32_t n_msgs, int32_t allow_partial)
 {
-    //n_outvector_t local_buf = { buf, len };
-    //n_output_msg_t local_message = { &local_buf, 1 };
-    //int32_t n_sent_bytes;
+    n_socket_t * sock = comp->selected_pair.local->sockptr;
+    n_addr_t * addr = &comp->selected_pair.remote->addr;
+    char buf[MAX_BUFFER_SIZE];
+    int32_t bytes = 0;
+    uint32_t i, j;
+
+    for (i = 0; i < n_msgs; i++)
+    {
+        const n_output_msg_t * msg = &msgs[i];
+        uint32_t len = output_message_get_size(msg);
+        char * data = buf;
 
-    //n_sent_bytes = n_send_msgs_nonblock_internal(agent, stream_id, component_id, &local_message, 1, FALSE, NULL);
+        if (msg->n_buffers == 1)
+        {
+            data = (char *)msg->buffers[0].buffer;
+        }
+        else
+        {
+            uint32_t off = 0;
+
+            if (len > sizeof(buf))
+            {
+                comp->dgram_stats.tx_dropped++;
+                break;
+            }
+            for (j = 0; off < len; j++)
+            {
+                memcpy(buf + off, msg->buffers[j].buffer, msg->buffers[j].size);
+                off += msg->buffers[j].size;
+            }
+        }
+
+        if (agent_socket_send(sock, addr, len, data) < 0)
+        {
+            comp->dgram_stats.tx_dropped++;
+            break;
+        }
+        comp->dgram_stats.tx_packets++;
+        bytes += len;
+    }
 
+    return allow_partial ? bytes : (int32_t)i;
+}
+
+int32_t n_agent_send_msgs(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id,
+                          const n_output_msg_t * msgs, uint32_t n_msgs, int32_t allow_partial)
+{
     n_stream_t * stream;
     n_comp_t * comp;
     int32_t n_sent = -1; /* is in bytes if allow_partial is TRUE, otherwise in messages */
 
-    agent_lock();
+    if (msgs == NULL && n_msgs > 0)
+        return n_sent;
+
+    /* the agent lock only covers the lookup, the send itself runs under the
+     * component lock so components of any stream send in parallel */
+    agent_lock(agent);
 
     if (!agent_find_comp(agent, stream_id, comp_id, &stream, &comp))
     {
         nice_debug("[%s]: Invalid stream/component", G_STRFUNC);
-        goto done;
+        agent_unlock(agent);
+        return n_sent;
     }
 
+    comp_lock(comp);
+    agent_unlock(agent);
+
     /* FIXME: Cancellation isnt yet supported, but it doesnt matter because
      * we only deal with non-blocking writes. */
     if (comp->selected_pair.local != NULL)
@@ -1909,28 +2205,44 @@ int32_t n_agent_send(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, ui
             char tmpbuf[INET6_ADDRSTRLEN];
             nice_address_to_string(&comp->selected_pair.remote->addr, tmpbuf);
 
-            nice_debug("[%s]: s%d:%d: sending %d bytes to [%s]:%d\n", G_STRFUNC, stream_id, comp_id, len, tmpbuf,
+            nice_debug("[%s]: s%d:%d: sending %u messages to [%s]:%d\n", G_STRFUNC, stream_id, comp_id, n_msgs, tmpbuf,
                        n_addr_get_port(&comp->selected_pair.remote->addr));
         }
         
-        if (!pst_is_closed(comp->tcp))
+        if (!agent->reliable)
+        {
+            /* No pseudo-TCP in between, straight onto the selected pair */
+            n_sent = _agent_send_dgrams(comp, msgs, n_msgs, allow_partial);
+        }
+        else if (!pst_is_closed(comp->tcp))
         {
-            /* Send on the pseudo-TCP socket. */
-            //n_sent = pst_send_messages(comp->tcp, messages, n_messages, allow_partial, &child_error);
-            n_sent = pst_send(comp->tcp, buf, len);
-            adjust_tcp_clock(agent, stream, comp);
+            /* Send on the pseudo-TCP socket, every vector goes into the send
+             * buffer before the clock is adjusted once. */
+            int32_t err;
 
-            if (!pst_can_send(comp->tcp))
+            n_sent = pst_send_msgs(comp->tcp, msgs, n_msgs, allow_partial);
+            err = (n_sent < 0) ? pst_get_error(comp->tcp) : 0;
+            if (n_sent < 0 && (err == EWOULDBLOCK || err == ENOTCONN))
             {
-                //g_cancellable_reset(component->tcp_writable_cancellable);
-
+                /* a full send buffer or a handshake still running is not
+                 * an error */
+                n_sent = 0;
             }
-
-            if (n_sent < 0 /*&& !g_error_matches(child_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)*/)
+            else if (n_sent < 0)
             {
                 /* Signal errors */
                 _pseudo_tcp_error(agent, stream, comp);
             }
+            else
+            {
+                adjust_tcp_clock(agent, stream, comp);
+            }
+
+            /* the next ACKs that bring the space back, or pst_opened() at
+             * the end of the handshake, notify the sender */
+            if (!pst_is_closed(comp->tcp) && (err == ENOTCONN
+                    || pst_get_available_send_space(comp->tcp) < _agent_writable_low_water(comp)))
+                comp->writable_armed = TRUE;
         }
         else
         {
@@ -1939,33 +2251,162 @@ int32_t n_agent_send(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, ui
     }
     else
     {
-        /* Socket isn't properly open yet. */
+        /* Socket isn't properly open yet, notify once it is */
         n_sent = 0;  /* EWOULDBLOCK */
+        if (agent->reliable)
+            comp->writable_armed = TRUE;
     }
 
     /* Handle errors and cancellations. */
     if (n_sent == 0)
     {
         //g_set_error_literal(&child_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK, g_strerror(EAGAIN));
-        n_sent = -1;
+        n_sent = N_AGENT_SEND_WOULDBLOCK;
     }
 
-    //nice_debug("[%s]: n_sent: %d, n_messages: %u", G_STRFUNC,  n_sent, n_messages);
+    nice_debug("[%s]: n_sent: %d, n_messages: %u", G_STRFUNC,  n_sent, n_msgs);
 
-done:
-
-    agent_unlock();
+    comp_unlock(comp);
 
     return n_sent;
 }
 
+int32_t n_agent_send(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, uint32_t len, const char * buf)
+{
+    n_outvector_t local_buf = { buf, len };
+    n_output_msg_t local_message = { &local_buf, 1 };
+
+    return n_agent_send_msgs(agent, stream_id, comp_id, &local_message, 1, TRUE);
+}
+
+/* Sleeps on the component until deadline (monotonic usec, -1 for none).
+ * Called with the component lock held exactly once. */
+static void _agent_wait_comp(n_comp_t * comp, int64_t deadline)
+{
+    struct timespec ts;
+    int64_t abs_us;
+
+    if (deadline < 0)
+    {
+        pthread_cond_wait(&comp->writable_cond, &comp->mutex);
+        return;
+    }
+#ifdef _WIN32
+    {
+        n_timeval_t now;
+
+        /* pthreads-win32 only knows the realtime clock */
+        get_current_time(&now);
+        abs_us = (int64_t)now.tv_sec * USEC_PER_SEC + now.tv_usec + (deadline - get_monotonic_time());
+    }
+#else
+    abs_us = deadline;
+#endif
+    ts.tv_sec = (time_t)(abs_us / USEC_PER_SEC);
+    ts.tv_nsec = (long)(abs_us % USEC_PER_SEC) * 1000;
+    pthread_cond_timedwait(&comp->writable_cond, &comp->mutex, &ts);
+}
+
+/* Waits until a send that came back N_AGENT_SEND_WOULDBLOCK is worth
+ * retrying. Returns FALSE once the deadline has passed or the component
+ * is gone. */
+static int32_t _agent_wait_writable(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, int64_t deadline)
+{
+    n_stream_t * stream;
+    n_comp_t * comp;
+    int32_t ret = TRUE;
+
+    agent_lock(agent);
+    if (!agent_find_comp(agent, stream_id, comp_id, &stream, &comp))
+    {
+        agent_unlock(agent);
+        return FALSE;
+    }
+    comp_lock(comp);
+    agent_unlock(agent);
+
+    if (!agent->reliable)
+    {
+        /* nothing tells when a datagram socket drains, retry shortly */
+        int64_t until = get_monotonic_time() + AGENT_SEND_RETRY_US;
+
+        if (deadline >= 0 && deadline < until)
+            until = deadline;
+        _agent_wait_comp(comp, until);
+    }
+    else
+    {
+        /* armed is cleared by the notification and by component_close() */
+        while (comp->writable_armed && !pst_is_closed(comp->tcp))
+        {
+            if (deadline >= 0 && get_monotonic_time() >= deadline)
+                break;
+            _agent_wait_comp(comp, deadline);
+        }
+    }
+    if (deadline >= 0 && get_monotonic_time() >= deadline)
+        ret = FALSE;
+
+    comp_unlock(comp);
+    return ret;
+}
+
+int32_t n_agent_send_all(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, uint32_t len, const char * buf, int32_t timeout_ms)
+{
+    int64_t deadline = -1;
+    uint32_t done = 0;
+    int32_t n = 0;
+
+    if (buf == NULL && len > 0)
+        return -1;
+    if (timeout_ms >= 0)
+        deadline = get_monotonic_time() + (int64_t)timeout_ms * 1000;
+
+    while (done < len)
+    {
+        n = n_agent_send(agent, stream_id, comp_id, len - done, buf + done);
+        if (n > 0)
+        {
+            done += n;
+            continue;
+        }
+        if (n != N_AGENT_SEND_WOULDBLOCK || !_agent_wait_writable(agent, stream_id, comp_id, deadline))
+            break;
+    }
+
+    return (done > 0 || len == 0) ? (int32_t)done : n;
+}
+
+int32_t n_agent_set_writable_cb(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, uint32_t low_water,
+                                n_agent_writable_func func, void * data)
+{
+    n_stream_t * stream;
+    n_comp_t * comp;
+
+    agent_lock(agent);
+    if (!agent_find_comp(agent, stream_id, comp_id, &stream, &comp))
+    {
+        agent_unlock(agent);
+        return FALSE;
+    }
+    comp_lock(comp);
+    agent_unlock(agent);
+
+    comp->writable_cb = func;
+    comp->writable_data = data;
+    comp->writable_low_water = low_water;
+
+    comp_unlock(comp);
+    return TRUE;
+}
+
 n_slist_t * n_agent_get_local_cands(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id)
 {
     n_comp_t * comp;
     n_slist_t * ret = NULL;
     n_slist_t * item = NULL;
 
-    agent_lock();
+    agent_lock(agent);
 
     if (!agent_find_comp(agent, stream_id, comp_id, NULL, &comp))
     {
@@ -1976,7 +2417,7 @@ n_slist_t * n_agent_get_local_cands(n_agent_t * agent, uint32_t stream_id, uint3
         ret = n_slist_append(ret, nice_candidate_copy(item->data));
 
 done:
-    agent_unlock();
+    agent_unlock(agent);
     return ret;
 }
 
@@ -1986,7 +2427,7 @@ n_slist_t * n_agent_get_remote_cands(n_agent_t * agent, uint32_t stream_id, uint
     n_comp_t * comp;
     n_slist_t * ret = NULL, *item = NULL;
 
-    agent_lock();
+    agent_lock(agent);
     if (!agent_find_comp(agent, stream_id, comp_id, NULL, &comp))
     {
         goto done;
@@ -1996,7 +2437,7 @@ n_slist_t * n_agent_get_remote_cands(n_agent_t * agent, uint32_t stream_id, uint
         ret = n_slist_append(ret, nice_candidate_copy(item->data));
 
 done:
-    agent_unlock();
+    agent_unlock(agent);
     return ret;
 }
 
@@ -2005,7 +2446,7 @@ int32_t n_agent_restart(n_agent_t * agent)
     n_slist_t * i;
 
     //nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(agent);
 
     /* step: regenerate tie-breaker value */
     _generate_tie_breaker(agent);
@@ -2019,7 +2460,7 @@ int32_t n_agent_restart(n_agent_t * agent)
         stream_restart(agent, stream);
     }
 
-    agent_unlock();
+    agent_unlock(agent);
     return TRUE;
 }
 
@@ -2029,7 +2470,7 @@ int32_t n_agent_restart_stream(n_agent_t * agent, uint32_t stream_id)
     n_stream_t * stream;
 
     //nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(agent);
 
     stream = agent_find_stream(agent, stream_id);
     if (!stream)
@@ -2044,7 +2485,7 @@ int32_t n_agent_restart_stream(n_agent_t * agent, uint32_t stream_id)
 
     res = TRUE;
 done:
-    agent_unlock();
+    agent_unlock(agent);
     return res;
 }
 
@@ -2098,6 +2539,7 @@ static void n_agent_dispose(n_agent_t * agent)
     nice_rng_free(agent->rng);
     agent->rng = NULL;
 
+    pthread_mutex_destroy(&agent->agent_mutex);
 }
 
 #if 1
@@ -2110,7 +2552,7 @@ int32_t n_agent_attach_recv(n_agent_t * agent, uint32_t stream_id, uint32_t comp
 
 
 	//nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-	agent_lock();
+	agent_lock(agent);
 
 	/* attach candidates */
 
@@ -2138,84 +2580,221 @@ int32_t n_agent_attach_recv(n_agent_t * agent, uint32_t stream_id, uint32_t comp
 		* next incoming data.
 		* but only do this if we know we're already readable, otherwise we might
 		* trigger an error in the initial, pre-connection attach. */
+		comp_lock(comp);
 		if (agent->reliable && !pst_is_closed(comp->tcp) && comp->tcp_readable)
 			pst_readable(comp->tcp, comp);
+		comp_unlock(comp);
 	}
 
 done:
-	agent_unlock();
+	agent_unlock(agent);
 	return ret;
 }
 
-/**/
+/* Receive buffers of one thread, allocated on its first agent_recv_packet()
+ * and reused for every batch after that. */
+typedef struct
+{
+    n_input_msg_t msgs[NICE_SOCKET_RECV_BATCH];
+    n_invector_t vecs[NICE_SOCKET_RECV_BATCH];
+    n_addr_t from[NICE_SOCKET_RECV_BATCH];
+    uint8_t bufs[NICE_SOCKET_RECV_BATCH][MAX_BUFFER_SIZE];
+    n_input_msg_t umsgs[NICE_SOCKET_RECV_BATCH];  /* io_uring: buffers point into the socket's ring */
+    n_invector_t uvecs[NICE_SOCKET_RECV_BATCH];
+} n_recv_batch_t;
+
+static pthread_key_t recv_batch_key;
+static pthread_once_t recv_batch_once = PTHREAD_ONCE_INIT;
+
+static void _recv_batch_free(void * data)
+{
+    n_slice_free(n_recv_batch_t, data);
+}
+
+static void _recv_batch_key_init(void)
+{
+    pthread_key_create(&recv_batch_key, _recv_batch_free);
+}
+
+static n_recv_batch_t * _recv_batch_get(void)
+{
+    n_recv_batch_t * batch;
+    int32_t i;
+
+    pthread_once(&recv_batch_once, _recv_batch_key_init);
+    batch = pthread_getspecific(recv_batch_key);
+    if (batch == NULL)
+    {
+        /* no memset, every datagram is only read up to its length */
+        if ((batch = n_slice_new(n_recv_batch_t)) == NULL)
+            return NULL;
+        for (i = 0; i < NICE_SOCKET_RECV_BATCH; i++)
+        {
+            batch->vecs[i].buffer = batch->bufs[i];
+            batch->vecs[i].size = MAX_BUFFER_SIZE;
+            batch->msgs[i].buffers = &batch->vecs[i];
+            batch->msgs[i].n_buffers = 1;
+            batch->msgs[i].from = &batch->from[i];
+            batch->msgs[i].length = 0;
+            batch->umsgs[i] = batch->msgs[i];
+            batch->umsgs[i].buffers = &batch->uvecs[i];
+        }
+        pthread_setspecific(recv_batch_key, batch);
+    }
+    return batch;
+}
+
+/* Tracks the RTP sequence numbers of unreliable datagrams, RFC 3550 A.1
+ * style, so losses and reordering show up in the component counters */
+static void _agent_dgram_track_seq(n_comp_t * comp, const uint8_t * buf, int32_t length)
+{
+    n_dgram_stats_t * stats = &comp->dgram_stats;
+    uint16_t seq, delta;
+
+    /* RTP version 2, RTCP packet types 200-204 have no sequence number */
+    if (length < 12 || (buf[0] >> 6) != 2 || (buf[1] >= 200 && buf[1] <= 204))
+        return;
+
+    seq = (uint16_t)((buf[2] << 8) | buf[3]);
+    delta = (uint16_t)(seq - comp->rtp_max_seq);
+    if (comp->rtp_seq_valid && delta == 0)
+    {
+        /* duplicate */
+    }
+    else if (comp->rtp_seq_valid && delta < 3000)
+    {
+        stats->rx_lost += delta - 1;
+        comp->rtp_max_seq = seq;
+    }
+    else if (comp->rtp_seq_valid && delta > 0x10000 - 100)
+    {
+        /* a late packet fills a gap that was counted as lost */
+        stats->rx_reordered++;
+        if (stats->rx_lost > 0)
+            stats->rx_lost--;
+    }
+    else
+    {
+        /* first packet, or a jump too large for a loss: the sender restarted */
+        comp->rtp_max_seq = seq;
+        comp->rtp_seq_valid = TRUE;
+    }
+}
+
+/* Unreliable mode: the datagram goes from the receive batch buffer straight
+ * to the I/O callback */
+static void _agent_recv_dgram(n_comp_t * comp, const uint8_t * buf, int32_t length)
+{
+    comp->dgram_stats.rx_packets++;
+    _agent_dgram_track_seq(comp, buf, length);
+    if (!comp_emit_io_cb(comp, buf, length))
+        comp->dgram_stats.rx_dropped++;
+}
+
+/* Classifies a datagram by its first byte (RFC 7983): 0..3 is STUN when the
+ * magic cookie and the length field agree, and pseudo-TCP otherwise since
+ * its conversation number starts with a zero byte; 64..79 is TURN
+ * ChannelData, but only on a socket a relay is allocated through, anywhere
+ * else it is an application datagram like any other first byte. Only the
+ * STUN class is worth a full validation. */
+static n_demux_class_e _agent_demux(n_agent_t * agent, int32_t turn, const uint8_t * buf, int32_t length)
+{
+    uint8_t b;
+
+    if (length <= 0)
+        return N_DEMUX_REJECTED;
+
+    b = buf[0];
+    if (b <= 3)
+    {
+        if (length >= STUN_MSG_HEADER_LENGTH
+            && (((uint32_t)buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7]) == STUN_MAGIC_COOKIE
+            && STUN_MSG_HEADER_LENGTH + ((buf[2] << 8) | buf[3]) == length)
+            return N_DEMUX_STUN;
+        return agent->reliable ? N_DEMUX_PSEUDO_TCP : N_DEMUX_APP;
+    }
+
+    if (turn && b >= 64 && b <= 79 && length >= 4 && 4 + ((buf[2] << 8) | buf[3]) <= length)
+        return N_DEMUX_CHANNEL_DATA;
+
+    /* pseudo-TCP never starts with anything but a zero byte */
+    return agent->reliable ? N_DEMUX_REJECTED : N_DEMUX_APP;
+}
+
+/* Drains up to NICE_SOCKET_RECV_BATCH datagrams of a readable socket, STUN
+ * ones go to the connectivity checks, data ones are all fed to pseudo-TCP
+ * before its clock is adjusted once, or in unreliable mode handed to the
+ * I/O callback one by one. Called with the component lock held exactly
+ * once and s_source held by the caller: the lock is dropped for the read
+ * itself, so the receive shards of one component only serialize on the
+ * processing, and to take the agent lock in order. */
 int32_t agent_recv_packet(n_socket_source_t * s_source)
 {
-    int length;
-    int fd = s_source->socket->sock_fd;
-    //n_dlist_t * item;
-    //n_input_msg_t * message;
-    n_addr_t from;
+    n_socket_t * sock = s_source->socket;
+    int32_t uring = (sock->type == NICE_SOCKET_TYPE_UDP_URING);
+    int32_t corked = FALSE;
     n_comp_t * comp;
     n_agent_t * agent;
     n_stream_t * stream;
-    int32_t has_io_callback = 1;
-    int32_t remove_source = FALSE;
-	uint8_t local_header_buf[TCP_HEADER_SIZE] = {0};
-	uint8_t local_body_buf[MAX_BUFFER_SIZE] = {0};
-    n_invector_t local_bufs[] =
-    {
-        { local_header_buf, sizeof(local_header_buf) },
-        { local_body_buf, sizeof(local_body_buf) },
-    };
-    n_input_msg_t local_message =
-    {
-        local_bufs, N_ELEMENTS(local_bufs), NULL, 0
-    };
-    n_recv_status_t retval = 0;
-
-    agent_lock();
+    n_recv_batch_t * batch;
+    n_input_msg_t * msgs;
+    uint32_t n_calls = 0;
+    int32_t n_msgs, i, fed = 0;
+    n_recv_status_t retval = RECV_WOULD_BLOCK;
 
     comp = s_source->component;
     agent = comp->agent;
     stream = comp->stream;
 
-    /*if (nread == -1)
-    {
-        nice_debug("[%s]: n_socket_t %p has received HUP", G_STRFUNC,  socket_source->socket);
-        if (comp->selected_pair.local &&
-                comp->selected_pair.local->sockptr == socket_source->socket &&
-                comp->state == COMP_STATE_READY)
-        {
-            nice_debug("[%s]: Selected pair socket %p has HUP, declaring failed", G_STRFUNC, socket_source->socket);
-            agent_sig_comp_state_change(agent, stream->id, comp->id, COMP_STATE_FAILED);
-        }
-
-        component_detach_socket(comp, socket_source->socket);
-        agent_unlock();
-        return -1;
-    }*/
-
-    //has_io_callback = component_has_io_callback(comp);
+    if ((batch = _recv_batch_get()) == NULL)
+        return RECV_ERROR;
 
-    if (pst_is_closed(comp->tcp))
+    if (agent->reliable && pst_is_closed(comp->tcp))
     {
         nice_debug("[%s]: not handling incoming packet for s%d:%d "
                    "because pseudo-TCP socket does not exist in reliable mode.", G_STRFUNC,
                    stream->id, comp->id);
-        remove_source = TRUE;
         goto done;
     }
 
-    while (has_io_callback)
+    comp_unlock(comp);
+    if (uring)
+    {
+        /* completions are already in memory, replies go out in one submit */
+        msgs = batch->umsgs;
+        nice_udp_uring_cork(sock, TRUE);
+        corked = TRUE;
+        n_msgs = nice_udp_uring_recv(sock, msgs, NICE_SOCKET_RECV_BATCH);
+    }
+    else
+    {
+        msgs = batch->msgs;
+        n_msgs = nice_socket_recv_batch(sock->sock_fd, msgs, NICE_SOCKET_RECV_BATCH, &n_calls);
+    }
+    comp_lock(comp);
+    if (comp->closed || s_source->detached)
+        goto done;
+    comp->recv_stats.syscalls += n_calls;
+    if (n_msgs <= 0)
     {
-        length = nice_socket_recv(fd, &from, MAX_BUFFER_SIZE, local_body_buf);
+        retval = (n_msgs < 0) ? RECV_ERROR : RECV_WOULD_BLOCK;
+        goto done;
+    }
+    comp->recv_stats.packets += n_msgs;
+    if (n_msgs > comp->recv_stats.max_batch)
+        comp->recv_stats.max_batch = n_msgs;
 
-        if (nice_debug_is_enabled())
-        {
-            char tmpbuf[INET6_ADDRSTRLEN];
-            nice_address_to_string(&from, tmpbuf);
-            //nice_debug("[%s]: %d bytes received on [%d] from [%s:%u]", G_STRFUNC, length, fd, tmpbuf, n_addr_get_port(&from));
-        }
+    agent->media_after_tick = TRUE;
+    retval = RECV_OOB;
+
+    for (i = 0; i < n_msgs; i++)
+    {
+        uint8_t * buf = msgs[i].buffers[0].buffer;
+        int32_t length = msgs[i].length;
+        n_addr_t * from = msgs[i].from;
+        n_demux_class_e cls = _agent_demux(agent, s_source->turn, buf, length);
+
+        comp->recv_stats.bytes += length;
 
 #if 0
         for (item = comp->turn_servers; item; item = n_dlist_next(item))
@@ -2242,150 +2821,457 @@ int32_t agent_recv_packet(n_socket_source_t * s_source)
         }
 #endif
 
-        agent->media_after_tick = TRUE;
+        if (cls == N_DEMUX_STUN)
+        {
+            comp->recv_stats.stun_validated++;
+            if (stun_msg_valid_buflen(buf, length, 1) != length)
+            {
+                nice_debug("[%s]: Packet looked like STUN but failed validation.", G_STRFUNC);
+                comp->recv_stats.demux[N_DEMUX_REJECTED]++;
+                continue;
+            }
+            comp->recv_stats.demux[N_DEMUX_STUN]++;
+
+            /* connectivity checks touch agent wide state, retake the
+             * locks in order */
+            comp_unlock(comp);
+            agent_lock(agent);
+            comp_lock(comp);
+            /* closed or detached meanwhile, the rest of the batch is moot */
+            if (comp->closed || s_source->detached)
+            {
+                agent_unlock(agent);
+                goto done;
+            }
+            cocheck_handle_in_stun(agent, stream, comp,
+                                   s_source->primary ? s_source->primary : s_source->socket,
+                                   from, (char *)buf, length);
+            agent_unlock(agent);
+            /* the checks themselves may have dropped the socket */
+            if (s_source->detached)
+                goto done;
+            continue;
+        }
 
-        if (stun_msg_valid_buflen_fast(local_body_buf, length, 1) == length)
+        comp->recv_stats.demux[cls]++;
+        if (cls == N_DEMUX_CHANNEL_DATA)
         {
-            int32_t validated_len;
+            /* relayed data is not unwrapped on this path */
+            nice_debug("[%s]: Dropping TURN ChannelData packet.", G_STRFUNC);
+            continue;
+        }
+        if (cls == N_DEMUX_REJECTED)
+            continue;
 
-            validated_len = stun_msg_valid_buflen(local_body_buf, length, 1);
+        if (!agent->reliable)
+        {
+            _agent_recv_dgram(comp, buf, length);
+            continue;
+        }
 
-            if (validated_len == (int32_t) length)
-            {
-                int32_t handled;
+        if (pst_is_closed(comp->tcp))
+        {
+            nice_debug("[%s]: Received data on a pseudo tcp FAILED component. Ignoring.", G_STRFUNC);
+            continue;
+        }
 
-                handled = cocheck_handle_in_stun(agent, stream, comp, s_source->socket, &from, (char *)local_body_buf, validated_len);
+        if (comp->selected_pair.local == NULL)
+        {
+            if (comp_early_push(comp, buf, length))
+                nice_debug("%s: queued %d bytes", G_STRFUNC, length);
+            continue;
+        }
 
-                if (handled)
-                {
-                    /* Handled STUN message. */
-                    //nice_debug("[%s]: Valid STUN packet received.", G_STRFUNC);
-                    retval = RECV_OOB;
-                    goto done;
-                }
-            }
+        if (fed == 0)
+            process_queued_tcp_packets(agent, stream, comp);
 
-            nice_debug("[%s]: Packet passed fast STUN validation but failed slow validation.", G_STRFUNC);
+        /* Received data on a reliable connection. */
+        pst_notify_packet(comp->tcp, buf, length);
+        fed++;
+    }
 
-        }
+    if (fed > 0 && !pst_is_closed(comp->tcp))
+    {
+        adjust_tcp_clock(agent, stream, comp);
+        /* ACKs among them may have freed send space */
+        _agent_check_writable(comp);
+    }
 
-        /* stunݰ԰TCPݰ */
-        if (length > 0)
-        {
-            if (!pst_is_closed(comp->tcp))
-            {
-                if (comp->selected_pair.local == NULL)
-                {
-                    n_outvector_t * vec = n_slice_new(n_outvector_t);
-                    //vec->buffer = compact_input_message(message, &vec->size);
-					vec->buffer = n_slice_copy(length, local_body_buf);
-					vec->size = length;
-                    n_queue_push_tail(&comp->queued_tcp_packets, vec);
-                    nice_debug("%s: queued %d bytes for n_outvector_t %p", G_STRFUNC, length, vec);
-
-                    return RECV_OOB;
-                }
-                else
-                {
-                    process_queued_tcp_packets(agent, stream, comp);
-                }
+done:
+    if (corked)
+    {
+        nice_udp_uring_recv_done(sock);
+        nice_udp_uring_cork(sock, FALSE);
+    }
+    return retval;
+}
 
-                /* Received data on a reliable connection. */
+static n_socket_source_t * _agent_find_source(n_comp_t * comp, int32_t fd)
+{
+    n_slist_t * l;
 
-                nice_debug("%s: notifying pseudo-TCP of packet, length %u", G_STRFUNC, length);
-                //pst_notify_message(comp->tcp, local_body_buf, length);
-				pst_notify_packet(comp->tcp, local_body_buf, length);
+    for (l = comp->socket_srcs_slist; l != NULL; l = l->next)
+    {
+        n_socket_source_t * s_source = l->data;
 
-                adjust_tcp_clock(agent, stream, comp);
+        if (s_source->socket && nice_socket_poll_fd(s_source->socket) == fd)
+            return s_source;
+    }
+    return NULL;
+}
 
-                /* Success! Handled out-of-band. */
-                retval = RECV_OOB;
-                goto done;
-            }
-            else if (pst_is_closed(comp->tcp))
-            {
-                nice_debug("[%s]: Received data on a pseudo tcp FAILED component. Ignoring.", G_STRFUNC);
+/* Runs on an executor thread for every readable socket */
+static void _agent_io_dispatch(int32_t fd, uint32_t events, void * data)
+{
+    n_socket_source_t * s_source;
 
-                retval = RECV_OOB;
-                goto done;
-            }
+    n_comp_t * comp = data;
+
+    if (!(events & (REACTOR_IN | REACTOR_ERR)))
+        return;
+    comp_lock(comp);
+    s_source = _agent_find_source(comp, fd);
+    if (s_source)
+    {
+        /* keeps s_source alive while agent_recv_packet() has the lock dropped */
+        s_source->readers++;
+        agent_recv_packet(s_source);
+        comp_release_source(comp, s_source);
+    }
+    comp_unlock(comp);
+}
+
+int32_t n_agent_set_early_queue(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, uint32_t max_bytes, int32_t policy)
+{
+    n_comp_t * comp;
+    int32_t ret = FALSE;
+
+    agent_lock(agent);
+    if (agent_find_comp(agent, stream_id, comp_id, NULL, &comp))
+    {
+        comp_lock(comp);
+        comp->early_queue.max_bytes = max_bytes;
+        comp->early_queue.policy = (policy == EARLY_DROP_NEWEST) ? EARLY_DROP_NEWEST : EARLY_DROP_OLDEST;
+        /* a lower cap applies to what is queued already */
+        while (comp->early_queue.bytes > max_bytes)
+        {
+            comp_early_pop(comp);
+            comp->recv_stats.early_dropped++;
         }
+        comp_unlock(comp);
+        ret = TRUE;
     }
+    agent_unlock(agent);
 
-done:
-    agent_unlock();
-    return retval;
+    return ret;
 }
 
-#define ANENT_MAX_FD 128
+int32_t n_agent_get_recv_stats(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, n_recv_stats_t * stats, int32_t reset)
+{
+    n_comp_t * comp;
+    int32_t ret = FALSE;
 
-void _agent_worker(void * arg)
+    if (stats == NULL)
+        return FALSE;
+
+    agent_lock(agent);
+    if (agent_find_comp(agent, stream_id, comp_id, NULL, &comp))
+    {
+        comp_lock(comp);
+        *stats = comp->recv_stats;
+        stats->deliver_queued = comp->deliver ? comp_deliver_queued(comp->deliver) : 0;
+        if (reset)
+            memset(&comp->recv_stats, 0, sizeof(n_recv_stats_t));
+        comp_unlock(comp);
+        ret = TRUE;
+    }
+    agent_unlock(agent);
+
+    return ret;
+}
+
+int32_t n_agent_get_send_stats(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, n_send_stats_t * stats, int32_t reset)
+{
+    n_comp_t * comp;
+    int32_t ret = FALSE;
+
+    if (stats == NULL)
+        return FALSE;
+
+    agent_lock(agent);
+    if (agent_find_comp(agent, stream_id, comp_id, NULL, &comp))
+    {
+        comp_lock(comp);
+        *stats = comp->send_stats;
+        if (reset)
+            memset(&comp->send_stats, 0, sizeof(n_send_stats_t));
+        comp_unlock(comp);
+        ret = TRUE;
+    }
+    agent_unlock(agent);
+
+    return ret;
+}
+
+int32_t n_agent_get_dgram_stats(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, n_dgram_stats_t * stats, int32_t reset)
+{
+    n_comp_t * comp;
+    int32_t ret = FALSE;
+
+    if (stats == NULL)
+        return FALSE;
+
+    agent_lock(agent);
+    if (agent_find_comp(agent, stream_id, comp_id, NULL, &comp))
+    {
+        comp_lock(comp);
+        *stats = comp->dgram_stats;
+        if (reset)
+            memset(&comp->dgram_stats, 0, sizeof(n_dgram_stats_t));
+        comp_unlock(comp);
+        ret = TRUE;
+    }
+    agent_unlock(agent);
+
+    return ret;
+}
+
+int32_t n_agent_io_start(int32_t threads, int32_t policy)
 {
-    n_comp_t * comp = (n_comp_t *)arg;
-    int poll_delay = 10;
-    int n, i, fd_idx = 0;
-    n_slist_t  * l;
-    n_socket_source_t * s_source, * s_srcs[ANENT_MAX_FD] = {NULL};
-    struct pollfd p[ANENT_MAX_FD] = {0};
+    if (executor_open(threads, policy, _agent_io_dispatch) < 0)
+        return -1;
+    if (executor_start() < 0)
+    {
+        executor_close();
+        return -1;
+    }
+    return 0;
+}
+
+void n_agent_io_stop(void)
+{
+    executor_close();
+}
+
+int32_t n_agent_io_set_busy_poll(int32_t spin_us, int32_t sock_us)
+{
+    return executor_set_busy_poll(spin_us, sock_us);
+}
+
+int32_t n_agent_io_get_stats(n_io_stats_t * stats, int32_t reset)
+{
+    EXECUTOR_STATS_S es;
+
+    if (stats == NULL || executor_get_stats(&es, reset) < 0)
+        return -1;
+    stats->spin_hits = es.spin_hits;
+    stats->spin_expired = es.spin_expired;
+    stats->wakeups = es.wakeups;
+    return 0;
+}
+
+/* Delivery threads, each waits on its own event handle for the kicks of
+ * the rings it serves; a NULL record tells it to exit */
+#define AGENT_DELIVER_MAX_THREADS  16
+#define AGENT_DELIVER_BATCH        64
+
+typedef struct
+{
+    int32_t num;
+    volatile int32_t next;          /* round robin cursor */
+    pthread_t tids[AGENT_DELIVER_MAX_THREADS];
+    int32_t events[AGENT_DELIVER_MAX_THREADS];
+} n_deliver_pool_t;
+
+static n_deliver_pool_t deliver_pool = { 0 };
+
+/* Event handle of the next delivery thread, round robin */
+static int32_t _agent_deliver_pick(void)
+{
+    return deliver_pool.events[(uint32_t)atomic_int_add(&deliver_pool.next, 1) % deliver_pool.num];
+}
+
+/* Hands every queued record to the I/O callback, then lets pseudo-TCP
+ * refill the ring if it had to leave data behind */
+static void _agent_deliver(n_deliver_ring_t * ring)
+{
+    n_comp_t * comp;
+    n_agent_recv_func func = NULL;
+    void * user_data = NULL;
+    const uint8_t * buf;
+    uint32_t len;
+
+    /* a push from here on kicks us again */
+    atomic_int_set(&ring->kicked, FALSE);
+    comp_deliver_callback(ring, &func, &user_data);
+
+    /* the component may be freed meanwhile, the ring carries all we need */
+    while (comp_deliver_peek(ring, &buf, &len))
+    {
+        if (func != NULL && !atomic_int_get(&ring->closed))
+            func(ring->agent, ring->stream_id, ring->comp_id, len, (char *)buf, user_data);
+        comp_deliver_consume(ring);
+    }
+
+    if (atomic_int_get(&ring->throttled) && (comp = comp_deliver_get(ring)) != NULL)
+    {
+        comp_lock(comp);
+        if (!atomic_int_get(&ring->closed) && comp->tcp && !pst_is_closed(comp->tcp))
+        {
+            atomic_int_set(&ring->throttled, FALSE);
+            pst_readable(comp->tcp, comp);
+            adjust_tcp_clock(comp->agent, comp->stream, comp);
+        }
+        comp_unlock(comp);
+        comp_deliver_put(comp);
+    }
+    comp_deliver_unref(ring);
+}
 
+static void _agent_deliver_loop(void * arg)
+{
+    int32_t event = (int32_t)(intptr_t)arg;
+    n_event_rec_t recs[AGENT_DELIVER_BATCH];
+    int32_t n, i, running = TRUE;
 
-    while (1)
+    while (running)
     {
-        for (l = comp->socket_srcs_slist; l != NULL; l = l->next)
+        if ((n = event_wait_batch(event, COMP_DELIVER_EVENT, recs, AGENT_DELIVER_BATCH)) < 0)
+            break;
+        for (i = 0; i < n; i++)
         {
-            s_source = l->data;
+            if (recs[i].n_data == NULL)
+                running = FALSE;
+            else
+                _agent_deliver(recs[i].n_data);
+        }
+    }
+    pthread_exit(NULL);
+}
 
-            if (s_source->socket && s_source->socket->sock_fd > 0)
-            {
-                p[fd_idx].fd = s_source->socket->sock_fd;
-                p[fd_idx].events = POLLIN;
-                s_srcs[fd_idx] = s_source;
-                if (fd_idx < ANENT_MAX_FD)
-                {
-                    fd_idx++;
-                }
-                else
-                {
-                    nice_debug("pollfd is overload\n");
-                }
-            }
+int32_t n_agent_delivery_start(int32_t threads)
+{
+    int32_t i;
+
+    if (deliver_pool.num > 0 || threads <= 0 || threads > AGENT_DELIVER_MAX_THREADS)
+        return -1;
+
+    for (i = 0; i < threads; i++)
+    {
+        if ((deliver_pool.events[i] = event_open()) < 0)
+            break;
+        if (pthread_create(&deliver_pool.tids[i], 0, (void *)_agent_deliver_loop, (void *)(intptr_t)deliver_pool.events[i]) != 0)
+        {
+            event_close(deliver_pool.events[i]);
+            break;
         }
+    }
+    deliver_pool.num = i;
+    deliver_pool.next = 0;
+    if (i < threads)
+    {
+        n_agent_delivery_stop();
+        return -1;
+    }
+    return 0;
+}
 
-        n = _poll(p, fd_idx, poll_delay);
-        if (n > 0)
+void n_agent_delivery_stop(void)
+{
+    int32_t i, num = deliver_pool.num;
+
+    /* no ring is handed a thread any more, and none still posts to one */
+    deliver_pool.num = 0;
+    comp_deliver_detach_all();
+
+    for (i = 0; i < num; i++)
+    {
+        /* the thread drains its queue, so the stop record gets in */
+        while (event_post(deliver_pool.events[i], COMP_DELIVER_EVENT, NULL) < 0)
+            sleep_ms(1);
+        pthread_join(deliver_pool.tids[i], NULL);
+        event_close(deliver_pool.events[i]);
+    }
+}
+
+int32_t n_agent_set_deferred_delivery(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, uint32_t high_water)
+{
+    n_comp_t * comp;
+    int32_t ret = FALSE;
+
+    if (deliver_pool.num == 0)
+        return FALSE;
+
+    agent_lock(agent);
+    if (agent_find_comp(agent, stream_id, comp_id, NULL, &comp))
+    {
+        comp_lock(comp);
+        if (comp->deliver != NULL)
         {
-            for (i = 0; i < fd_idx; i++)
+            n_deliver_ring_t * ring = comp->deliver;
+
+            /* left over from a stopped pool, it joins the new one */
+            if (ring->event < 0)
+                comp_deliver_attach(comp, _agent_deliver_pick());
+            /* the ring keeps its size, the mark only moves within it */
+            ring->high_water = MIN(high_water, ring->size / 2 - COMP_DELIVER_RECORD(COMP_DELIVER_CHUNK));
+            if (atomic_int_get(&ring->throttled) && comp->tcp && !pst_is_closed(comp->tcp))
             {
-                if (!(p[i].revents & POLLIN))
-                    continue;
-                agent_recv_packet(s_srcs[i]);
+                atomic_int_set(&ring->throttled, FALSE);
+                pst_readable(comp->tcp, comp);
+                adjust_tcp_clock(agent, comp->stream, comp);
             }
+            ret = TRUE;
         }
-        else if (n < 0)
+        else if (high_water == 0)
         {
-            nice_debug("poll err = %d\n", net_errno());
-            continue;
+            ret = TRUE;
         }
         else
         {
-            sleep_ms(1);
+            ret = comp_deliver_enable(comp, high_water, _agent_deliver_pick());
         }
-        fd_idx = 0;
+        comp_unlock(comp);
     }
+    agent_unlock(agent);
+
+    return ret;
 }
 
 int32_t n_agent_dispatcher(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id)
 {
     n_comp_t * comp = NULL;
     n_stream_t * stream = NULL;
-    int32_t ret = -1;
+    int32_t index, ret = 0;
 
+    agent_lock(agent);
     if (!agent_find_comp(agent, stream_id, comp_id, &stream, &comp))
     {
         nice_debug("could not find component %u in stream %u", comp_id, stream_id);
+        agent_unlock(agent);
+        return -1;
     }
 
-    ret = pthread_create(&worker_tid, 0, (void *)_agent_worker, (void *)comp);
+    /* sockets attached meanwhile see either no reactor or the one their
+     * sources get registered on here */
+    comp_lock(comp);
+    if (comp->reactor)
+    {
+        /* already served by an I/O thread */
+    }
+    else if ((index = executor_pick()) < 0)
+    {
+        nice_debug("[%s]: no I/O executor, call n_agent_io_start() first", G_STRFUNC);
+        ret = -1;
+    }
+    else
+    {
+        comp->io_thread = index;
+        comp->reactor = executor_reactor(index);
+        comp_reactor_sync(comp);
+    }
+    comp_unlock(comp);
+    agent_unlock(agent);
 
     return ret;
 }
@@ -2406,7 +3292,7 @@ int32_t n_agent_set_selected_pair(n_agent_t * agent, uint32_t stream_id, uint32_
     //g_return_val_if_fail(rfoundation, FALSE);
 
     //nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(agent);
 
     /* step: check that params specify an existing pair */
     if (!agent_find_comp(agent, stream_id, component_id, &stream, &component))
@@ -2422,12 +3308,13 @@ int32_t n_agent_set_selected_pair(n_agent_t * agent, uint32_t stream_id, uint32_
     /* step: stop connectivity checks (note: for the whole stream) */
     cocheck_prune_stream(agent, stream);
 
-    if  (pst_is_closed(component->tcp))
+    comp_lock(component);
+    if (agent->reliable && pst_is_closed(component->tcp))
     {
         nice_debug("[%s]: not setting selected pair for s%d:%d because "
                    "pseudo tcp socket does not exist in reliable mode", G_STRFUNC,
                    stream->id, component->id);
-        goto done;
+        goto unlock;
     }
 
     /* step: change component state */
@@ -2439,8 +3326,10 @@ int32_t n_agent_set_selected_pair(n_agent_t * agent, uint32_t stream_id, uint32_
 
     ret = TRUE;
 
+unlock:
+    comp_unlock(component);
 done:
-    agent_unlock();
+    agent_unlock(agent);
     return ret;
 }
 
@@ -2457,7 +3346,7 @@ int32_t n_agent_get_selected_pair(n_agent_t * agent, uint32_t stream_id, uint32_
     //g_return_val_if_fail(remote != NULL, FALSE);
 
     //nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(agent);
 
     /* step: check that params specify an existing pair */
     if (!agent_find_comp(agent, stream_id, component_id, &stream, &component))
@@ -2471,7 +3360,7 @@ int32_t n_agent_get_selected_pair(n_agent_t * agent, uint32_t stream_id, uint32_
     }
 
 done:
-    agent_unlock();
+    agent_unlock(agent);
 
     return ret;
 }
@@ -2491,7 +3380,7 @@ int32_t n_agent_set_selected_rcand(n_agent_t * agent, uint32_t stream_id, uint32
     //g_return_val_if_fail(candidate != NULL, FALSE);
 
     //nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(agent);
 
     /* step: check if the component exists*/
     if (!agent_find_comp(agent, stream_id, component_id, &stream, &component))
@@ -2502,6 +3391,8 @@ int32_t n_agent_set_selected_rcand(n_agent_t * agent, uint32_t stream_id, uint32
     /* step: stop connectivity checks (note: for the whole stream) */
     cocheck_prune_stream(agent, stream);
 
+    comp_lock(component);
+
     /* Store previous selected pair */
     local = component->selected_pair.local;
     remote = component->selected_pair.remote;
@@ -2510,7 +3401,7 @@ int32_t n_agent_set_selected_rcand(n_agent_t * agent, uint32_t stream_id, uint32
     /* step: set the selected pair */
     lcandidate = comp_set_selected_remote_cand(agent, component, candidate);
     if (!lcandidate)
-        goto done;
+        goto unlock;
 
     if (agent->reliable && pst_is_closed(component->tcp))
     {
@@ -2521,7 +3412,7 @@ int32_t n_agent_set_selected_rcand(n_agent_t * agent, uint32_t stream_id, uint32
         component->selected_pair.local = local;
         component->selected_pair.remote = remote;
         component->selected_pair.priority = (uint32_t)priority;
-        goto done;
+        goto unlock;
     }
 
     /* step: change component state */
@@ -2530,8 +3421,10 @@ int32_t n_agent_set_selected_rcand(n_agent_t * agent, uint32_t stream_id, uint32
 
     ret = TRUE;
 
+unlock:
+    comp_unlock(component);
 done:
-    agent_unlock();
+    agent_unlock(agent);
     return ret;
 }
 
@@ -2553,12 +3446,13 @@ void n_agent_set_stream_tos(n_agent_t * agent, uint32_t stream_id, int32_t tos)
     //g_return_if_fail(stream_id >= 1);
 
     nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(agent);
 
     stream = agent_find_stream(agent, stream_id);
     if (stream == NULL)
         goto done;
 
+    stream_lock(stream);
     stream->tos = tos;
     for (i = stream->components; i; i = i->next)
     {
@@ -2571,9 +3465,10 @@ void n_agent_set_stream_tos(n_agent_t * agent, uint32_t stream_id, int32_t tos)
             _set_socket_tos(agent, local_candidate->sockptr, tos);
         }
     }
+    stream_unlock(stream);
 
 done:
-    agent_unlock();
+    agent_unlock(agent);
 }
 
 int32_t n_agent_forget_relays(n_agent_t * agent, uint32_t stream_id, uint32_t component_id)
@@ -2581,7 +3476,7 @@ int32_t n_agent_forget_relays(n_agent_t * agent, uint32_t stream_id, uint32_t co
     n_comp_t * component;
     int32_t ret = TRUE;
 
-    agent_lock();
+    agent_lock(agent);
 
     if (!agent_find_comp(agent, stream_id, component_id, NULL, &component))
     {
@@ -2592,7 +3487,7 @@ int32_t n_agent_forget_relays(n_agent_t * agent, uint32_t stream_id, uint32_t co
     component_clean_turn_servers(component);
 
 done:
-    agent_unlock();
+    agent_unlock(agent);
 
     return ret;
 }
@@ -2610,12 +3505,12 @@ n_comp_state_e n_agent_get_comp_state(n_agent_t * agent, uint32_t stream_id, uin
     n_comp_t * component;
 
     //nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(agent);
 
     if (agent_find_comp(agent, stream_id, component_id, NULL, &component))
         state = component->state;
 
-    agent_unlock();
+    agent_unlock(agent);
 
     return state;
 }
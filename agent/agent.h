@@ -197,11 +197,68 @@ typedef void (*n_agent_recv_func)(n_agent_t * agent, uint32_t stream_id, uint32_
  *
  * Create a new #n_agent_t.
  * The returned object must be freed with g_object_unref()
+ * All timers of the agent run on one timer loop, picked round robin among
+ * the loops opened with timer_open_loops()
  *
  * Returns: The new agent GObject
  */
 n_agent_t * n_agent_new();
 
+/**
+ * n_agent_set_reliable:
+ * @agent: The #n_agent_t Object
+ * @reliable: %TRUE for a pseudo-TCP stream per component (the default),
+ * %FALSE for plain datagrams
+ *
+ * In unreliable mode no pseudo-TCP socket is created: every datagram given
+ * to n_agent_send() goes out as one UDP packet on the selected pair, and
+ * every non-STUN datagram received is handed to the n_agent_attach_recv()
+ * callback straight from the receive buffer. Nothing is retransmitted or
+ * reordered, see n_agent_get_dgram_stats() for what was lost.
+ *
+ * Must be called before the first n_agent_add_stream().
+ *
+ * Returns: %TRUE if the mode has been set, %FALSE if streams exist already
+ */
+int n_agent_set_reliable(n_agent_t * agent, int32_t reliable);
+
+/**
+ * n_agent_set_rx_shards:
+ * @agent: The #n_agent_t Object
+ * @n_shards: Number of sockets behind every host candidate, 1 to disable
+ * @steer: %TRUE to pick the socket by source address
+ *
+ * Host candidates gathered afterwards are bound by @n_shards SO_REUSEPORT
+ * sockets. Once n_agent_dispatcher() gave the component an I/O thread, each
+ * extra socket is read by one of the following threads, so the receive
+ * syscalls of a busy port run on several cores. Replies always leave from
+ * the first socket. With @steer a BPF program makes every datagram of a
+ * peer land on the same socket, otherwise the kernel hashes the 4-tuple.
+ *
+ * Falls back to one socket where SO_REUSEPORT is not available.
+ *
+ * Returns: %TRUE if @n_shards is valid, %FALSE otherwise
+ */
+int32_t n_agent_set_rx_shards(n_agent_t * agent, uint32_t n_shards, int32_t steer);
+
+/**
+ * n_agent_set_io_uring:
+ * @agent: The #n_agent_t Object
+ * @enable: %TRUE to use io_uring sockets
+ *
+ * Host candidates gathered afterwards are bound by an io_uring socket: a
+ * multishot receive fills a registered buffer ring and the datagrams of one
+ * readiness event are handed to the stream without a syscall each, replies
+ * made while handling them are submitted together. Such a candidate is not
+ * split into receive shards.
+ *
+ * Falls back to a plain UDP socket where io_uring is not available (before
+ * Linux 6.0, or outside Linux).
+ *
+ * Returns: %TRUE
+ */
+int32_t n_agent_set_io_uring(n_agent_t * agent, int32_t enable);
+
 /**
  * n_agent_add_local_addr:
  * @agent: The #n_agent_t Object
@@ -406,6 +463,9 @@ int n_agent_get_local_credentials(n_agent_t * agent, uint32_t stream_id, char **
  **/
 int n_agent_set_remote_cands(n_agent_t * agent, uint32_t stream_id, uint32_t component_id, const n_slist_t  * candidates);
 
+/* Returned by the send functions when nothing could be queued right now */
+#define N_AGENT_SEND_WOULDBLOCK  (-2)
+
 /**
  * n_agent_send:
  * @agent: The #n_agent_t Object
@@ -422,11 +482,10 @@ int n_agent_set_remote_cands(n_agent_t * agent, uint32_t stream_id, uint32_t com
      in any state if component was in READY state before and was then restarted
    </para>
    <para>
-   In reliable mode, the -1 error value means either that you are not yet
-   connected or that the send buffer is full (equivalent to EWOULDBLOCK).
-   In both cases, you simply need to wait for the
-   #n_agent_t::reliable-transport-writable signal to be fired before resending
-   the data.
+   %N_AGENT_SEND_WOULDBLOCK means either that you are not yet connected or
+   that the send buffer is full. In reliable mode wait for the
+   n_agent_set_writable_cb() callback, or use n_agent_send_all(), before
+   resending the data. -1 means the pseudo-TCP socket is closed or failed.
    </para>
    <para>
    In non-reliable mode, it will virtually never happen with UDP sockets, but
@@ -439,10 +498,86 @@ int n_agent_set_remote_cands(n_agent_t * agent, uint32_t stream_id, uint32_t com
    </para>
 </note>
  *
- * Returns: The number of bytes sent, or negative error code
+ * Returns: The number of bytes sent, %N_AGENT_SEND_WOULDBLOCK or -1
  */
 int32_t n_agent_send(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, uint32_t len, const char * buf);
 
+/**
+ * n_agent_send_msgs:
+ * @agent: The #n_agent_t Object
+ * @stream_id: The ID of the stream to send to
+ * @comp_id: The ID of the component to send to
+ * @msgs: (array length=n_msgs): The messages to send, each a scatter-gather
+ * array of #n_outvector_t, so a header and its payload need not be copied
+ * into one buffer
+ * @n_msgs: The number of messages in @msgs
+ * @allow_partial: %TRUE to accept as many bytes as fit in the send buffer,
+ * %FALSE to accept whole messages only
+ *
+ * Sends several messages over a stream's component with one lock
+ * acquisition and one pseudo-TCP clock adjustment. Same conditions as
+ * n_agent_send() apply; a message that is not accepted must be sent again
+ * once the n_agent_set_writable_cb() callback fires.
+ *
+ * Returns: The number of bytes accepted if @allow_partial is %TRUE, the
+ * number of messages accepted otherwise, %N_AGENT_SEND_WOULDBLOCK if none
+ * fit, or -1 on errors
+ */
+int32_t n_agent_send_msgs(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id,
+                          const n_output_msg_t * msgs, uint32_t n_msgs, int32_t allow_partial);
+
+/**
+ * n_agent_send_all:
+ * @agent: The #n_agent_t Object
+ * @stream_id: The ID of the stream to send to
+ * @comp_id: The ID of the component to send to
+ * @len: The length of the buffer to send
+ * @buf: The buffer of data to send
+ * @timeout_ms: Milliseconds to wait for send space at most, -1 for no limit
+ *
+ * Like n_agent_send() but sleeps whenever the send buffer is full until the
+ * whole buffer is queued. Must not be called from an agent callback, the
+ * wait needs the component lock to be free.
+ *
+ * Returns: @len, the bytes queued before the timeout or an error, or
+ * n_agent_send()'s result if nothing was queued
+ */
+int32_t n_agent_send_all(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, uint32_t len, const char * buf, int32_t timeout_ms);
+
+/**
+ * n_agent_writable_func:
+ * @agent: The #n_agent_t Object
+ * @stream_id: The id of the stream
+ * @component_id: The id of the component
+ * @user_data: The user data set in n_agent_set_writable_cb()
+ *
+ * Callback function when a component's send buffer has room again
+ */
+typedef void (*n_agent_writable_func)(n_agent_t * agent, uint32_t stream_id, uint32_t component_id, void * user_data);
+
+/**
+ * n_agent_set_writable_cb:
+ * @agent: The #n_agent_t Object
+ * @stream_id: The ID of the stream
+ * @comp_id: The ID of the component
+ * @low_water: Free send buffer bytes that count as writable, 0 for any
+ * @func: The callback, %NULL to remove it
+ * @data: user data passed to @func
+ *
+ * Once a reliable send returned %N_AGENT_SEND_WOULDBLOCK or left less than
+ * @low_water bytes free, @func is called once as soon as the free space is
+ * back at @low_water (capped to the size of the send buffer). It is armed
+ * again by the next send that runs short, so a sender that keeps writing
+ * until it is told to stop gets exactly one call per stall.
+ *
+ * @func runs on an I/O or timer thread without the component lock; it may
+ * send but should not block.
+ *
+ * Returns: %TRUE on success, %FALSE if the component was not found
+ */
+int32_t n_agent_set_writable_cb(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, uint32_t low_water,
+                                n_agent_writable_func func, void * data);
+
 
 /**
  * n_agent_get_local_cands:
@@ -697,6 +832,243 @@ n_comp_state_e n_agent_get_comp_state(n_agent_t * agent, uint32_t stream_id,  ui
 
 void nice_print_cand(n_agent_t * agent, n_cand_t * l_cand, n_cand_t * r_cand);
 
+/* What a received datagram was taken for, from its first byte as laid out
+ * by RFC 7983 and the STUN magic cookie */
+typedef enum
+{
+    N_DEMUX_STUN,                   /* valid STUN message */
+    N_DEMUX_CHANNEL_DATA,           /* TURN ChannelData, 64..79 on a socket a relay is allocated through */
+    N_DEMUX_PSEUDO_TCP,             /* pseudo-TCP segment, reliable mode */
+    N_DEMUX_APP,                    /* application datagram, unreliable mode */
+    N_DEMUX_REJECTED,               /* none of the above or failed validation */
+    N_DEMUX_CLASSES
+} n_demux_class_e;
+
+/**
+ * n_recv_stats_t:
+ * @packets: datagrams received
+ * @syscalls: receive syscalls made, packets / syscalls is the average batch
+ * @bytes: payload bytes received
+ * @max_batch: largest number of datagrams read in one wakeup
+ * @early_queued: packets kept because no pair was selected yet
+ * @early_dropped: early packets dropped by the cap, see n_agent_set_early_queue()
+ * @demux: datagrams per #n_demux_class_e
+ * @stun_validated: datagrams that went through full STUN validation
+ * @deliver_queued: bytes waiting for the delivery thread right now
+ * @deliver_throttled: times pseudo-TCP data was left in its receive buffer
+ * because the delivery ring was past its high-water mark
+ *
+ * Receive counters of a component, see n_agent_get_recv_stats().
+ */
+typedef struct
+{
+    uint64_t packets;
+    uint64_t syscalls;
+    uint64_t bytes;
+    uint32_t max_batch;
+    uint64_t early_queued;
+    uint64_t early_dropped;
+    uint64_t demux[N_DEMUX_CLASSES];
+    uint64_t stun_validated;
+    uint64_t deliver_queued;
+    uint64_t deliver_throttled;
+} n_recv_stats_t;
+
+typedef enum
+{
+    EARLY_DROP_OLDEST,              /* make room by dropping the oldest packets */
+    EARLY_DROP_NEWEST               /* drop the packet that does not fit */
+} n_early_drop_e;
+
+/**
+ * n_agent_set_early_queue:
+ * @agent: The #n_agent_t Object
+ * @stream_id: The ID of the stream
+ * @comp_id: The ID of the component
+ * @max_bytes: Payload kept at most, 32 KB by default
+ * @policy: An #n_early_drop_e telling what goes once @max_bytes is reached
+ *
+ * Pseudo-TCP packets that arrive before a pair is selected are kept in a
+ * ring of at most 64 slots and handed over once the pair is selected.
+ *
+ * Returns: %TRUE if the component was found, %FALSE otherwise
+ */
+int32_t n_agent_set_early_queue(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, uint32_t max_bytes, int32_t policy);
+
+/**
+ * n_agent_get_recv_stats:
+ * @agent: The #n_agent_t Object
+ * @stream_id: The ID of the stream
+ * @comp_id: The ID of the component
+ * @stats: Filled with the counters of the component
+ * @reset: Clear the counters after reading them
+ *
+ * Returns: %TRUE if the component was found, %FALSE otherwise
+ */
+int32_t n_agent_get_recv_stats(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, n_recv_stats_t * stats, int32_t reset);
+
+/**
+ * n_send_stats_t:
+ * @packets: pseudo-TCP segments sent
+ * @syscalls: send syscalls made, packets / syscalls is the average batch
+ * @bytes: bytes sent, pseudo-TCP headers included
+ * @max_batch: largest number of segments sent in one flush
+ *
+ * Pseudo-TCP transmit counters of a component, see n_agent_get_send_stats().
+ */
+typedef struct
+{
+    uint64_t packets;
+    uint64_t syscalls;
+    uint64_t bytes;
+    uint32_t max_batch;
+} n_send_stats_t;
+
+/**
+ * n_agent_get_send_stats:
+ * @agent: The #n_agent_t Object
+ * @stream_id: The ID of the stream
+ * @comp_id: The ID of the component
+ * @stats: Filled with the counters of the component
+ * @reset: Clear the counters after reading them
+ *
+ * Returns: %TRUE if the component was found, %FALSE otherwise
+ */
+int32_t n_agent_get_send_stats(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, n_send_stats_t * stats, int32_t reset);
+
+/**
+ * n_dgram_stats_t:
+ * @rx_packets: data datagrams received
+ * @rx_dropped: data datagrams dropped because no receive callback was
+ * attached
+ * @rx_lost: gaps in the RTP sequence numbers of the datagrams received
+ * @rx_reordered: RTP datagrams received after a later sequence number
+ * @tx_packets: datagrams sent
+ * @tx_dropped: datagrams the socket refused to send
+ *
+ * Counters of a component in unreliable mode, see n_agent_set_reliable().
+ * Datagrams that do not look like RTP are not checked for loss or order.
+ */
+typedef struct
+{
+    uint64_t rx_packets;
+    uint64_t rx_dropped;
+    uint64_t rx_lost;
+    uint64_t rx_reordered;
+    uint64_t tx_packets;
+    uint64_t tx_dropped;
+} n_dgram_stats_t;
+
+/**
+ * n_agent_get_dgram_stats:
+ * @agent: The #n_agent_t Object
+ * @stream_id: The ID of the stream
+ * @comp_id: The ID of the component
+ * @stats: Filled with the counters of the component
+ * @reset: Clear the counters after reading them
+ *
+ * Returns: %TRUE if the component was found, %FALSE otherwise
+ */
+int32_t n_agent_get_dgram_stats(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, n_dgram_stats_t * stats, int32_t reset);
+
+/**
+ * n_agent_io_start:
+ * @threads: Number of I/O threads, shared by every agent
+ * @policy: An #EXECUTOR_POLICY_E telling how components are spread over
+ * the threads
+ *
+ * Opens and starts the I/O executor. Must be called once before
+ * n_agent_dispatcher(); n_agent_io_stop() stops and joins the threads.
+ *
+ * Returns: 0 on success, -1 otherwise
+ */
+int32_t n_agent_io_start(int32_t threads, int32_t policy);
+
+void n_agent_io_stop(void);
+
+/**
+ * n_agent_io_set_busy_poll:
+ * @spin_us: How long an I/O thread keeps polling without blocking after it
+ * handled packets, 0 to block right away (the default)
+ * @sock_us: SO_BUSY_POLL set on sockets handed to the threads afterwards,
+ * 0 to leave them alone (Linux only)
+ *
+ * Trades CPU for latency: a packet arriving within @spin_us of the previous
+ * one is picked up without a wakeup. See n_agent_io_get_stats() for how
+ * often that happens.
+ *
+ * Returns: 0 on success, -1 otherwise
+ */
+int32_t n_agent_io_set_busy_poll(int32_t spin_us, int32_t sock_us);
+
+/**
+ * n_io_stats_t:
+ * @spin_hits: packets found while busy polling
+ * @spin_expired: busy poll budgets that ran out before a packet came
+ * @wakeups: packets found after blocking
+ *
+ * Counters of all I/O threads, see n_agent_io_set_busy_poll().
+ */
+typedef struct
+{
+    uint64_t spin_hits;
+    uint64_t spin_expired;
+    uint64_t wakeups;
+} n_io_stats_t;
+
+int32_t n_agent_io_get_stats(n_io_stats_t * stats, int32_t reset);
+
+/**
+ * n_agent_delivery_start:
+ * @threads: Number of delivery threads, shared by every agent
+ *
+ * Starts the threads that run the I/O callbacks of components set up with
+ * n_agent_set_deferred_delivery(). n_agent_delivery_stop() joins them;
+ * components still set up that way go back to inline callbacks, what they
+ * had queued is delivered before the threads exit, and a later
+ * n_agent_set_deferred_delivery() hands them to the new threads.
+ *
+ * Returns: 0 on success, -1 otherwise
+ */
+int32_t n_agent_delivery_start(int32_t threads);
+
+void n_agent_delivery_stop(void);
+
+/**
+ * n_agent_set_deferred_delivery:
+ * @agent: The #n_agent_t Object
+ * @stream_id: The ID of the stream
+ * @comp_id: The ID of the component
+ * @high_water: Bytes queued for the callback at most, 0 for inline callbacks
+ *
+ * Received data is copied into a ring of the component and the
+ * n_agent_attach_recv() callback is run by one of the threads of
+ * n_agent_delivery_start() instead of the I/O thread, so a slow callback
+ * does not hold up the socket. Once @high_water bytes are queued,
+ * pseudo-TCP data is left in its receive buffer, which shrinks the window
+ * advertised to the sender; in unreliable mode datagrams are dropped.
+ *
+ * The ring is sized by the first call, a later @high_water is capped to
+ * it. Data still queued when switching back to inline callbacks is
+ * delivered by the delivery thread.
+ *
+ * Returns: %TRUE on success, %FALSE if the component was not found or no
+ * delivery thread is running
+ */
+int32_t n_agent_set_deferred_delivery(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, uint32_t high_water);
+
+/**
+ * n_agent_dispatcher:
+ * @agent: The #n_agent_t Object
+ * @stream_id: The ID of the stream
+ * @comp_id: The ID of the component
+ *
+ * Hands the sockets of the component to one of the I/O threads started by
+ * n_agent_io_start(); a component is served by one thread, apart from the
+ * receive shards set up by n_agent_set_rx_shards().
+ *
+ * Returns: 0 on success, -1 otherwise
+ */
 int32_t n_agent_dispatcher(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id);
 
 void n_networking_init(void);
@@ -12,11 +12,20 @@ static volatile unsigned int n_components_destroyed = 0;
 #include "discovery.h"
 #include "agent-priv.h"
 #include "timer.h"
+#include "executor.h"
+#include "event.h"
 #include "uv.h"
 
 static void comp_sched_io_cb(n_comp_t * component);
 static void comp_desched_io_cb(n_comp_t * component);
 
+/* Guards what delivery threads read of a component through its ring, the
+ * ring's comp, func and user_data, and deliver_users, and the list of rings
+ * still posting to a delivery thread */
+static pthread_mutex_t deliver_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t deliver_idle = PTHREAD_COND_INITIALIZER;
+static n_slist_t * deliver_rings = NULL;
+
 void incoming_check_free(n_inchk_t * icheck)
 {
     n_free(icheck->username);
@@ -31,6 +40,27 @@ static void socket_source_free(n_socket_source_t * source)
     n_slice_free(n_socket_source_t, source);
 }
 
+/* Frees a source taken off the component, unless an I/O thread is reading
+ * from it with the component lock dropped: the last one frees it then.
+ * Returns the source when the caller has to free it. */
+static n_socket_source_t * _source_drop(n_socket_source_t * source)
+{
+    if (source->readers > 0)
+    {
+        source->detached = TRUE;
+        return NULL;
+    }
+    return source;
+}
+
+/* Caller holds the component lock, pairs with the readers++ done before
+ * agent_recv_packet() */
+void comp_release_source(n_comp_t * comp, n_socket_source_t * source)
+{
+    if (--source->readers == 0 && source->detached)
+        socket_source_free(source);
+}
+
 n_comp_t * comp_new(uint32_t id, n_agent_t * agent, n_stream_t * stream)
 {
     n_comp_t * comp;
@@ -48,7 +78,21 @@ n_comp_t * comp_new(uint32_t id, n_agent_t * agent, n_stream_t * stream)
 
     n_agent_init_stun_agent(agent, &comp->stun_agent);
 
+    agent_mutex_init(&comp->mutex);
     pthread_mutex_init(&comp->io_mutex, NULL);
+#ifndef _WIN32
+    {
+        pthread_condattr_t attr;
+
+        /* n_agent_send_all() deadlines are monotonic */
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&comp->writable_cond, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+#else
+    pthread_cond_init(&comp->writable_cond, NULL);
+#endif
     n_queue_init(&comp->pend_io_msgs);
     comp->io_callback_id = 0;
 
@@ -58,7 +102,8 @@ n_comp_t * comp_new(uint32_t id, n_agent_t * agent, n_stream_t * stream)
     /*comp_set_io_context(comp, NULL);
     comp_set_io_callback(comp, NULL, NULL);*/
 
-    n_queue_init(&comp->queued_tcp_packets);
+    comp->early_queue.max_bytes = COMP_EARLY_MAX_BYTES;
+    comp->early_queue.policy = EARLY_DROP_OLDEST;
 
     return comp;
 }
@@ -136,12 +181,43 @@ static void comp_clear_selected_pair(n_comp_t * comp)
     memset(&comp->selected_pair, 0, sizeof(n_cand_pair_t));
 }
 
+void comp_lock(n_comp_t * comp)
+{
+    pthread_mutex_lock(&comp->mutex);
+    comp->lock_depth++;
+}
+
+void comp_unlock(n_comp_t * comp)
+{
+    comp->lock_depth--;
+    pthread_mutex_unlock(&comp->mutex);
+}
+
+int32_t comp_unlock_all(n_comp_t * comp)
+{
+    int32_t depth = comp->lock_depth;
+    int32_t i;
+
+    for (i = 0; i < depth; i++)
+        comp_unlock(comp);
+    return depth;
+}
+
+void comp_relock(n_comp_t * comp, int32_t depth)
+{
+    while (depth-- > 0)
+        comp_lock(comp);
+}
+
 /* Must be called with the agent lock held as it touches internal n_comp_t
  * state. */
 void component_close(n_comp_t * comp)
 {
     IOCallbackData * data;
-    n_outvector_t * vec;
+
+    comp_lock(comp);
+    /* I/O threads that dropped the lock midway check this on the way back */
+    comp->closed = TRUE;
 
     /* Start closing the pseudo-TCP socket first. FIXME: There is a very big and
      * reliably triggerable race here. pst_close() does not block
@@ -174,6 +250,11 @@ void component_close(n_comp_t * comp)
     n_slist_free_full(comp->remote_candidates, (n_destroy_notify) n_cand_free);
     comp->remote_candidates = NULL;
     component_free_socket_sources(comp);
+    if (comp->reactor)
+    {
+        executor_release(comp->io_thread);
+        comp->reactor = 0;
+    }
     n_slist_free_full(comp->incoming_checks, (n_destroy_notify) incoming_check_free);
     comp->incoming_checks = NULL;
 
@@ -202,11 +283,23 @@ void component_close(n_comp_t * comp)
 
     //g_cancellable_cancel(comp->stop_cancellable);
 
-    while ((vec = n_queue_pop_head(&comp->queued_tcp_packets)) != NULL)
-    {
-        n_free((void *) vec->buffer);
-        n_slice_free(n_outvector_t, vec);
-    }
+    comp_early_clear(comp);
+
+    /* what the delivery thread has not handed over yet is dropped */
+    if (comp->deliver)
+        atomic_int_set(&comp->deliver->closed, TRUE);
+    comp_deliver_disable(comp);
+
+    /* senders blocked in n_agent_send_all() find the socket closed */
+    comp->writable_armed = FALSE;
+    comp->writable_cb = NULL;
+    pthread_cond_broadcast(&comp->writable_cond);
+
+    /* the sockets of unflushed segments are gone */
+    comp->send_batch.n_bufs = 0;
+    comp->send_batch.used = 0;
+
+    comp_unlock(comp);
 }
 
 /* Must be called with the agent lock released as it could dispose of
@@ -221,7 +314,25 @@ void component_free(n_comp_t * cmp)
     //g_clear_object(&cmp->tcp);
     //g_clear_object(&cmp->stop_cancellable);
     //g_clear_object(&cmp->iostream);
+
+    /* component_close() took the sockets off the reactors, an I/O thread
+     * may still be in the middle of a batch collected before that */
+    executor_quiesce();
+
+    /* and a delivery thread may be refilling its ring */
+    pthread_mutex_lock(&deliver_mutex);
+    while (cmp->deliver_users > 0)
+        pthread_cond_wait(&deliver_idle, &deliver_mutex);
+    pthread_mutex_unlock(&deliver_mutex);
+
+    pthread_cond_destroy(&cmp->writable_cond);
     pthread_mutex_destroy(&cmp->io_mutex);
+    pthread_mutex_destroy(&cmp->mutex);
+
+    if (cmp->send_batch.data)
+        n_slice_free1(COMP_SEND_BATCH_DATA, cmp->send_batch.data);
+    if (cmp->early_queue.pool)
+        n_slice_free1(COMP_EARLY_SLOTS * COMP_EARLY_SLOT_SIZE, cmp->early_queue.pool);
 
 /*
     if (cmp->stop_cancellable_source != NULL)
@@ -341,11 +452,13 @@ void comp_update_selected_pair(n_comp_t * comp, const n_cand_pair_t * pair)
         comp->turn_candidate = NULL;
     }
 
+    comp_lock(comp);
     comp_clear_selected_pair(comp);
 
     comp->selected_pair.local = pair->local;
     comp->selected_pair.remote = pair->remote;
     comp->selected_pair.priority = pair->priority;
+    comp_unlock(comp);
 
 }
 
@@ -416,11 +529,13 @@ n_cand_t * comp_set_selected_remote_cand(n_agent_t * agent, n_comp_t * component
         agent_sig_new_remote_cand(agent, remote);
     }
 
+    comp_lock(component);
     comp_clear_selected_pair(component);
 
     component->selected_pair.local = local;
     component->selected_pair.remote = remote;
     component->selected_pair.priority = (uint32_t)priority;
+    comp_unlock(component);
 
     return local;
 }
@@ -433,6 +548,60 @@ static int32_t _find_socket_source(const void * a, const void * b)
     return (source_a->socket == socket_b) ? 0 : 1;
 }
 
+/* A primary socket is read by the I/O thread serving the component, shard k
+ * of it by the k-th thread after that one */
+static void _source_register(n_comp_t * comp, n_socket_source_t * source)
+{
+    int32_t reactor = comp->reactor;
+
+    if (!comp->reactor || nice_socket_poll_fd(source->socket) <= 0)
+        return;
+    if (source->shard > 0 && executor_thread_count() > 1)
+        reactor = executor_reactor((comp->io_thread + source->shard) % executor_thread_count());
+    if (source->reactor && source->reactor != reactor)
+        reactor_del(source->reactor, nice_socket_poll_fd(source->socket));
+    if (executor_sock_busy_poll() > 0)
+        nice_socket_set_busy_poll(source->socket, executor_sock_busy_poll());
+    reactor_add(reactor, nice_socket_poll_fd(source->socket), REACTOR_IN, comp);
+    source->reactor = reactor;
+}
+
+static void _source_unregister(n_socket_source_t * source)
+{
+    if (source->reactor && nice_socket_poll_fd(source->socket) > 0)
+        reactor_del(source->reactor, nice_socket_poll_fd(source->socket));
+    source->reactor = 0;
+}
+
+/* Registers every socket source of comp once it got an I/O thread, sockets
+ * attached later are registered by comp_attach_socket() itself */
+void comp_reactor_sync(n_comp_t * comp)
+{
+    n_slist_t * l;
+
+    comp_lock(comp);
+    for (l = comp->socket_srcs_slist; l != NULL; l = l->next)
+        _source_register(comp, l->data);
+    comp_unlock(comp);
+}
+
+/* A relay got allocated through base: TURN ChannelData can arrive on it and
+ * its receive shards from now on */
+void comp_mark_turn_base(n_comp_t * comp, n_socket_t * base)
+{
+    n_slist_t * l;
+
+    comp_lock(comp);
+    for (l = comp->socket_srcs_slist; l != NULL; l = l->next)
+    {
+        n_socket_source_t * source = l->data;
+
+        if (source->socket == base || source->primary == base)
+            source->turn = TRUE;
+    }
+    comp_unlock(comp);
+}
+
 /* This takes ownership of the socket.
  * It creates and attaches a source to the components context. */
 void comp_attach_socket(n_comp_t * comp, n_socket_t * nicesock)
@@ -441,6 +610,7 @@ void comp_attach_socket(n_comp_t * comp, n_socket_t * nicesock)
     n_socket_source_t * socket_source;
 
     /* nicesock, ûеĻһµģӵβ */
+    comp_lock(comp);
     l = n_slist_find_custom(comp->socket_srcs_slist, nicesock, _find_socket_source);
     if (l != NULL)
     {
@@ -454,12 +624,46 @@ void comp_attach_socket(n_comp_t * comp, n_socket_t * nicesock)
         comp->socket_srcs_slist = n_slist_prepend(comp->socket_srcs_slist, socket_source);
         comp->socket_sources_age++;
     }
+
+    _source_register(comp, socket_source);
+    comp_unlock(comp);
     
     nice_debug("[%s]: n_comp_t %p: attach source (fd %d)", G_STRFUNC, comp, nicesock->sock_fd);
     
     //socket_source_attach(socket_source, comp->ctx);
 }
 
+/* Takes ownership of shard, an SO_REUSEPORT socket bound to the address of
+ * primary. It is only read from: what arrives on it is handled as if it had
+ * arrived on primary, which stays the one every reply is sent from. */
+void comp_attach_shard(n_comp_t * comp, n_socket_t * primary, n_socket_t * shard)
+{
+    n_slist_t * l;
+    n_socket_source_t * socket_source;
+    int32_t n_shards = 0;
+
+    comp_lock(comp);
+    for (l = comp->socket_srcs_slist; l != NULL; l = l->next)
+    {
+        if (((n_socket_source_t *)l->data)->primary == primary)
+            n_shards++;
+    }
+
+    socket_source = n_slice_new0(n_socket_source_t);
+    socket_source->socket = shard;
+    socket_source->component = comp;
+    socket_source->primary = primary;
+    socket_source->shard = n_shards + 1;
+    comp->socket_srcs_slist = n_slist_prepend(comp->socket_srcs_slist, socket_source);
+    comp->socket_sources_age++;
+
+    _source_register(comp, socket_source);
+    comp_unlock(comp);
+
+    nice_debug("[%s]: n_comp_t %p: attach shard %d of fd %d (fd %d)", G_STRFUNC, comp,
+               socket_source->shard, primary->sock_fd, shard->sock_fd);
+}
+
 /* Reattaches socket handles of @component to the main context.
  *
  * Must *not* take the agent lock, since it?s called from within
@@ -511,17 +715,42 @@ void component_detach_socket(n_comp_t * component, n_socket_t * nicesock)
     }
 
     /* Find the n_socket_source_t for the socket. */
+    comp_lock(component);
     l = n_slist_find_custom(component->socket_srcs_slist, nicesock,  _find_socket_source);
     if (l == NULL)
+    {
+        comp_unlock(component);
         return;
+    }
 
     /* Detach the source. */
     socket_source = l->data;
     component->socket_srcs_slist = n_slist_delete_link(component->socket_srcs_slist, l);
     component->socket_sources_age++;
 
+    _source_unregister(socket_source);
+
+    /* the receive shards go with their primary */
+    for (l = component->socket_srcs_slist; l != NULL;)
+    {
+        n_socket_source_t * shard_source = l->data;
+        n_slist_t * next = l->next;
+
+        if (shard_source->primary == nicesock)
+        {
+            component->socket_srcs_slist = n_slist_delete_link(component->socket_srcs_slist, l);
+            _source_unregister(shard_source);
+            if (_source_drop(shard_source))
+                socket_source_free(shard_source);
+        }
+        l = next;
+    }
+    socket_source = _source_drop(socket_source);
+    comp_unlock(component);
+
     //socket_source_detach(socket_source);
-    socket_source_free(socket_source);
+    if (socket_source)
+        socket_source_free(socket_source);
 }
 
 /*
@@ -545,15 +774,327 @@ void component_detach_all_sockets(n_comp_t * component)
 
 void component_free_socket_sources(n_comp_t * component)
 {
+    n_slist_t * l;
+
     nice_debug("Free socket sources for component %p.", component);
 
-    n_slist_free_full(component->socket_srcs_slist, (n_destroy_notify) socket_source_free);
+    comp_lock(component);
+    for (l = component->socket_srcs_slist; l != NULL; l = l->next)
+    {
+        _source_unregister(l->data);
+        if (_source_drop(l->data))
+            socket_source_free(l->data);
+    }
+
+    n_slist_free(component->socket_srcs_slist);
     component->socket_srcs_slist = NULL;
     component->socket_sources_age++;
+    comp_unlock(component);
 
     comp_clear_selected_pair(component);
 }
 
+/* Copies an early packet into the next free slot. Returns FALSE if it was
+ * dropped, either it or the oldest ones go when the cap is reached. */
+int32_t comp_early_push(n_comp_t * comp, const uint8_t * buf, uint32_t len)
+{
+    n_early_queue_t * q = &comp->early_queue;
+    uint32_t slot;
+
+    if (len > COMP_EARLY_SLOT_SIZE || len > q->max_bytes)
+    {
+        comp->recv_stats.early_dropped++;
+        return FALSE;
+    }
+    if (q->count == COMP_EARLY_SLOTS || q->bytes + len > q->max_bytes)
+    {
+        if (q->policy == EARLY_DROP_NEWEST)
+        {
+            comp->recv_stats.early_dropped++;
+            return FALSE;
+        }
+        while (q->count == COMP_EARLY_SLOTS || q->bytes + len > q->max_bytes)
+        {
+            comp_early_pop(comp);
+            comp->recv_stats.early_dropped++;
+        }
+    }
+    if (q->pool == NULL && (q->pool = n_slice_alloc(COMP_EARLY_SLOTS * COMP_EARLY_SLOT_SIZE)) == NULL)
+    {
+        comp->recv_stats.early_dropped++;
+        return FALSE;
+    }
+
+    slot = (q->head + q->count) % COMP_EARLY_SLOTS;
+    memcpy(q->pool + slot * COMP_EARLY_SLOT_SIZE, buf, len);
+    q->lens[slot] = len;
+    q->count++;
+    q->bytes += len;
+    comp->recv_stats.early_queued++;
+    return TRUE;
+}
+
+void comp_early_pop(n_comp_t * comp)
+{
+    n_early_queue_t * q = &comp->early_queue;
+
+    if (q->count == 0)
+        return;
+    q->bytes -= q->lens[q->head];
+    q->head = (q->head + 1) % COMP_EARLY_SLOTS;
+    q->count--;
+}
+
+/* Empties the ring, the pool is kept for the next connection */
+void comp_early_clear(n_comp_t * comp)
+{
+    comp->early_queue.head = 0;
+    comp->early_queue.count = 0;
+    comp->early_queue.bytes = 0;
+}
+
+/* Gives the component a delivery ring posting its kicks to event. The ring
+ * is sized for high_water plus a record on either side of the filler, so a
+ * record always fits once the delivery thread caught up. */
+int32_t comp_deliver_enable(n_comp_t * comp, uint32_t high_water, int32_t event)
+{
+    n_deliver_ring_t * ring;
+    uint32_t size = 4096;
+
+    if (high_water > (1U << 28))
+        return FALSE;
+    while (size < 2 * (high_water + COMP_DELIVER_RECORD(COMP_DELIVER_CHUNK)))
+        size <<= 1;
+
+    ring = n_slice_new0(n_deliver_ring_t);
+    if (ring == NULL)
+        return FALSE;
+    if ((ring->buf = n_slice_alloc(size)) == NULL)
+    {
+        n_slice_free(n_deliver_ring_t, ring);
+        return FALSE;
+    }
+    ring->size = size;
+    ring->high_water = high_water;
+    ring->refs = 1;
+    ring->event = event;
+    ring->agent = comp->agent;
+    ring->stream_id = comp->stream->id;
+    ring->comp_id = comp->id;
+    ring->comp = comp;
+    pthread_mutex_lock(&comp->io_mutex);
+    ring->func = comp->io_callback;
+    ring->user_data = comp->io_user_data;
+    pthread_mutex_unlock(&comp->io_mutex);
+
+    comp_deliver_disable(comp);
+    comp->deliver = ring;
+    pthread_mutex_lock(&deliver_mutex);
+    deliver_rings = n_slist_prepend(deliver_rings, ring);
+    pthread_mutex_unlock(&deliver_mutex);
+    return TRUE;
+}
+
+/* Points a ring cut off by comp_deliver_detach_all() at a delivery thread
+ * again, component lock held */
+void comp_deliver_attach(n_comp_t * comp, int32_t event)
+{
+    n_deliver_ring_t * ring = comp->deliver;
+
+    pthread_mutex_lock(&deliver_mutex);
+    ring->event = event;
+    deliver_rings = n_slist_prepend(deliver_rings, ring);
+    pthread_mutex_unlock(&deliver_mutex);
+}
+
+/* Before the delivery threads stop: every component goes back to inline
+ * callbacks and its ring stops posting. A ring with records or a throttled
+ * pseudo-TCP socket left is kicked a last time, so the thread still hands
+ * them over. Called without any lock held. */
+void comp_deliver_detach_all(void)
+{
+    n_deliver_ring_t * ring;
+    n_comp_t * comp;
+    int32_t event, kick;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&deliver_mutex);
+        if (deliver_rings == NULL)
+        {
+            pthread_mutex_unlock(&deliver_mutex);
+            break;
+        }
+        ring = deliver_rings->data;
+        deliver_rings = n_slist_delete_link(deliver_rings, deliver_rings);
+        /* listed rings are attached, so comp is set */
+        comp = ring->comp;
+        comp->deliver_users++;
+        pthread_mutex_unlock(&deliver_mutex);
+
+        kick = FALSE;
+        comp_lock(comp);
+        event = ring->event;
+        if (comp->deliver == ring && event >= 0)
+        {
+            ring->high_water = 0;
+            ring->event = -1;
+            if ((comp_deliver_queued(ring) > 0 || atomic_int_get(&ring->throttled))
+                && atomic_int_compare_and_exchange(&ring->kicked, FALSE, TRUE))
+            {
+                atomic_int_inc(&ring->refs);
+                kick = TRUE;
+            }
+        }
+        comp_unlock(comp);
+        comp_deliver_put(comp);
+
+        /* the thread may need the component lock to drain its queue */
+        while (kick && event_post(event, COMP_DELIVER_EVENT, ring) < 0)
+            sleep_ms(1);
+    }
+}
+
+/* Drops the component's reference, records still queued are delivered
+ * unless the ring has been closed */
+void comp_deliver_disable(n_comp_t * comp)
+{
+    if (comp->deliver == NULL)
+        return;
+    /* from now on the delivery thread cannot reach us through it */
+    pthread_mutex_lock(&deliver_mutex);
+    comp->deliver->comp = NULL;
+    comp->deliver->func = NULL;
+    comp->deliver->user_data = NULL;
+    deliver_rings = n_slist_remove(deliver_rings, comp->deliver);
+    pthread_mutex_unlock(&deliver_mutex);
+    comp_deliver_unref(comp->deliver);
+    comp->deliver = NULL;
+}
+
+void comp_deliver_unref(n_deliver_ring_t * ring)
+{
+    if (atomic_int_add(&ring->refs, -1) != 1)
+        return;
+    n_slice_free1(ring->size, ring->buf);
+    n_slice_free(n_deliver_ring_t, ring);
+}
+
+uint32_t comp_deliver_queued(n_deliver_ring_t * ring)
+{
+    return (uint32_t)atomic_int_get(&ring->tail) - (uint32_t)atomic_int_get(&ring->head);
+}
+
+/* Bytes that may still be queued before the high-water mark */
+uint32_t comp_deliver_room(n_deliver_ring_t * ring)
+{
+    uint32_t queued = comp_deliver_queued(ring);
+
+    return queued < ring->high_water ? ring->high_water - queued : 0;
+}
+
+/* Producer side, component lock held. Copies one record in and kicks the
+ * delivery thread unless a kick is pending already. Returns FALSE if the
+ * record does not fit; the high-water mark is left to the caller. */
+int32_t comp_deliver_push(n_comp_t * comp, const uint8_t * buf, uint32_t len)
+{
+    n_deliver_ring_t * ring = comp->deliver;
+    uint32_t tail = (uint32_t)ring->tail;
+    uint32_t rec = COMP_DELIVER_RECORD(len);
+    uint32_t pos = tail & (ring->size - 1);
+    uint32_t end = ring->size - pos;
+    uint32_t skip = (end < rec) ? end : 0;
+
+    if (comp_deliver_queued(ring) + skip + rec > ring->size)
+        return FALSE;
+
+    if (skip)
+    {
+        *(uint32_t *)(ring->buf + pos) = COMP_DELIVER_SKIP;
+        pos = 0;
+    }
+    *(uint32_t *)(ring->buf + pos) = len;
+    memcpy(ring->buf + pos + 4, buf, len);
+    /* publishes the record, the add is a full barrier */
+    atomic_int_add(&ring->tail, skip + rec);
+
+    /* a ring cut off the delivery threads is only drained */
+    if (ring->event >= 0 && atomic_int_compare_and_exchange(&ring->kicked, FALSE, TRUE))
+    {
+        atomic_int_inc(&ring->refs);
+        if (event_post(ring->event, COMP_DELIVER_EVENT, ring) < 0)
+        {
+            nice_debug("[%s]: delivery thread queue full, s%d:%d waits for the next kick", G_STRFUNC,
+                       comp->stream->id, comp->id);
+            atomic_int_set(&ring->kicked, FALSE);
+            atomic_int_add(&ring->refs, -1);
+        }
+    }
+    return TRUE;
+}
+
+/* Consumer side: the oldest record, it stays queued until consumed */
+int32_t comp_deliver_peek(n_deliver_ring_t * ring, const uint8_t ** buf, uint32_t * len)
+{
+    uint32_t head = (uint32_t)ring->head;
+    uint32_t tail = (uint32_t)atomic_int_get(&ring->tail);
+
+    while (head != tail)
+    {
+        uint32_t pos = head & (ring->size - 1);
+        uint32_t l = *(uint32_t *)(ring->buf + pos);
+
+        if (l == COMP_DELIVER_SKIP)
+        {
+            atomic_int_add(&ring->head, ring->size - pos);
+            head += ring->size - pos;
+            continue;
+        }
+        *buf = ring->buf + pos + 4;
+        *len = l;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+void comp_deliver_consume(n_deliver_ring_t * ring)
+{
+    uint32_t pos = (uint32_t)ring->head & (ring->size - 1);
+
+    atomic_int_add(&ring->head, COMP_DELIVER_RECORD(*(uint32_t *)(ring->buf + pos)));
+}
+
+/* Consumer side: the I/O callback records go to, NULL once closed */
+void comp_deliver_callback(n_deliver_ring_t * ring, n_agent_recv_func * func, void ** user_data)
+{
+    pthread_mutex_lock(&deliver_mutex);
+    *func = ring->func;
+    *user_data = ring->user_data;
+    pthread_mutex_unlock(&deliver_mutex);
+}
+
+/* Consumer side: the component while it is open, it is not freed before
+ * comp_deliver_put() */
+n_comp_t * comp_deliver_get(n_deliver_ring_t * ring)
+{
+    n_comp_t * comp;
+
+    pthread_mutex_lock(&deliver_mutex);
+    comp = ring->comp;
+    if (comp != NULL)
+        comp->deliver_users++;
+    pthread_mutex_unlock(&deliver_mutex);
+    return comp;
+}
+
+void comp_deliver_put(n_comp_t * comp)
+{
+    pthread_mutex_lock(&deliver_mutex);
+    if (--comp->deliver_users == 0)
+        pthread_cond_broadcast(&deliver_idle);
+    pthread_mutex_unlock(&deliver_mutex);
+}
+
 /* (func, user_data) and (recv_messages, n_recv_messages) are mutually
  * exclusive. At most one of the two must be specified; if both are NULL, the
  * n_comp_t will not receive any data (i.e. reception is paused).
@@ -590,6 +1131,15 @@ void comp_set_io_callback(n_comp_t * comp, n_agent_recv_func func, void * user_d
     n_input_msg_iter_reset(&comp->recv_messages_iter);
 
     pthread_mutex_unlock(&comp->io_mutex);
+
+    /* the delivery thread reads its own copy */
+    if (comp->deliver != NULL)
+    {
+        pthread_mutex_lock(&deliver_mutex);
+        comp->deliver->func = func;
+        comp->deliver->user_data = func ? user_data : NULL;
+        pthread_mutex_unlock(&deliver_mutex);
+    }
 }
 
 int component_has_io_callback(n_comp_t * component)
@@ -675,13 +1225,15 @@ done:
     return FALSE;
 }
 
-/* This must be called with the agent lock *held*. */
-void comp_emit_io_cb(n_comp_t * comp, const uint8_t * buf, uint32_t buf_len)
+/* This must be called with the component lock *held*. */
+/* Returns FALSE if there was no callback to hand the data to */
+int32_t comp_emit_io_cb(n_comp_t * comp, const uint8_t * buf, uint32_t buf_len)
 {
     n_agent_t * agent;
     uint32_t stream_id, comp_id;
     n_agent_recv_func io_callback;
     void * io_user_data;
+    int32_t depth;
 
     //g_assert(component != NULL);
     //g_assert(buf != NULL);
@@ -699,7 +1251,15 @@ void comp_emit_io_cb(n_comp_t * comp, const uint8_t * buf, uint32_t buf_len)
     /* Allow this to be called with a NULL io_callback, since the caller can?t
      * lock io_mutex to check beforehand. */
     if (io_callback == NULL)
-        return;
+        return FALSE;
+
+    /* handed to the delivery thread, past the high-water mark it is dropped */
+    if (comp->deliver != NULL && comp->deliver->high_water > 0)
+    {
+        if (buf_len > comp_deliver_room(comp->deliver))
+            return FALSE;
+        return comp_deliver_push(comp, buf, buf_len);
+    }
 
     //g_assert(NICE_IS_AGENT(agent));
     //g_assert(stream_id > 0);
@@ -710,11 +1270,12 @@ void comp_emit_io_cb(n_comp_t * comp, const uint8_t * buf, uint32_t buf_len)
      * handler. */
     //if (g_main_context_is_owner(comp->ctx))
     {
-        /* Thread owns the main context, so invoke the callback directly. */
-        agent_unlock();
+        /* Thread owns the main context, so invoke the callback directly. The
+         * callback may send on any component, so do not hold ours across it,
+         * however deep the path that got here took it. */
+        depth = comp_unlock_all(comp);
         io_callback(agent, stream_id, comp_id, buf_len, (char *) buf, io_user_data);
-        //nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-        agent_lock();
+        comp_relock(comp, depth);
     }
     /*else
     {
@@ -731,6 +1292,8 @@ void comp_emit_io_cb(n_comp_t * comp, const uint8_t * buf, uint32_t buf_len)
         comp_sched_io_cb(comp);
         pthread_mutex_unlock(&comp->io_mutex);
     }*/
+
+    return TRUE;
 }
 
 
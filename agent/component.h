@@ -18,6 +18,7 @@ typedef struct _comp_st n_comp_t;
 #include "socket.h"
 #include "nlist.h"
 #include "nqueue.h"
+#include "reactor.h"
 #include "pthread.h"
 #include "uv.h"
 
@@ -76,6 +77,12 @@ typedef struct
 {
     n_socket_t * socket;
     n_comp_t * component;
+    n_socket_t * primary;           /* host socket this one is a receive shard of, NULL otherwise */
+    int32_t shard;                  /* 0 for a primary, 1.. for its SO_REUSEPORT shards */
+    int32_t reactor;                /* reactor the socket is registered on, 0 if none */
+    int32_t readers;                /* I/O threads inside agent_recv_packet() on it */
+    int32_t detached;               /* taken off the component, the last reader frees it */
+    int32_t turn;                   /* a TURN relay is allocated through it, 64..79 is ChannelData */
 } n_socket_source_t;
 
 
@@ -101,6 +108,71 @@ typedef struct
 IOCallbackData * io_callback_data_new(const uint8_t * buf, uint32_t buf_len);
 void io_callback_data_free(IOCallbackData * data);
 
+/* Pseudo-TCP segments written during one burst, sent together when the
+ * burst is flushed. The segments are packed back to back into data, which
+ * is sized so a whole batch fits in one UDP GSO send. */
+#define COMP_SEND_BATCH_DATA  (63 * 1024)
+
+typedef struct
+{
+    n_socket_t * socks[NICE_SOCKET_SEND_BATCH];
+    n_addr_t to[NICE_SOCKET_SEND_BATCH];
+    n_outvector_t bufs[NICE_SOCKET_SEND_BATCH];
+    uint32_t n_bufs;
+    uint32_t used;  /* bytes of data in use */
+    char * data;    /* allocated on first use */
+} n_send_batch_t;
+
+/* Packets received before a pair is selected, kept until pseudo-TCP can
+ * answer them. A fixed ring of slots carved out of one pool, bounded by
+ * max_bytes of payload; what does not fit is dropped by the policy. */
+#define COMP_EARLY_SLOTS      64
+#define COMP_EARLY_SLOT_SIZE  1500  /* a pseudo-TCP segment is at most MAX_TCP_MTU */
+#define COMP_EARLY_MAX_BYTES  (32 * 1024)
+
+typedef struct
+{
+    uint8_t * pool;                 /* COMP_EARLY_SLOTS slots, allocated on first use */
+    uint32_t lens[COMP_EARLY_SLOTS];
+    uint32_t head;                  /* oldest slot */
+    uint32_t count;
+    uint32_t bytes;                 /* payload queued */
+    uint32_t max_bytes;
+    n_early_drop_e policy;
+} n_early_queue_t;
+
+/* Deferred delivery: data for the I/O callback is copied into a ring that
+ * the I/O thread fills under the component lock and one delivery thread
+ * drains, so a slow callback holds up neither the socket nor the ACKs of
+ * pseudo-TCP. A record is a 4 byte length and the payload padded to 4
+ * bytes; a record never wraps, the space left at the end is skipped. */
+#define COMP_DELIVER_CHUNK  (16 * 1024)   /* largest pseudo-TCP record */
+#define COMP_DELIVER_SKIP   0xffffffff    /* length of the filler at the end */
+#define COMP_DELIVER_EVENT  0x1           /* posted to the delivery thread, n_data is the ring */
+#define COMP_DELIVER_RECORD(len)  (4 + (((len) + 3) & ~3u))
+
+typedef struct
+{
+    uint8_t * buf;
+    uint32_t size;                  /* power of two */
+    volatile int32_t head;          /* bytes consumed, moved by the delivery thread */
+    volatile int32_t tail;          /* bytes produced, moved under the component lock */
+    uint32_t high_water;            /* bytes queued past which nothing is added */
+    volatile int32_t refs;          /* the component's and a pending kick's */
+    volatile int32_t kicked;        /* a kick is posted and not picked up yet */
+    volatile int32_t throttled;     /* data was left in pseudo-TCP for lack of room */
+    volatile int32_t closed;        /* the component is gone, drop what is left */
+    int32_t event;                  /* handle of the delivery thread, -1 once detached */
+    n_agent_t * agent;              /* what the callback is called with, */
+    uint32_t stream_id;             /* fixed when the ring is set up */
+    uint32_t comp_id;
+    /* the delivery thread only reads these through comp_deliver_callback()
+     * and comp_deliver_get(), the component may be gone */
+    n_comp_t * comp;                /* NULL once the component closed */
+    n_agent_recv_func func;
+    void * user_data;
+} n_deliver_ring_t;
+
 struct _comp_st
 {
     n_comp_type_e type;
@@ -110,8 +182,13 @@ struct _comp_st
     n_slist_t * remote_candidates;  /* list of n_cand_t objs */
     n_slist_t * socket_srcs_slist;     /* list of n_socket_source_t objs; must only grow monotonically */
     uint32_t socket_sources_age;    /* incremented when socket_srcs_slist changes */
+    int32_t reactor;                /* reactor of the I/O thread serving us, sockets stay registered */
+    int32_t io_thread;              /* executor thread index, valid while reactor is set */
     n_slist_t * incoming_checks;    /* list of n_inchk_t objs */
     n_dlist_t * turn_servers;            /* List of turn_server_t objs */
+    pthread_mutex_t mutex;          /* component lock, see "Locking" in agent-priv.h */
+    int32_t lock_depth;             /* times the owner holds mutex, only touched under it */
+    int32_t closed;                 /* component_close() ran, guarded by the component lock */
     n_cand_pair_t selected_pair; /* independent from checklists, see ICE 11.1. "Sending Media" (ID-19) */
     n_cand_t * restart_candidate; /* for storing active remote candidate during a restart */
     n_cand_t * turn_candidate; /* for storing active turn candidate if turn servers have been cleared */
@@ -164,11 +241,31 @@ struct _comp_st
     /* Queue of messages received before a selected socket was available to send
      * ACKs on. The messages are dequeued to the pseudo-TCP socket once a selected
      * UDP socket is available. This is only used for reliable Components. */
-    n_queue_t queued_tcp_packets;
+    n_early_queue_t early_queue;    /* guarded by the component lock */
+
+    n_recv_stats_t recv_stats;  /* guarded by the component lock */
+    n_send_batch_t send_batch;  /* guarded by the component lock */
+    n_send_stats_t send_stats;  /* guarded by the component lock */
+    n_dgram_stats_t dgram_stats;  /* unreliable mode, guarded by the component lock */
+    n_deliver_ring_t * deliver;   /* deferred delivery, NULL for inline callbacks */
+    int32_t deliver_users;        /* delivery threads holding us, component_free() waits for them */
+    n_agent_writable_func writable_cb;  /* guarded by the component lock, like the rest */
+    void * writable_data;
+    uint32_t writable_low_water;    /* free send space that counts as writable */
+    int32_t writable_armed;         /* a send ran short, notify once on the way back up */
+    pthread_cond_t writable_cond;   /* n_agent_send_all() sleeps here, on the component lock */
+    uint16_t rtp_max_seq;       /* highest RTP sequence number received */
+    int32_t rtp_seq_valid;      /* rtp_max_seq has been set */
 };
 
 n_comp_t * comp_new(uint32_t component_id, n_agent_t * agent, n_stream_t * stream);
 void component_close(n_comp_t * cmp);
+void comp_lock(n_comp_t * cmp);
+void comp_unlock(n_comp_t * cmp);
+/* Releases every level of the component lock the caller holds, to call
+ * out to the application; comp_relock() takes them all back */
+int32_t comp_unlock_all(n_comp_t * cmp);
+void comp_relock(n_comp_t * cmp, int32_t depth);
 void component_free(n_comp_t * cmp);
 int comp_find_pair(n_comp_t * cmp, n_agent_t * agent, const char * lfoundation, const char * rfoundation, n_cand_pair_t * pair);
 void component_restart(n_comp_t * cmp);
@@ -176,13 +273,33 @@ void comp_update_selected_pair(n_comp_t * component, const n_cand_pair_t * pair)
 n_cand_t * comp_find_remote_cand(const n_comp_t * component, const n_addr_t * addr);
 n_cand_t * comp_set_selected_remote_cand(n_agent_t * agent, n_comp_t * component, n_cand_t * candidate);
 void comp_attach_socket(n_comp_t * component, n_socket_t * nsocket);
+void comp_attach_shard(n_comp_t * component, n_socket_t * primary, n_socket_t * shard);
+void comp_reactor_sync(n_comp_t * component);
+void comp_mark_turn_base(n_comp_t * component, n_socket_t * base);
 void component_detach_socket(n_comp_t * component, n_socket_t * nsocket);
 void component_detach_all_sockets(n_comp_t * component);
 void component_free_socket_sources(n_comp_t * component);
+void comp_release_source(n_comp_t * component, n_socket_source_t * source);
+int32_t comp_early_push(n_comp_t * component, const uint8_t * buf, uint32_t len);
+void comp_early_pop(n_comp_t * component);
+void comp_early_clear(n_comp_t * component);
+int32_t comp_deliver_enable(n_comp_t * component, uint32_t high_water, int32_t event);
+void comp_deliver_disable(n_comp_t * component);
+void comp_deliver_attach(n_comp_t * component, int32_t event);
+void comp_deliver_detach_all(void);
+void comp_deliver_unref(n_deliver_ring_t * ring);
+uint32_t comp_deliver_room(n_deliver_ring_t * ring);
+uint32_t comp_deliver_queued(n_deliver_ring_t * ring);
+int32_t comp_deliver_push(n_comp_t * component, const uint8_t * buf, uint32_t len);
+int32_t comp_deliver_peek(n_deliver_ring_t * ring, const uint8_t ** buf, uint32_t * len);
+void comp_deliver_consume(n_deliver_ring_t * ring);
+void comp_deliver_callback(n_deliver_ring_t * ring, n_agent_recv_func * func, void ** user_data);
+n_comp_t * comp_deliver_get(n_deliver_ring_t * ring);
+void comp_deliver_put(n_comp_t * component);
 
 //void comp_set_io_context(n_comp_t * component, GMainContext * context);
 void comp_set_io_callback(n_comp_t * component,  n_agent_recv_func func, void * user_data);
-void comp_emit_io_cb(n_comp_t * component, const uint8_t * buf, uint32_t buf_len);
+int32_t comp_emit_io_cb(n_comp_t * component, const uint8_t * buf, uint32_t buf_len);
 int component_has_io_callback(n_comp_t * component);
 void component_clean_turn_servers(n_comp_t * component);
 turn_server_t * turn_server_new(const char * server_ip, uint32_t server_port, const char * username, const char * password);
@@ -493,17 +493,17 @@ static int _cocheck_tick(void * pointer)
     n_agent_t * agent = pointer;
 
 	//nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(agent);
 /*
     if (g_source_is_destroyed(g_main_current_source()))
     {
         nice_debug("Source was destroyed. " "Avoided race condition in _cocheck_tick");
-        agent_unlock();
+        agent_unlock(agent);
         return FALSE;
     }*/
 
     ret = _cocheck_tick_unlocked(agent);
-	agent_unlock();
+	agent_unlock(agent);
 
     return ret;
 }
@@ -513,7 +513,7 @@ static int _conn_keepalive_retrans_tick(void * pointer)
     n_cand_pair_t * pair = (n_cand_pair_t *) pointer;
 
 	//nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(pair->keepalive.agent);
 
     /* A race condition might happen where the mutex above waits for the lock
      * and in the meantime another thread destroys the source.
@@ -522,7 +522,7 @@ static int _conn_keepalive_retrans_tick(void * pointer)
     /*if (g_source_is_destroyed(g_main_current_source()))
     {
         nice_debug("Source was destroyed. " "Avoided race condition in _conn_keepalive_retrans_tick");
-        agent_unlock();
+        agent_unlock(pair->keepalive.agent);
         return FALSE;
     }*/
 
@@ -547,7 +547,7 @@ static int _conn_keepalive_retrans_tick(void * pointer)
                                       NULL, &component))
             {
                 nice_debug("Could not find stream or component in" " _conn_keepalive_retrans_tick");
-                agent_unlock();
+                agent_unlock(pair->keepalive.agent);
                 return FALSE;
             }
 
@@ -588,8 +588,8 @@ static int _conn_keepalive_retrans_tick(void * pointer)
 										   "Pair keepalive", stun_timer_remainder(&pair->keepalive.timer),
 										   _conn_keepalive_retrans_tick, pair);*/
 
-			pair->keepalive.tick_clock = timer_create();
-			timer_init(pair->keepalive.tick_clock, 0, interval, (notifycallback)_conn_keepalive_retrans_tick, (void *)pair, "pair keepalive");
+			pair->keepalive.tick_clock = timer_create_on(pair->keepalive.agent->timer_loop);
+			timer_init_slack(pair->keepalive.tick_clock, 0, interval, NICE_AGENT_TIMER_RETRANS_SLACK, (notifycallback)_conn_keepalive_retrans_tick, (void *)pair, "pair keepalive");
 			timer_start(pair->keepalive.tick_clock);
 			break;
 		}
@@ -601,8 +601,8 @@ static int _conn_keepalive_retrans_tick(void * pointer)
 										   "Pair keepalive", stun_timer_remainder(&pair->keepalive.timer),
 										   _conn_keepalive_retrans_tick, pair);*/
 
-			pair->keepalive.tick_clock = timer_create();
-			timer_init(pair->keepalive.tick_clock, 0, interval, (notifycallback)_conn_keepalive_retrans_tick, (void *)pair, "pair keepalive");
+			pair->keepalive.tick_clock = timer_create_on(pair->keepalive.agent->timer_loop);
+			timer_init_slack(pair->keepalive.tick_clock, 0, interval, NICE_AGENT_TIMER_RETRANS_SLACK, (notifycallback)_conn_keepalive_retrans_tick, (void *)pair, "pair keepalive");
 			timer_start(pair->keepalive.tick_clock);
 
 			break;
@@ -613,7 +613,7 @@ static int _conn_keepalive_retrans_tick(void * pointer)
     }
 
 
-    agent_unlock();
+    agent_unlock(pair->keepalive.agent);
     return FALSE;
 }
 
@@ -718,8 +718,8 @@ static int _conn_keepalive_tick_unlocked(n_agent_t * agent)
                                                            &p->keepalive.tick_source, "Pair keepalive",
                                                            stun_timer_remainder(&p->keepalive.timer),
                                                            _conn_keepalive_retrans_tick, p);*/
-							p->keepalive.tick_clock = timer_create();
-							timer_init(p->keepalive.tick_clock, 0, interval, (notifycallback)_conn_keepalive_retrans_tick, (void *)p, "pair keepalive");
+							p->keepalive.tick_clock = timer_create_on(agent->timer_loop);
+							timer_init_slack(p->keepalive.tick_clock, 0, interval, NICE_AGENT_TIMER_RETRANS_SLACK, (notifycallback)_conn_keepalive_retrans_tick, (void *)p, "pair keepalive");
 							timer_start(p->keepalive.tick_clock);
                         }
                         else
@@ -813,13 +813,13 @@ static int _conn_keepalive_tick(void * pointer)
     int ret;
 
 	//nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(agent);
 /*
     if (g_source_is_destroyed(g_main_current_source()))
     {
         nice_debug("Source was destroyed. "
                    "Avoided race condition in _conn_keepalive_tick");
-        agent_unlock();
+        agent_unlock(agent);
         return FALSE;
     }*/
 
@@ -840,7 +840,7 @@ static int _conn_keepalive_tick(void * pointer)
 			agent->keepalive_timer = 0;
 		}
     }
-	agent_unlock();
+	agent_unlock(agent);
     return ret;
 }
 
@@ -850,7 +850,7 @@ static int _turn_alloc_refresh_retrans_tick(void * pointer)
     n_agent_t * agent = NULL;
 
 	//nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-    agent_lock();
+    agent_lock(cand->agent);
 
     /* A race condition might happen where the mutex above waits for the lock
      * and in the meantime another thread destroys the source.
@@ -860,7 +860,7 @@ static int _turn_alloc_refresh_retrans_tick(void * pointer)
     {
         nice_debug("Source was destroyed. "
                    "Avoided race condition in _turn_alloc_refresh_retrans_tick");
-        agent_unlock();
+        agent_unlock(cand->agent);
         return FALSE;
     }*/
 
@@ -897,7 +897,7 @@ static int _turn_alloc_refresh_retrans_tick(void * pointer)
 				"Candidate TURN refresh", stun_timer_remainder(&cand->timer),
 				_turn_alloc_refresh_retrans_tick, cand);*/
 
-			cand->tick_clock = timer_create();
+			cand->tick_clock = timer_create_on(cand->agent->timer_loop);
 			timer_init(cand->tick_clock, 0, interval, (notifycallback)_turn_alloc_refresh_retrans_tick, (void *)cand, "candidate turn refresh");
 			timer_start(cand->tick_clock);
 
@@ -911,7 +911,7 @@ static int _turn_alloc_refresh_retrans_tick(void * pointer)
 				"Candidate TURN refresh", stun_timer_remainder(&cand->timer),
 		                                           _turn_alloc_refresh_retrans_tick, cand);*/
 
-			cand->tick_clock = timer_create();
+			cand->tick_clock = timer_create_on(cand->agent->timer_loop);
 			timer_init(cand->tick_clock, 0, interval, (notifycallback)_turn_alloc_refresh_retrans_tick, (void *)cand, "candidate turn refresh");
 			timer_start(cand->tick_clock);
 
@@ -923,7 +923,7 @@ static int _turn_alloc_refresh_retrans_tick(void * pointer)
     }
 
 
-	agent_unlock();
+	agent_unlock(cand->agent);
 
     //g_object_unref(agent);
 
@@ -971,7 +971,7 @@ static void _turn_alloc_refresh_tick_unlocked(n_cand_refresh_t * cand)
         /*agent_timeout_add(cand->agent, &cand->tick_source, "candidate turn refresh", stun_timer_remainder(&cand->timer),
                                        _turn_alloc_refresh_retrans_tick, cand);*/
 
-		cand->tick_clock = timer_create();
+		cand->tick_clock = timer_create_on(cand->agent->timer_loop);
 		timer_init(cand->tick_clock, 0, interval, (notifycallback)_turn_alloc_refresh_retrans_tick, (void *)cand, "candidate turn refresh");
 		timer_start(cand->tick_clock);
     }
@@ -989,16 +989,16 @@ static int _turn_allocate_refresh_tick(void * pointer)
     n_cand_refresh_t * cand = (n_cand_refresh_t *) pointer;
 
 	//nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-	agent_lock();
+	agent_lock(cand->agent);
     /*if (g_source_is_destroyed(g_main_current_source()))
     {
         nice_debug("Source was destroyed. " "Avoided race condition in _turn_allocate_refresh_tick");
-        agent_unlock();
+        agent_unlock(cand->agent);
         return FALSE;
     }*/
 
     _turn_alloc_refresh_tick_unlocked(cand);
-	agent_unlock();
+	agent_unlock(cand->agent);
 
     return FALSE;
 }
@@ -1024,7 +1024,7 @@ int cocheck_schedule_next(n_agent_t * agent)
     if (res && agent->cocheck_timer == 0)
     {
         /*agent_timeout_add(agent, &agent->conncheck_timer_source, "cocheck schedule", agent->timer_ta, _cocheck_tick, agent);*/
-		agent->cocheck_timer = timer_create();
+		agent->cocheck_timer = timer_create_on(agent->timer_loop);
 		timer_init(agent->cocheck_timer, 0, agent->timer_ta, (notifycallback)_cocheck_tick, (void *)agent, "cocheck schedule");
 		timer_start(agent->cocheck_timer);
     }
@@ -1035,8 +1035,8 @@ int cocheck_schedule_next(n_agent_t * agent)
         /*agent_timeout_add(agent, &agent->keepalive_timer_source,
                                        "Connectivity keepalive timeout", NICE_AGENT_TIMER_TR_DEFAULT,
                                        _conn_keepalive_tick, agent);*/
-		agent->keepalive_timer = timer_create();
-		timer_init(agent->keepalive_timer, 0, NICE_AGENT_TIMER_TR_DEFAULT, (notifycallback)_conn_keepalive_tick, (void *)agent, "cocheck keepalive");
+		agent->keepalive_timer = timer_create_on(agent->timer_loop);
+		timer_init_slack(agent->keepalive_timer, 0, NICE_AGENT_TIMER_TR_DEFAULT, NICE_AGENT_TIMER_TR_SLACK, (notifycallback)_conn_keepalive_tick, (void *)agent, "cocheck keepalive");
 		timer_start(agent->keepalive_timer);
     }
 
@@ -2527,8 +2527,8 @@ static n_cand_refresh_t * _add_new_turn_refresh(n_cand_disc_t * cdisco, n_cand_t
     /*agent_timeout_add(agent, &cand->timer_source, "Candidate TURN refresh",
                                    (lifetime - 60) * 1000, _turn_allocate_refresh_tick, cand);*/
 
-	cand->timer_clock = timer_create();
-	timer_init(cand->timer_clock, 0, (lifetime - 60) * 1000, (notifycallback)_turn_allocate_refresh_tick, (void *)cand, "candidate turn refresh");
+	cand->timer_clock = timer_create_on(agent->timer_loop);
+	timer_init_slack(cand->timer_clock, 0, (lifetime - 60) * 1000, NICE_AGENT_TIMER_REFRESH_SLACK, (notifycallback)_turn_allocate_refresh_tick, (void *)cand, "candidate turn refresh");
 	timer_start(cand->timer_clock);
 
     nice_debug("cand->timer_clock is : %d", cand->timer_clock);
@@ -2709,8 +2709,8 @@ static int _map_reply_to_relay_refresh(n_agent_t * agent, stun_msg_t * resp)
                                                    "Candidate TURN refresh", (lifetime - 60) * 1000,
                                                    _turn_allocate_refresh_tick, cand);*/
 
-					cand->timer_clock = timer_create();
-					timer_init(cand->timer_clock, 0, (lifetime - 60) * 1000, (notifycallback)_turn_allocate_refresh_tick, (void *)cand, "candidate turn refresh");
+					cand->timer_clock = timer_create_on(agent->timer_loop);
+					timer_init_slack(cand->timer_clock, 0, (lifetime - 60) * 1000, NICE_AGENT_TIMER_REFRESH_SLACK, (notifycallback)_turn_allocate_refresh_tick, (void *)cand, "candidate turn refresh");
 					timer_start(cand->timer_clock);
 
                     /*g_source_destroy(cand->tick_source);
@@ -445,6 +445,25 @@ static void _assign_remote_foundation(n_agent_t * agent, n_cand_t * candidate)
  /* Ϊ stream_id  component_id һѡַ
  *  ɹѡָ, ʧΪNULL*/
 
+/* Binds the extra SO_REUSEPORT sockets of a host candidate, in the order
+ * the steering program counts them */
+static void _add_rx_shards(n_agent_t * agent, n_comp_t * comp, n_socket_t * nicesock)
+{
+    uint32_t i;
+
+    for (i = 1; i < agent->rx_shards; i++)
+    {
+        n_socket_t * shard = n_socket_new_reuseport(&nicesock->addr);
+
+        if (shard == NULL)
+            break;
+        comp_attach_shard(comp, nicesock, shard);
+    }
+
+    if (i > 1 && agent->rx_steer && nice_socket_steer_by_source(nicesock, i) < 0)
+        nice_debug("[%s]: no source steering, the kernel hashes the 4-tuple", G_STRFUNC);
+}
+
 HostCandidateResult disc_add_local_host_cand(n_agent_t * agent, uint32_t stream_id, uint32_t comp_id, n_addr_t * address, n_cand_t ** outcandidate)
 {
     n_cand_t * candidate;
@@ -467,7 +486,14 @@ HostCandidateResult disc_add_local_host_cand(n_agent_t * agent, uint32_t stream_
     //_generate_cand_cred(agent, candidate);
     _assign_foundation(agent, candidate);
 
-    nicesock = n_socket_new(address);
+    /* an io_uring socket already drains its port without a syscall per
+     * datagram, it is never sharded */
+    if (agent->io_uring)
+        nicesock = n_udp_uring_socket_new(address);
+    if (!nicesock && agent->rx_shards > 1)
+        nicesock = n_socket_new_reuseport(address);
+    if (!nicesock)
+        nicesock = n_socket_new(address);
     if (!nicesock)
     {
         res = CANDIDATE_CANT_CREATE_SOCKET;
@@ -486,6 +512,8 @@ HostCandidateResult disc_add_local_host_cand(n_agent_t * agent, uint32_t stream_
 
     _set_socket_tos(agent, nicesock, stream->tos);
     comp_attach_socket(comp, nicesock);
+    if (nicesock->type != NICE_SOCKET_TYPE_UDP_URING)
+        _add_rx_shards(agent, comp, nicesock);
 
     *outcandidate = candidate;
 
@@ -581,6 +609,7 @@ n_cand_t * disc_add_relay_cand(n_agent_t * agent, uint32_t stream_id, uint32_t c
         goto errors;
 
     comp_attach_socket(comp, relay_socket);
+    comp_mark_turn_base(comp, base_socket);
     agent_sig_new_cand(agent, candidate);
 
     return candidate;
@@ -890,11 +919,11 @@ static int _disc_tick(void * pointer)
     int ret;
 
 	//nice_debug("[%s]: agent_lock+++++++++++", G_STRFUNC);
-	agent_lock();
+	agent_lock(agent);
     /*if (g_source_is_destroyed(g_main_current_source()))
     {
         nice_debug("Source was destroyed. " "Avoided race condition in _disc_tick");
-        agent_unlock();
+        agent_unlock(agent);
         return FALSE;
     }*/
 
@@ -911,7 +940,7 @@ static int _disc_tick(void * pointer)
 		agent->disc_timer = 0;
     }
 	//nice_debug("[%s]: agent_unlock+++++++++++", G_STRFUNC);
-	agent_unlock();
+	agent_unlock(agent);
 
     return ret;
 }
@@ -935,7 +964,7 @@ void disc_schedule(n_agent_t * agent)
             if (res == TRUE)
             {
                 //agent_timeout_add(agent, &agent->disc_timer_source, "Candidate discovery tick", agent->timer_ta, _disc_tick, agent);
-				agent->disc_timer = timer_create();
+				agent->disc_timer = timer_create_on(agent->timer_loop);
 				timer_init(agent->disc_timer, 0, agent->timer_ta, (notifycallback)_disc_tick, (void *)agent,  "Candidate discovery tick");
 				timer_start(agent->disc_timer);
             }
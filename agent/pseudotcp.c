@@ -85,6 +85,12 @@ const uint16_t PACKET_MAXIMUMS[] =
 #define MAX_SEQ 0xFFFFFFFF
 #define HEADER_SIZE 24
 
+/* With TCP_OPT_SACK negotiated, a pure ACK carries the number of SACK
+ * blocks in its Control byte and the blocks themselves, a start and an end
+ * sequence number each, in place of data */
+#define SACK_BLOCK_SIZE 8
+#define MAX_SACK_BLOCKS 8
+
 #define PACKET_OVERHEAD (HEADER_SIZE + UDP_HEADER_SIZE + \
       IP_HEADER_SIZE + JINGLE_HEADER_SIZE)
 
@@ -107,6 +113,7 @@ typedef enum
     TCP_OPT_MSS = 2,  /* maximum segment size */
     TCP_OPT_WND_SCALE = 3,  /* window scale factor */
     /* libnice extensions: */
+    TCP_OPT_SACK = 253,  /* selective acknowledgement blocks on pure ACKs */
     TCP_OPT_FIN_ACK = 254,  /* FIN-ACK support */
 } TcpOption;
 
@@ -363,6 +370,8 @@ typedef struct
     const char * data;
     uint32_t len;
     uint32_t tsval, tsecr;
+    const uint8_t * sack;   /* n_sack blocks as received */
+    uint32_t n_sack;
 } Segment;
 
 typedef struct
@@ -377,6 +386,68 @@ typedef struct
     uint32_t seq, len;
 } RSegment;
 
+/* Out-of-order data held in rbuf beyond rcv_nxt, as sorted, disjoint and
+ * non-adjacent ranges merged in place. When full the furthest range is
+ * forgotten, the sender retransmits it. */
+#define PST_MAX_RANGES 64
+
+typedef struct
+{
+    RSegment ranges[PST_MAX_RANGES];
+    uint32_t count;
+} RRanges;
+
+/* Congestion control state. NewReno and CUBIC keep their window in cwnd
+ * and ssthresh, which the loss recovery in process() inflates and deflates;
+ * BBR sizes its own window from the path model. */
+typedef struct
+{
+    uint32_t w_max;         /* window before the last reduction */
+    uint32_t origin, k;     /* plateau of the curve and ms to reach it */
+    uint32_t epoch_start;   /* ms the current growth began, 0 if none */
+    uint32_t w_est;         /* what NewReno would have by now */
+    uint64_t frac, est_frac;  /* growth below one byte, times cwnd */
+    uint32_t min_rtt;
+} CubicState;
+
+#define BBR_BW_ROUNDS 10        /* rounds the delivery rate max filter spans */
+
+typedef enum
+{
+    BBR_STARTUP,
+    BBR_DRAIN,
+    BBR_PROBE_BW,
+    BBR_PROBE_RTT,
+} BbrMode;
+
+typedef struct
+{
+    BbrMode mode;
+    uint32_t cwnd;
+    uint32_t bw[BBR_BW_ROUNDS];  /* delivery rate of the last rounds, bytes/s */
+    uint32_t rounds;
+    uint32_t round_end, round_start, round_delivered;
+    uint32_t min_rtt, min_rtt_stamp;
+    int min_rtt_expired;
+    uint32_t full_bw, full_bw_rounds;
+    uint32_t cycle;
+    uint32_t probe_rtt_done, probe_rtt_round;
+} BbrState;
+
+typedef struct
+{
+    void (*init)(pst_socket_t * self);
+    /* snd_una moved by @acked bytes; during a fast recovery the window is
+     * the recovery's to manage */
+    void (*on_ack)(pst_socket_t * self, uint32_t acked, int recovering, uint32_t now);
+    /* three duplicate ACKs, fast recovery starts */
+    void (*on_loss)(pst_socket_t * self, uint32_t now);
+    void (*on_rto)(pst_socket_t * self, uint32_t now);
+    void (*on_rtt_sample)(pst_socket_t * self, uint32_t rtt, uint32_t now);
+    /* bytes send_burst() may have in flight */
+    uint32_t (*cwnd)(pst_socket_t * self);
+} PseudoTcpCongestionOps;
+
 /**
  * ClosedownSource:
  * @CLOSEDOWN_LOCAL: Error detected locally, or connection forcefully closed
@@ -409,7 +480,7 @@ struct _PseudoTcpSocketPrivate
     uint32_t last_traffic;
 
     // Incoming data
-    n_dlist_t * rlist;
+    RRanges rlist;
     uint32_t rbuf_len, rcv_nxt, rcv_wnd, lastrecv;
     uint8_t rwnd_scale; // Window scale factor
     PseudoTcpFifo rbuf;
@@ -437,6 +508,20 @@ struct _PseudoTcpSocketPrivate
     uint32_t ssthresh, cwnd;
     uint8_t dup_acks;
     uint32_t recover;
+    pst_cc_e cc_algorithm;
+    const PseudoTcpCongestionOps * cc;
+    union
+    {
+        CubicState cubic;
+        BbrState bbr;
+    } cc_state;
+
+    /* SACK scoreboard: ranges beyond snd_una the peer holds, the point up to
+     * which holes were retransmitted in this recovery, and the slist link
+     * the search for the next hole resumes from */
+    RRanges sacked;
+    uint32_t sack_rexmit;
+    n_dlist_t * sack_hint;
     uint32_t t_ack;  /* time a delayed ack was scheduled; 0 if no acks scheduled */
 
     int use_nagling;
@@ -454,6 +539,13 @@ struct _PseudoTcpSocketPrivate
      * option) to enable correct FIN-ACK connection termination. Defaults to
      * TRUE unless no compatible option is received. */
     int support_fin_ack;
+
+    /* TRUE while both sides announced TCP_OPT_SACK */
+    int support_sack;
+
+    /* Bytes at the head of rbuf lent out by pst_recv_spans() and not yet
+     * given back by pst_recv_release(). */
+    uint32_t rbuf_lent;
 };
 
 #define LARGER(a,b) (((a) - (b) - 1) < (G_MAXUINT32 >> 1))
@@ -461,21 +553,78 @@ struct _PseudoTcpSocketPrivate
 #define SMALLER(a,b) LARGER ((b),(a))
 #define SMALLER_OR_EQUAL(a,b) LARGER_OR_EQUAL ((b),(a))
 
-/* properties */
-enum
-{
-    PROP_CONVERSATION = 1,
-    PROP_CALLBACKS,
-    PROP_STATE,
-    PROP_ACK_DELAY,
-    PROP_NO_DELAY,
-    PROP_RCV_BUF,
-    PROP_SND_BUF,
-    PROP_SUPPORT_FIN_ACK,
-    LAST_PROPERTY
-};
+/* Records [seq, seq + len), merging it with every range it overlaps or touches */
+static void pst_ranges_add(RRanges * r, uint32_t seq, uint32_t len)
+{
+    uint32_t end = seq + len, lo = 0, hi = r->count, last;
+
+    /* first range that does not end before seq */
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
 
+        if (SMALLER(r->ranges[mid].seq + r->ranges[mid].len, seq))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < r->count && SMALLER_OR_EQUAL(r->ranges[lo].seq, end))
+    {
+        RSegment * first = &r->ranges[lo];
+        uint32_t first_end = first->seq + first->len;
+
+        last = lo + 1;
+        while (last < r->count && SMALLER_OR_EQUAL(r->ranges[last].seq, end))
+            last++;
+        if (SMALLER(seq, first->seq))
+            first->seq = seq;
+        if (LARGER(r->ranges[last - 1].seq + r->ranges[last - 1].len, first_end))
+            first_end = r->ranges[last - 1].seq + r->ranges[last - 1].len;
+        if (LARGER(end, first_end))
+            first_end = end;
+        first->len = first_end - first->seq;
+        memmove(&r->ranges[lo + 1], &r->ranges[last], (r->count - last) * sizeof(RSegment));
+        r->count -= last - lo - 1;
+        return;
+    }
+
+    if (r->count == PST_MAX_RANGES)
+    {
+        if (lo == r->count)
+            return;
+        r->count--;
+    }
+    memmove(&r->ranges[lo + 1], &r->ranges[lo], (r->count - lo) * sizeof(RSegment));
+    r->ranges[lo].seq = seq;
+    r->ranges[lo].len = len;
+    r->count++;
+}
+
+/* Drops the ranges rcv_nxt has reached, returns how far the last of them
+ * extends beyond it */
+static uint32_t pst_ranges_advance(RRanges * r, uint32_t rcv_nxt)
+{
+    uint32_t n = 0, adjust = 0;
 
+    while (n < r->count && SMALLER_OR_EQUAL(r->ranges[n].seq, rcv_nxt))
+    {
+        uint32_t end = r->ranges[n].seq + r->ranges[n].len;
+
+        if (LARGER(end, rcv_nxt + adjust))
+            adjust = end - rcv_nxt;
+        n++;
+    }
+    if (n > 0)
+    {
+        memmove(&r->ranges[0], &r->ranges[n], (r->count - n) * sizeof(RSegment));
+        r->count -= n;
+    }
+    return adjust;
+}
+
+
+static void cc_set_algorithm(pst_socket_t * self, pst_cc_e algorithm);
 static void pst_finalize(pst_socket_t * self);
 static void queue_connect_message(pst_socket_t * self);
 static uint32_t queue(pst_socket_t * self, const char * data, uint32_t len, TcpFlags flags);
@@ -484,6 +633,7 @@ static int parse(pst_socket_t * self, const uint8_t * _header_buf, uint32_t head
 static int process(pst_socket_t * self, Segment * seg);
 static int transmit(pst_socket_t * self, SSegment * sseg, uint32_t now);
 static void attempt_send(pst_socket_t * self, SendFlags sflags);
+static void flush_packets(pst_socket_t * self);
 static void closedown(pst_socket_t * self, uint32_t err, ClosedownSource source);
 static void adjustMTU(pst_socket_t * self);
 static void parse_options(pst_socket_t * self, const uint8_t * data, uint32_t len);
@@ -562,6 +712,12 @@ void pst_get_property(pst_socket_t * self,  uint32_t property_id, void * value)
             *(int *)value = self->priv->support_fin_ack;
             //g_value_set_boolean(value, self->priv->support_fin_ack);
             break;
+        case PROP_SUPPORT_SACK:
+            *(int *)value = self->priv->support_sack;
+            break;
+        case PROP_CONGESTION_CONTROL:
+            *(pst_cc_e *)value = self->priv->cc_algorithm;
+            break;
         default:
             //G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -605,6 +761,12 @@ void pst_set_property(pst_socket_t * self,  uint32_t property_id,  void * value)
             //self->priv->support_fin_ack = g_value_get_boolean(value);
             self->priv->support_fin_ack = *(int *)value;
             break;
+        case PROP_SUPPORT_SACK:
+            self->priv->support_sack = *(int *)value;
+            break;
+        case PROP_CONGESTION_CONTROL:
+            cc_set_algorithm(self, *(pst_cc_e *)value);
+            break;
         default:
             //G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -615,7 +777,6 @@ static void pst_finalize(pst_socket_t * self)
 {
     //pst_socket_t * self = PSEUDO_TCP_SOCKET(object);
     PseudoTcpSocketPrivate * priv = self->priv;
-    n_dlist_t * i;
     SSegment * sseg;
 
     if (priv == NULL)
@@ -624,13 +785,9 @@ static void pst_finalize(pst_socket_t * self)
     while ((sseg = n_queue_pop_head(&priv->slist)))
         n_slice_free(SSegment, sseg);
     n_queue_clear(&priv->unsent_slist);
-    for (i = priv->rlist; i; i = i->next)
-    {
-        RSegment * rseg = i->data;
-        n_slice_free(RSegment, rseg);
-    }
-    n_dlist_free(priv->rlist);
-    priv->rlist = NULL;
+    priv->rlist.count = 0;
+    priv->sacked.count = 0;
+    priv->sack_hint = NULL;
 
     pst_fifo_clear(&priv->rbuf);
     pst_fifo_clear(&priv->sbuf);
@@ -686,6 +843,10 @@ static void pst_init(pst_socket_t * obj)
 
     priv->dup_acks = 0;
     priv->recover = 0;
+    cc_set_algorithm(obj, PST_CC_NEWRENO);
+    priv->sacked.count = 0;
+    priv->sack_rexmit = 0;
+    priv->sack_hint = NULL;
 
     priv->ts_recent = priv->ts_lastack = 0;
 
@@ -697,6 +858,7 @@ static void pst_init(pst_socket_t * obj)
 
     priv->support_wnd_scale = TRUE;
     priv->support_fin_ack = TRUE;
+    priv->support_sack = TRUE;
 }
 
 pst_socket_t * pst_new(uint32_t conversation, pst_callback_t * callbacks)
@@ -718,7 +880,7 @@ pst_socket_t * pst_new(uint32_t conversation, pst_callback_t * callbacks)
 static void queue_connect_message(pst_socket_t * self)
 {
     PseudoTcpSocketPrivate * priv = self->priv;
-    uint8_t buf[8];
+    uint8_t buf[16];
     uint32_t size = 0;
 
     buf[size++] = CTL_CONNECT;
@@ -737,6 +899,13 @@ static void queue_connect_message(pst_socket_t * self)
         buf[size++] = 0;  /* currently unused */
     }
 
+    if (priv->support_sack)
+    {
+        buf[size++] = TCP_OPT_SACK;
+        buf[size++] = 1;
+        buf[size++] = MAX_SACK_BLOCKS;
+    }
+
     priv->snd_wnd = size;
 
     queue(self, (char *) buf, size, FLAG_CTL);
@@ -786,7 +955,7 @@ void pst_notify_mtu(pst_socket_t * self, uint16_t mtu)
     }
 }
 
-void pst_notify_clock(pst_socket_t * self)
+static void notify_clock(pst_socket_t * self)
 {
     PseudoTcpSocketPrivate * priv = self->priv;
     uint32_t now = pseudo_tcp_get_current_time(self);
@@ -826,7 +995,6 @@ void pst_notify_clock(pst_socket_t * self)
         {
             // Note: (priv->slist.front().xmit == 0)) {
             // retransmit segments
-            uint32_t nInFlight;
             uint32_t rto_limit;
 
             nice_debug("timeout retransmit (rto: %u) "
@@ -839,10 +1007,11 @@ void pst_notify_clock(pst_socket_t * self)
                 return;
             }
 
-            nInFlight = priv->snd_nxt - priv->snd_una;
-            priv->ssthresh = max(nInFlight / 2, 2 * priv->mss);
-            //LOG(LS_INFO) << "priv->ssthresh: " << priv->ssthresh << "  nInFlight: " << nInFlight << "  priv->mss: " << priv->mss;
-            priv->cwnd = priv->mss;
+            priv->cc->on_rto(self, now);
+
+            // The receiver may have dropped what it reported, start over
+            priv->sacked.count = 0;
+            priv->sack_rexmit = priv->snd_una;
 
             // Back off retransmit timer.  Note: the limit is lower when connecting.
             rto_limit = (priv->state < TCP_ESTABLISHED) ? DEF_RTO : MAX_RTO;
@@ -877,6 +1046,14 @@ void pst_notify_clock(pst_socket_t * self)
 
 }
 
+void pst_notify_clock(pst_socket_t * self)
+{
+    notify_clock(self);
+    /* retransmits, window probes and delayed acks are written outside
+     * attempt_send() */
+    flush_packets(self);
+}
+
 int pst_notify_packet(pst_socket_t * self, const char * buffer, uint32_t len)
 {
     int retval;
@@ -896,6 +1073,7 @@ int pst_notify_packet(pst_socket_t * self, const char * buffer, uint32_t len)
      * closed from within a callback. */
     //g_object_ref(self);
     retval = parse(self, (uint8_t *) buffer, HEADER_SIZE, (uint8_t *) buffer + HEADER_SIZE, len - HEADER_SIZE);
+    flush_packets(self);
     //g_object_unref(self);
 
     return retval;
@@ -986,11 +1164,11 @@ int pst_get_next_clock(pst_socket_t * self, uint64_t * timeout)
 }
 
 
-int32_t pst_recv(pst_socket_t * self, char * buffer, size_t len)
+/* Returns 1 if data may be read, 0 at the end of the stream and -1 with
+ * priv->error set otherwise */
+static int32_t recv_check(pst_socket_t * self)
 {
     PseudoTcpSocketPrivate * priv = self->priv;
-    uint32_t bytesread;
-    uint32_t available_space;
 
     /* Received a FIN from the peer, so return 0. RFC 793, ?3.5, Case 2. */
     if (priv->support_fin_ack &&
@@ -1014,9 +1192,51 @@ int32_t pst_recv(pst_socket_t * self, char * buffer, size_t len)
         return -1;
     }
 
+    return 1;
+}
+
+/* Reopens the receive window once the application has taken data out of
+ * |m_rbuf| */
+static void recv_window_update(pst_socket_t * self)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    uint32_t available_space;
+
+    available_space = pst_fifo_get_write_remaining(&priv->rbuf);
+
+    if (available_space - priv->rcv_wnd >= min(priv->rbuf_len / 2, priv->mss))
+    {
+        // !?! Not sure about this was closed business
+        int bWasClosed = (priv->rcv_wnd == 0);
+
+        priv->rcv_wnd = available_space;
+
+        if (bWasClosed)
+        {
+            attempt_send(self, sfImmediateAck);
+        }
+    }
+}
+
+int32_t pst_recv(pst_socket_t * self, char * buffer, size_t len)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    uint32_t bytesread;
+    int32_t ret;
+
+    if ((ret = recv_check(self)) <= 0)
+        return ret;
+
     if (len == 0)
         return 0;
 
+    /* the head of |m_rbuf| is lent out by pst_recv_spans() */
+    if (priv->rbuf_lent > 0)
+    {
+        priv->error = EWOULDBLOCK;
+        return -1;
+    }
+
     bytesread = pst_fifo_read(&priv->rbuf, (uint8_t *) buffer, len);
 
     nice_debug("pst_fifo_read %d", bytesread);
@@ -1029,22 +1249,60 @@ int32_t pst_recv(pst_socket_t * self, char * buffer, size_t len)
         return -1;
     }
 
-    available_space = pst_fifo_get_write_remaining(&priv->rbuf);
+    recv_window_update(self);
 
-    if (available_space - priv->rcv_wnd >= min(priv->rbuf_len / 2, priv->mss))
-    {
-        // !?! Not sure about this was closed business
-        int bWasClosed = (priv->rcv_wnd == 0);
+    return bytesread;
+}
 
-        priv->rcv_wnd = available_space;
+int32_t pst_recv_spans(pst_socket_t * self, pst_span_t spans[2], uint32_t * n_spans)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    PseudoTcpFifo * b = &priv->rbuf;
+    uint32_t available, tail;
+    int32_t ret;
 
-        if (bWasClosed)
-        {
-            attempt_send(self, sfImmediateAck);
-        }
+    *n_spans = 0;
+    if ((ret = recv_check(self)) <= 0)
+        return ret;
+
+    /* nothing buffered, or the previous spans are not released yet */
+    available = pst_fifo_get_buffered(b);
+    if (priv->rbuf_lent > 0 || available == 0)
+    {
+        priv->bReadEnable = TRUE;
+        priv->error = EWOULDBLOCK;
+        return -1;
     }
 
-    return bytesread;
+    /* the data wraps at the end of the buffer at most once */
+    tail = min(available, b->buffer_length - b->read_position);
+    spans[0].data = &b->buffer[b->read_position];
+    spans[0].len = tail;
+    *n_spans = 1;
+    if (tail < available)
+    {
+        spans[1].data = &b->buffer[0];
+        spans[1].len = available - tail;
+        *n_spans = 2;
+    }
+    priv->rbuf_lent = available;
+
+    nice_debug("pst_recv_spans %u bytes in %u spans", available, *n_spans);
+
+    return available;
+}
+
+void pst_recv_release(pst_socket_t * self, uint32_t len)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+
+    len = min(len, priv->rbuf_lent);
+    priv->rbuf_lent = 0;
+    if (len == 0)
+        return;
+
+    pst_fifo_consume_read_data(&priv->rbuf, len);
+    recv_window_update(self);
 }
 
 int32_t pst_send(pst_socket_t * self, const char * buffer, uint32_t len)
@@ -1079,6 +1337,68 @@ int32_t pst_send(pst_socket_t * self, const char * buffer, uint32_t len)
     return written;
 }
 
+int32_t pst_send_msgs(pst_socket_t * self, const n_output_msg_t * msgs, uint32_t n_msgs, int allow_partial)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    uint32_t i, j, msg_len, written = 0, n_written = 0, wanted = 0;
+    int full = FALSE;
+
+    if (priv->state != TCP_ESTABLISHED)
+    {
+        priv->error = pseudo_tcp_state_has_sent_fin(priv->state) ? EPIPE : ENOTCONN;
+        return -1;
+    }
+
+    for (i = 0; i < n_msgs && !full; i++)
+    {
+        const n_output_msg_t * msg = &msgs[i];
+
+        /* n_buffers may be -1 for a NULL terminated vector array */
+        msg_len = 0;
+        for (j = 0; j < msg->n_buffers && msg->buffers[j].buffer != NULL; j++)
+            msg_len += msg->buffers[j].size;
+        wanted += msg_len;
+
+        /* without allow_partial a message is queued whole or not at all */
+        if (!allow_partial && msg_len > pst_fifo_get_write_remaining(&priv->sbuf))
+        {
+            full = TRUE;
+            break;
+        }
+
+        /* consecutive vectors are appended to the same unsent segment */
+        for (j = 0; j < msg->n_buffers && msg->buffers[j].buffer != NULL; j++)
+        {
+            uint32_t w = queue(self, msg->buffers[j].buffer, msg->buffers[j].size, FLAG_NONE);
+
+            written += w;
+            if (w < msg->buffers[j].size)
+            {
+                full = TRUE;
+                break;
+            }
+        }
+        if (!full)
+            n_written++;
+    }
+
+    if (written == 0 && wanted > 0 && (allow_partial || n_written == 0))
+    {
+        priv->bWriteEnable = TRUE;
+        priv->error = EWOULDBLOCK;
+        return -1;
+    }
+
+    attempt_send(self, sfNone);
+
+    if (full)
+    {
+        priv->bWriteEnable = TRUE;
+    }
+
+    return allow_partial ? (int32_t)written : (int32_t)n_written;
+}
+
 void pst_close(pst_socket_t * self, int force)
 {
     PseudoTcpSocketPrivate * priv = self->priv;
@@ -1243,6 +1563,7 @@ static pst_wret_e packet(pst_socket_t * self, uint32_t seq, TcpFlags flags, uint
         uint32_t u32[MAX_PACKET / 4];
     } buffer;
     pst_wret_e wres = WR_SUCCESS;
+    uint32_t sack_len = 0;
 
     //g_assert(HEADER_SIZE + len <= MAX_PACKET);
 
@@ -1265,13 +1586,26 @@ static pst_wret_e packet(pst_socket_t * self, uint32_t seq, TcpFlags flags, uint
         bytes_read = pst_fifo_read_offset(&priv->sbuf, buffer.u8 + HEADER_SIZE, len, offset);
         //g_assert(bytes_read == len);
     }
+    else if (priv->support_sack && flags == FLAG_NONE && priv->rlist.count > 0)
+    {
+        uint32_t i, n_sack = MIN(priv->rlist.count, MAX_SACK_BLOCKS);
+
+        // Lowest ranges first, they border the holes to fill next
+        for (i = 0; i < n_sack; i++)
+        {
+            *(buffer.u32 + HEADER_SIZE / 4 + 2 * i) = htonl(priv->rlist.ranges[i].seq);
+            *(buffer.u32 + HEADER_SIZE / 4 + 2 * i + 1) = htonl(priv->rlist.ranges[i].seq + priv->rlist.ranges[i].len);
+        }
+        buffer.u8[12] = (uint8_t)n_sack;
+        sack_len = n_sack * SACK_BLOCK_SIZE;
+    }
 
     nice_debug("[send]: <conv=%u><flg=%u><seq=%u:%u><ack=%u>"
                "<wnd=%u><ts=%u><tsr=%u><len=%u>",
                priv->conv, (unsigned)flags, seq, seq + len, priv->rcv_nxt, priv->rcv_wnd,
                now % 10000, priv->ts_recent % 10000, len);
 
-    wres = priv->callbacks.WritePacket(self, (char *) buffer.u8, len + HEADER_SIZE, priv->callbacks.user_data);
+    wres = priv->callbacks.WritePacket(self, (char *) buffer.u8, len + sack_len + HEADER_SIZE, priv->callbacks.user_data);
     /* Note: When len is 0, this is an ACK packet.  We don't read the
        return value for those, and thus we won't retry.  So go ahead and treat
        the packet as a success (basically simulate as if it were dropped),
@@ -1315,13 +1649,31 @@ static int parse(pst_socket_t * self, const uint8_t * _header_buf, uint32_t head
     seg.tsval = ntohl(*(header_buf.u32 + 4));
     seg.tsecr = ntohl(*(header_buf.u32 + 5));
 
+    seg.sack = NULL;
+    seg.n_sack = 0;
+    if (header_buf.u8[12] != 0)
+    {
+        uint32_t n_sack = header_buf.u8[12];
+
+        /* the blocks are never payload, even when the scoreboard is off */
+        if (n_sack * SACK_BLOCK_SIZE > data_buf_len)
+            return FALSE;
+        if (self->priv->support_sack)
+        {
+            seg.n_sack = n_sack;
+            seg.sack = data_buf;
+        }
+        data_buf += n_sack * SACK_BLOCK_SIZE;
+        data_buf_len -= n_sack * SACK_BLOCK_SIZE;
+    }
+
     seg.data = (const char *) data_buf;
     seg.len = data_buf_len;
 
     nice_debug("[recv]: <conv=%u><flag=%u><seq=%u:%u><ack=%u>"
-               "<wnd=%u><ts=%u><tsr=%u><len=%u>",
+               "<wnd=%u><ts=%u><tsr=%u><len=%u><sack=%u>",
                seg.conv, (unsigned)seg.flags, seg.seq, seg.seq + seg.len, seg.ack,
-               seg.wnd, seg.tsval % 10000, seg.tsecr % 10000, seg.len);
+               seg.wnd, seg.tsval % 10000, seg.tsecr % 10000, seg.len, seg.n_sack);
 
     return process(self, &seg);
 }
@@ -1374,6 +1726,470 @@ static int pseudo_tcp_state_has_received_fin(PseudoTcpState state)
     }
 }
 
+//////////////////////////////////////////////////////////////////////
+// Congestion control
+//////////////////////////////////////////////////////////////////////
+
+static uint32_t cc_in_flight(PseudoTcpSocketPrivate * priv)
+{
+    return priv->snd_nxt - priv->snd_una;
+}
+
+/* NewReno (RFC 5681, RFC 6582) */
+
+static void newreno_init(pst_socket_t * self)
+{
+}
+
+static void newreno_on_ack(pst_socket_t * self, uint32_t acked, int recovering, uint32_t now)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+
+    if (recovering)
+        return;
+
+    // Slow start, congestion avoidance
+    if (priv->cwnd < priv->ssthresh)
+    {
+        priv->cwnd += priv->mss;
+    }
+    else
+    {
+        priv->cwnd += max(1LU, priv->mss * priv->mss / priv->cwnd);
+    }
+}
+
+static void newreno_on_loss(pst_socket_t * self, uint32_t now)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+
+    priv->ssthresh = max(cc_in_flight(priv) / 2, 2 * priv->mss);
+    priv->cwnd = priv->ssthresh;
+}
+
+static void newreno_on_rto(pst_socket_t * self, uint32_t now)
+{
+    newreno_on_loss(self, now);
+    self->priv->cwnd = self->priv->mss;
+}
+
+static void newreno_on_rtt_sample(pst_socket_t * self, uint32_t rtt, uint32_t now)
+{
+}
+
+static uint32_t newreno_cwnd(pst_socket_t * self)
+{
+    return self->priv->cwnd;
+}
+
+static const PseudoTcpCongestionOps cc_newreno =
+{
+    newreno_init,
+    newreno_on_ack,
+    newreno_on_loss,
+    newreno_on_rto,
+    newreno_on_rtt_sample,
+    newreno_cwnd,
+};
+
+/* CUBIC (RFC 8312), in integer arithmetic: bytes and milliseconds */
+
+#define CUBIC_BETA       717      /* 0.7, in 1024ths */
+#define CUBIC_FRIENDLY   542      /* 3 * (1 - beta) / (1 + beta), in 1024ths */
+#define CUBIC_MAX_T      100000   /* ms, keeps (t - K)^3 within 64 bits */
+
+static uint32_t cubic_root(uint64_t a)
+{
+    uint32_t x = 0, b;
+
+    for (b = 1 << 20; b > 0; b >>= 1)
+    {
+        uint64_t y = x | b;
+
+        if (y * y * y <= a)
+            x = (uint32_t)y;
+    }
+    return x;
+}
+
+static void cubic_init(pst_socket_t * self)
+{
+    memset(&self->priv->cc_state.cubic, 0, sizeof(CubicState));
+}
+
+static void cubic_reduce(pst_socket_t * self)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    CubicState * c = &priv->cc_state.cubic;
+    // cwnd may still be inflated by a recovery
+    uint32_t cwnd = min(priv->cwnd, cc_in_flight(priv));
+
+    // Fast convergence: a flow losing ground releases some more
+    if (cwnd < c->w_max)
+        c->w_max = (uint32_t)((uint64_t)cwnd * (1024 + CUBIC_BETA) / 2048);
+    else
+        c->w_max = cwnd;
+    c->epoch_start = 0;
+    priv->ssthresh = max((uint32_t)((uint64_t)cwnd * CUBIC_BETA / 1024), 2 * priv->mss);
+}
+
+static void cubic_on_ack(pst_socket_t * self, uint32_t acked, int recovering, uint32_t now)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    CubicState * c = &priv->cc_state.cubic;
+    uint64_t target, delta, d;
+    uint32_t t, inc;
+
+    if (recovering)
+        return;
+    if (priv->cwnd < priv->ssthresh)
+    {
+        priv->cwnd += priv->mss;
+        return;
+    }
+
+    if (c->epoch_start == 0)
+    {
+        c->epoch_start = now;
+        c->w_est = priv->cwnd;
+        c->frac = c->est_frac = 0;
+        if (priv->cwnd < c->w_max)
+        {
+            // K = cbrt((W_max - cwnd) / C) with C = 0.4 segments/s^3
+            c->k = cubic_root((uint64_t)(c->w_max - priv->cwnd) * 2500000000ULL / priv->mss);
+            c->origin = c->w_max;
+        }
+        else
+        {
+            c->k = 0;
+            c->origin = priv->cwnd;
+        }
+    }
+
+    // W(t) = C * (t - K)^3 + W_max, one round trip ahead
+    t = min((uint32_t)max(time_diff(now, c->epoch_start), 0) + c->min_rtt, CUBIC_MAX_T);
+    d = (t > c->k) ? t - c->k : c->k - t;
+    delta = d * d * d / 1000 * priv->mss / 2500000;
+    if (t > c->k)
+        target = c->origin + delta;
+    else
+        target = (c->origin > delta) ? c->origin - delta : 0;
+
+    // Never slower than NewReno would grow on the same path
+    c->est_frac += (uint64_t)acked * priv->mss * CUBIC_FRIENDLY / 1024;
+    c->w_est += (uint32_t)(c->est_frac / priv->cwnd);
+    c->est_frac %= priv->cwnd;
+    if (target < c->w_est)
+        target = c->w_est;
+
+    // At most half a segment per segment acked, 1.5 times per round trip
+    if (target > priv->cwnd)
+        c->frac += min(target - priv->cwnd, (uint64_t)priv->cwnd / 2) * acked;
+    else
+        c->frac += (uint64_t)priv->mss * acked / 100;
+    inc = (uint32_t)(c->frac / priv->cwnd);
+    c->frac -= (uint64_t)inc * priv->cwnd;
+    priv->cwnd += inc;
+}
+
+static void cubic_on_loss(pst_socket_t * self, uint32_t now)
+{
+    cubic_reduce(self);
+    self->priv->cwnd = self->priv->ssthresh;
+}
+
+static void cubic_on_rto(pst_socket_t * self, uint32_t now)
+{
+    cubic_reduce(self);
+    self->priv->cwnd = self->priv->mss;
+}
+
+static void cubic_on_rtt_sample(pst_socket_t * self, uint32_t rtt, uint32_t now)
+{
+    CubicState * c = &self->priv->cc_state.cubic;
+
+    if (c->min_rtt == 0 || rtt < c->min_rtt)
+        c->min_rtt = rtt;
+}
+
+static const PseudoTcpCongestionOps cc_cubic =
+{
+    cubic_init,
+    cubic_on_ack,
+    cubic_on_loss,
+    cubic_on_rto,
+    cubic_on_rtt_sample,
+    newreno_cwnd,
+};
+
+/* BBR-style: the window is the delivery rate over the last rounds times the
+ * smallest round trip time of the last 10 s, with some gain. There is no
+ * pacing, so the gains apply to the window. */
+
+#define BBR_UNIT           256
+#define BBR_HIGH_GAIN      739      /* 2 / ln(2), fills the pipe in startup */
+#define BBR_FULL_BW_GROWTH 320      /* 1.25: bandwidth still growing */
+#define BBR_FULL_BW_ROUNDS 3
+#define BBR_MIN_RTT_MS     10000    /* lifetime of a min_rtt sample */
+#define BBR_PROBE_RTT_MS   200
+#define BBR_MIN_CWND(priv) (4 * (priv)->mss)
+
+// one round each: probe for more bandwidth, drain the queue it built, cruise
+static const uint32_t bbr_cycle_gain[] = { 320, 192, 256, 256, 256, 256, 256, 256 };
+
+static uint32_t bbr_max_bw(BbrState * b)
+{
+    uint32_t i, bw = 0;
+
+    for (i = 0; i < BBR_BW_ROUNDS; i++)
+        bw = max(bw, b->bw[i]);
+    return bw;
+}
+
+/* gain * bandwidth * min_rtt, in bytes */
+static uint32_t bbr_bdp(BbrState * b, uint32_t gain)
+{
+    uint64_t bdp = (uint64_t)bbr_max_bw(b) * max(b->min_rtt, 1) / 1000 * gain / BBR_UNIT;
+
+    return (uint32_t)min(bdp, (uint64_t)(G_MAXUINT32 >> 1));
+}
+
+static uint32_t bbr_target(pst_socket_t * self)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    BbrState * b = &priv->cc_state.bbr;
+    uint32_t target;
+
+    switch (b->mode)
+    {
+        case BBR_STARTUP:
+            target = bbr_bdp(b, BBR_HIGH_GAIN);
+            break;
+        case BBR_PROBE_BW:
+            target = bbr_bdp(b, bbr_cycle_gain[b->cycle]);
+            break;
+        default:
+            target = bbr_bdp(b, BBR_UNIT);
+            break;
+    }
+    return max(target, BBR_MIN_CWND(priv));
+}
+
+static void bbr_init(pst_socket_t * self)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    BbrState * b = &priv->cc_state.bbr;
+
+    memset(b, 0, sizeof(BbrState));
+    b->mode = BBR_STARTUP;
+    b->cwnd = max(priv->cwnd, BBR_MIN_CWND(priv));
+    b->min_rtt = G_MAXUINT32;
+    b->round_end = priv->snd_nxt;
+}
+
+/* Called once a round trip, when everything sent at its start is acked */
+static void bbr_end_round(pst_socket_t * self, uint32_t now)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    BbrState * b = &priv->cc_state.bbr;
+    uint32_t interval = (uint32_t)time_diff(now, b->round_start);
+    uint32_t bw = (uint32_t)min((uint64_t)b->round_delivered * 1000 / interval, (uint64_t)G_MAXUINT32);
+    uint32_t in_flight = cc_in_flight(priv);
+
+    // A round the application did not fill says nothing about the path
+    // unless it was faster than anything seen
+    if (bw >= bbr_max_bw(b) || pst_fifo_get_buffered(&priv->sbuf) > in_flight)
+        b->bw[b->rounds % BBR_BW_ROUNDS] = bw;
+    else
+        b->bw[b->rounds % BBR_BW_ROUNDS] = 0;
+    b->rounds++;
+    b->round_start = now;
+    b->round_delivered = 0;
+    b->round_end = priv->snd_nxt;
+
+    switch (b->mode)
+    {
+        case BBR_STARTUP:
+            if (bbr_max_bw(b) >= (uint64_t)b->full_bw * BBR_FULL_BW_GROWTH / BBR_UNIT)
+            {
+                b->full_bw = bbr_max_bw(b);
+                b->full_bw_rounds = 0;
+            }
+            else if (++b->full_bw_rounds >= BBR_FULL_BW_ROUNDS)
+            {
+                nice_debug("bbr: pipe full at %u bytes/s", b->full_bw);
+                b->mode = BBR_DRAIN;
+            }
+            break;
+        case BBR_DRAIN:
+            if (in_flight <= bbr_bdp(b, BBR_UNIT))
+            {
+                b->mode = BBR_PROBE_BW;
+                b->cycle = b->rounds % 8;
+            }
+            break;
+        case BBR_PROBE_BW:
+            b->cycle = (b->cycle + 1) % 8;
+            break;
+        case BBR_PROBE_RTT:
+            if (time_diff(now, b->probe_rtt_done) >= 0 && b->rounds > b->probe_rtt_round)
+            {
+                b->min_rtt_stamp = now;
+                b->mode = (b->full_bw_rounds >= BBR_FULL_BW_ROUNDS) ? BBR_PROBE_BW : BBR_STARTUP;
+            }
+            break;
+    }
+
+    // Shrink to a few segments for a moment so the queue empties and the
+    // path's own round trip time can be seen again
+    if (b->min_rtt_expired && b->mode != BBR_PROBE_RTT)
+    {
+        b->mode = BBR_PROBE_RTT;
+        b->probe_rtt_done = now + BBR_PROBE_RTT_MS;
+        b->probe_rtt_round = b->rounds;
+        b->min_rtt_expired = FALSE;
+    }
+}
+
+static void bbr_on_ack(pst_socket_t * self, uint32_t acked, int recovering, uint32_t now)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    BbrState * b = &priv->cc_state.bbr;
+    uint32_t target;
+
+    if (b->round_start == 0)
+    {
+        b->round_start = now;
+        b->round_end = priv->snd_nxt;
+    }
+    b->round_delivered += acked;
+    if (LARGER_OR_EQUAL(priv->snd_una, b->round_end) && time_diff(now, b->round_start) > 0)
+        bbr_end_round(self, now);
+
+    // Losses are not a signal, the window only follows the model
+    target = bbr_target(self);
+    if (b->full_bw_rounds >= BBR_FULL_BW_ROUNDS)
+        b->cwnd = min(b->cwnd + acked, target);
+    else if (b->cwnd < target || bbr_max_bw(b) == 0)
+        b->cwnd += acked;
+    b->cwnd = max(b->cwnd, BBR_MIN_CWND(priv));
+}
+
+static void bbr_on_loss(pst_socket_t * self, uint32_t now)
+{
+}
+
+static void bbr_on_rto(pst_socket_t * self, uint32_t now)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+
+    priv->cc_state.bbr.cwnd = BBR_MIN_CWND(priv);
+}
+
+static void bbr_on_rtt_sample(pst_socket_t * self, uint32_t rtt, uint32_t now)
+{
+    BbrState * b = &self->priv->cc_state.bbr;
+    int expired = (b->min_rtt != G_MAXUINT32 && time_diff(now, b->min_rtt_stamp) > BBR_MIN_RTT_MS);
+
+    if (rtt <= b->min_rtt || expired)
+    {
+        b->min_rtt = rtt;
+        b->min_rtt_stamp = now;
+        if (expired)
+            b->min_rtt_expired = TRUE;
+    }
+}
+
+static uint32_t bbr_cwnd(pst_socket_t * self)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    BbrState * b = &priv->cc_state.bbr;
+
+    if (b->mode == BBR_PROBE_RTT)
+        return min(b->cwnd, BBR_MIN_CWND(priv));
+    return b->cwnd;
+}
+
+static const PseudoTcpCongestionOps cc_bbr =
+{
+    bbr_init,
+    bbr_on_ack,
+    bbr_on_loss,
+    bbr_on_rto,
+    bbr_on_rtt_sample,
+    bbr_cwnd,
+};
+
+static void cc_set_algorithm(pst_socket_t * self, pst_cc_e algorithm)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+
+    switch (algorithm)
+    {
+        case PST_CC_CUBIC:
+            priv->cc = &cc_cubic;
+            break;
+        case PST_CC_BBR:
+            priv->cc = &cc_bbr;
+            break;
+        default:
+            algorithm = PST_CC_NEWRENO;
+            priv->cc = &cc_newreno;
+            break;
+    }
+    priv->cc_algorithm = algorithm;
+    priv->cc->init(self);
+}
+
+/* Adds the SACK blocks carried by @seg to the scoreboard, blocks outside of
+ * what is in flight are ignored */
+static void sack_update(pst_socket_t * self, Segment * seg)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    uint32_t i;
+
+    for (i = 0; i < seg->n_sack; i++)
+    {
+        uint32_t start = ntohl(*(const uint32_t *)(seg->sack + i * SACK_BLOCK_SIZE));
+        uint32_t end = ntohl(*(const uint32_t *)(seg->sack + i * SACK_BLOCK_SIZE + 4));
+
+        if (LARGER(start, seg->ack) && LARGER(end, start) && SMALLER_OR_EQUAL(end, priv->snd_nxt))
+            pst_ranges_add(&priv->sacked, start, end - start);
+    }
+}
+
+/* The first sent segment below the highest SACKed byte that the peer is
+ * missing and that was not retransmitted yet in this recovery, or NULL */
+static SSegment * sack_next_hole(pst_socket_t * self)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+    uint32_t seq = LARGER(priv->sack_rexmit, priv->snd_una) ? priv->sack_rexmit : priv->snd_una;
+    n_dlist_t * iter;
+    uint32_t i;
+
+    for (i = 0; i < priv->sacked.count; i++)
+    {
+        RSegment * r = &priv->sacked.ranges[i];
+
+        if (LARGER(r->seq, seq))
+            break;
+        if (LARGER(r->seq + r->len, seq))
+            seq = r->seq + r->len;
+    }
+    // Nothing is known to be lost beyond the last SACKed range
+    if (i == priv->sacked.count)
+        return NULL;
+
+    iter = priv->sack_hint;
+    if (iter == NULL || LARGER(((SSegment *)iter->data)->seq, seq))
+        iter = n_queue_peek_head_link(&priv->slist);
+    while (iter && SMALLER_OR_EQUAL(((SSegment *)iter->data)->seq + ((SSegment *)iter->data)->len, seq))
+        iter = iter->next;
+    priv->sack_hint = iter;
+
+    return iter ? iter->data : NULL;
+}
+
 static int process(pst_socket_t * self, Segment * seg)
 {
     PseudoTcpSocketPrivate * priv = self->priv;
@@ -1463,6 +2279,9 @@ static int process(pst_socket_t * self, Segment * seg)
     is_valuable_ack = (LARGER(seg->ack, priv->snd_una) && SMALLER_OR_EQUAL(seg->ack, priv->snd_nxt));
     is_duplicate_ack = (seg->ack == priv->snd_una);
 
+    if (seg->n_sack > 0 && (is_valuable_ack || is_duplicate_ack))
+        sack_update(self, seg);
+
     if (is_valuable_ack)
     {
         uint32_t nAcked;
@@ -1487,6 +2306,7 @@ static int process(pst_socket_t * self, Segment * seg)
                 priv->rx_rto = bound(MIN_RTO, priv->rx_srtt + max(1LU, 4 * priv->rx_rttvar), MAX_RTO);
 
                 nice_debug("rtt: %ld   srtt: %u  rto: %u",  rtt, priv->rx_srtt, priv->rx_rto);
+                priv->cc->on_rtt_sample(self, (uint32_t)rtt, now);
             }
             else
             {
@@ -1499,6 +2319,7 @@ static int process(pst_socket_t * self, Segment * seg)
 
         nAcked = seg->ack - priv->snd_una;
         priv->snd_una = seg->ack;
+        pst_ranges_advance(&priv->sacked, priv->snd_una);
 
         priv->rto_base = (priv->snd_una == priv->snd_nxt) ? 0 : now;
 
@@ -1533,28 +2354,48 @@ static int process(pst_socket_t * self, Segment * seg)
                     priv->largest = data->len;
                 }
                 nFree -= data->len;
+                if (n_queue_peek_head_link(&priv->slist) == priv->sack_hint)
+                    priv->sack_hint = NULL;
                 n_slice_free(SSegment, data);
                 n_queue_pop_head(&priv->slist);
             }
         }
 
+        priv->cc->on_ack(self, nAcked, priv->dup_acks >= 3, now);
+
         if (priv->dup_acks >= 3)
         {
             if (LARGER_OR_EQUAL(priv->snd_una, priv->recover))    // NewReno
             {
                 uint32_t nInFlight = priv->snd_nxt - priv->snd_una;
                 // (Fast Retransmit)
-                priv->cwnd = min(priv->ssthresh, nInFlight + priv->mss);
+                // A SACK recovery tends to end with little in flight, it
+                // resumes at ssthresh rather than from one segment (RFC 6675)
+                if (priv->support_sack)
+                    priv->cwnd = priv->ssthresh;
+                else
+                    priv->cwnd = min(priv->ssthresh, nInFlight + priv->mss);
                 nice_debug("exit recovery");
                 priv->dup_acks = 0;
             }
             else
             {
-                nice_debug("recovery retransmit");
-                if (!transmit(self, n_queue_peek_head(&priv->slist), now))
+                SSegment * hole;
+
+                // With SACK every reported hole is retransmitted once
+                if (priv->support_sack && priv->sacked.count > 0)
+                    hole = sack_next_hole(self);
+                else
+                    hole = n_queue_peek_head(&priv->slist);
+                if (hole)
                 {
-                    closedown(self, ECONNABORTED, CLOSEDOWN_LOCAL);
-                    return FALSE;
+                    nice_debug("recovery retransmit");
+                    if (!transmit(self, hole, now))
+                    {
+                        closedown(self, ECONNABORTED, CLOSEDOWN_LOCAL);
+                        return FALSE;
+                    }
+                    priv->sack_rexmit = hole->seq + hole->len;
                 }
                 priv->cwnd += priv->mss - min(nAcked, priv->cwnd);
             }
@@ -1562,15 +2403,6 @@ static int process(pst_socket_t * self, Segment * seg)
         else
         {
             priv->dup_acks = 0;
-            // Slow start, congestion avoidance
-            if (priv->cwnd < priv->ssthresh)
-            {
-                priv->cwnd += priv->mss;
-            }
-            else
-            {
-                priv->cwnd += max(1LU, priv->mss * priv->mss / priv->cwnd);
-            }
         }
     }
     else if (is_duplicate_ack)
@@ -1586,27 +2418,45 @@ static int process(pst_socket_t * self, Segment * seg)
         }
         else if (priv->snd_una != priv->snd_nxt)
         {
-            uint32_t nInFlight;
-
             priv->dup_acks += 1;
             if (priv->dup_acks == 3)   // (Fast Retransmit)
             {
+                SSegment * head = n_queue_peek_head(&priv->slist);
+
                 nice_debug("enter recovery");
                 nice_debug("recovery retransmit");
-                if (!transmit(self, n_queue_peek_head(&priv->slist), now))
+                if (!transmit(self, head, now))
                 {
                     closedown(self, ECONNABORTED, CLOSEDOWN_LOCAL);
                     return FALSE;
                 }
+                priv->sack_rexmit = head->seq + head->len;
                 priv->recover = priv->snd_nxt;
-                nInFlight = priv->snd_nxt - priv->snd_una;
-                priv->ssthresh = max(nInFlight / 2, 2 * priv->mss);
-                //LOG(LS_INFO) << "priv->ssthresh: " << priv->ssthresh << "  nInFlight: " << nInFlight << "  priv->mss: " << priv->mss;
-                priv->cwnd = priv->ssthresh + 3 * priv->mss;
+                priv->cc->on_loss(self, now);
+                // inflated by the three segments that left the network
+                priv->cwnd += 3 * priv->mss;
             }
             else if (priv->dup_acks > 3)
             {
-                priv->cwnd += priv->mss;
+                SSegment * hole = NULL;
+
+                if (priv->support_sack && priv->sacked.count > 0)
+                    hole = sack_next_hole(self);
+                if (hole)
+                {
+                    // A segment left the network, a hole goes out in its place
+                    nice_debug("recovery retransmit");
+                    if (!transmit(self, hole, now))
+                    {
+                        closedown(self, ECONNABORTED, CLOSEDOWN_LOCAL);
+                        return FALSE;
+                    }
+                    priv->sack_rexmit = hole->seq + hole->len;
+                }
+                else
+                {
+                    priv->cwnd += priv->mss;
+                }
             }
         }
         else
@@ -1832,46 +2682,28 @@ static int process(pst_socket_t * self, Segment * seg)
 
             if (seg->seq == priv->rcv_nxt)
             {
-                n_dlist_t * iter = NULL;
+                uint32_t nAdjust;
 
                 pst_fifo_consume_write_buffer(&priv->rbuf, seg->len);
                 priv->rcv_nxt += seg->len;
                 priv->rcv_wnd -= seg->len;
                 bNewData = TRUE;
 
-                iter = priv->rlist;
-                while (iter &&  SMALLER_OR_EQUAL(((RSegment *)iter->data)->seq, priv->rcv_nxt))
+                nAdjust = pst_ranges_advance(&priv->rlist, priv->rcv_nxt);
+                if (nAdjust > 0)
                 {
-                    RSegment * data = (RSegment *)(iter->data);
-                    if (LARGER(data->seq + data->len, priv->rcv_nxt))
-                    {
-                        uint32_t nAdjust = (data->seq + data->len) - priv->rcv_nxt;
-                        sflags = sfImmediateAck; // (Fast Recovery)
-                        nice_debug("Recovered %u bytes (%u -> %u)",
-                                   nAdjust, priv->rcv_nxt, priv->rcv_nxt + nAdjust);
-                        pst_fifo_consume_write_buffer(&priv->rbuf, nAdjust);
-                        priv->rcv_nxt += nAdjust;
-                        priv->rcv_wnd -= nAdjust;
-                    }
-                    n_slice_free(RSegment, priv->rlist->data);
-                    priv->rlist = n_dlist_delete_link(priv->rlist, priv->rlist);
-                    iter = priv->rlist;
+                    sflags = sfImmediateAck; // (Fast Recovery)
+                    nice_debug("Recovered %u bytes (%u -> %u)",
+                               nAdjust, priv->rcv_nxt, priv->rcv_nxt + nAdjust);
+                    pst_fifo_consume_write_buffer(&priv->rbuf, nAdjust);
+                    priv->rcv_nxt += nAdjust;
+                    priv->rcv_wnd -= nAdjust;
                 }
             }
             else
             {
-                n_dlist_t * iter = NULL;
-                RSegment * rseg = n_slice_new0(RSegment);
-
                 nice_debug("Saving %u bytes (%u -> %u)", seg->len, seg->seq, seg->seq + seg->len);
-                rseg->seq = seg->seq;
-                rseg->len = seg->len;
-                iter = priv->rlist;
-                while (iter && SMALLER(((RSegment *)iter->data)->seq, rseg->seq))
-                {
-                    iter = n_dlist_next(iter);
-                }
-                priv->rlist = n_dlist_insert_before(priv->rlist, iter, rseg);
+                pst_ranges_add(&priv->rlist, seg->seq, seg->len);
             }
         }
     }
@@ -1985,7 +2817,16 @@ static int transmit(pst_socket_t * self, SSegment * segment, uint32_t now)
     return TRUE;
 }
 
-static void attempt_send(pst_socket_t * self, SendFlags sflags)
+/* Hands the packets held back by WritePacket to the socket in one go */
+static void flush_packets(pst_socket_t * self)
+{
+    PseudoTcpSocketPrivate * priv = self->priv;
+
+    if (priv->callbacks.FlushPackets)
+        priv->callbacks.FlushPackets(self, priv->callbacks.user_data);
+}
+
+static void send_burst(pst_socket_t * self, SendFlags sflags)
 {
     PseudoTcpSocketPrivate * priv = self->priv;
     uint32_t now = pseudo_tcp_get_current_time(self);
@@ -2008,7 +2849,7 @@ static void attempt_send(pst_socket_t * self, SendFlags sflags)
         n_dlist_t * iter;
         SSegment * sseg;
 
-        cwnd = priv->cwnd;
+        cwnd = priv->cc->cwnd(self);
         if ((priv->dup_acks == 1) || (priv->dup_acks == 2))   // Limited Transmit
         {
             cwnd += priv->dup_acks * priv->mss;
@@ -2040,7 +2881,7 @@ static void attempt_send(pst_socket_t * self, SendFlags sflags)
             uint32_t available_space = pst_fifo_get_write_remaining(&priv->sbuf);
             bFirst = FALSE;
             nice_debug("[cwnd: %u  nWindow: %u  nInFlight: %u nAvailable: %u nQueued: %u nEmpty: %u ssthresh: %u]",
-                       priv->cwnd, nWindow, nInFlight, nAvailable, snd_buffered, available_space, priv->ssthresh);
+                       cwnd, nWindow, nInFlight, nAvailable, snd_buffered, available_space, priv->ssthresh);
         }
 
         if (nAvailable == 0 && sflags != sfFin && sflags != sfRst)
@@ -2102,6 +2943,13 @@ static void attempt_send(pst_socket_t * self, SendFlags sflags)
     }
 }
 
+/* Every segment the window allows goes out in one burst, flushed together */
+static void attempt_send(pst_socket_t * self, SendFlags sflags)
+{
+    send_burst(self, sflags);
+    flush_packets(self);
+}
+
 /* If @source is %CLOSEDOWN_REMOTE, don?t send an RST packet, since closedown()
  * has been called as a result of an RST segment being received.
  * See: RFC 1122, ?4.2.2.13. */
@@ -2210,6 +3058,15 @@ static void apply_option(pst_socket_t * self, uint8_t kind, const uint8_t * data
             nice_debug("FIN-ACK support enabled.");
             apply_fin_ack_option(self);
             break;
+        case TCP_OPT_SACK:
+            // Selective acknowledgements, only used if we announced them too.
+            if (len != 1)
+            {
+                nice_debug("Invalid SACK option received.");
+                return;
+            }
+            nice_debug("Peer supports SACK.");
+            break;
         case TCP_OPT_EOL:
         case TCP_OPT_NOOP:
             /* Nothing to do. */
@@ -2226,6 +3083,7 @@ static void parse_options(pst_socket_t * self, const uint8_t * data, uint32_t le
     PseudoTcpSocketPrivate * priv = self->priv;
     int has_window_scaling_option = FALSE;
     int has_fin_ack_option = FALSE;
+    int has_sack_option = FALSE;
     uint32_t pos = 0;
 
     // See http://www.freesoft.org/CIE/Course/Section4/8.htm for
@@ -2278,6 +3136,8 @@ static void parse_options(pst_socket_t * self, const uint8_t * data, uint32_t le
             has_window_scaling_option = TRUE;
         else if (kind == TCP_OPT_FIN_ACK)
             has_fin_ack_option = TRUE;
+        else if (kind == TCP_OPT_SACK)
+            has_sack_option = TRUE;
     }
 
     if (!has_window_scaling_option)
@@ -2297,6 +3157,12 @@ static void parse_options(pst_socket_t * self, const uint8_t * data, uint32_t le
         nice_debug("Peer doesn't support FIN-ACK");
         priv->support_fin_ack = FALSE;
     }
+
+    if (!has_sack_option)
+    {
+        nice_debug("Peer doesn't support SACK");
+        priv->support_sack = FALSE;
+    }
 }
 
 static void resize_send_buffer(pst_socket_t * self, uint32_t new_size)
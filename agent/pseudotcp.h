@@ -178,6 +178,26 @@ typedef enum
     PSEUDO_TCP_SHUTDOWN_RDWR,
 } PseudoTcpShutdown;
 
+/**
+ * pst_cc_e:
+ * @PST_CC_NEWRENO: Loss based: slow start, then one segment per round trip,
+ * halved on loss. The default.
+ * @PST_CC_CUBIC: Loss based: after a loss the window grows back towards the
+ * size it had on a cubic curve of time, independent of the round trip time
+ * (RFC 8312). Suits long, fast paths.
+ * @PST_CC_BBR: Delay based: the window follows the delivery rate times the
+ * smallest round trip time seen, random losses do not shrink it.
+ *
+ * Congestion control algorithms, chosen per socket with
+ * %PROP_CONGESTION_CONTROL.
+ */
+typedef enum
+{
+    PST_CC_NEWRENO,
+    PST_CC_CUBIC,
+    PST_CC_BBR,
+} pst_cc_e;
+
 /**
  * pst_callback_t:
  * @user_data: A user defined pointer to be passed to the callbacks
@@ -186,6 +206,9 @@ typedef enum
  * @PseudoTcpWritable: The socket is writable
  * @PseudoTcpClosed: The socket was closed (both sides)
  * @WritePacket: This callback is called when the socket needs to send data.
+ * @FlushPackets: Optional. When set, @WritePacket may hold the packets back
+ * and send them later; this callback is called once the socket is done
+ * writing a burst, and every packet held back must be sent from it.
  *
  * A structure containing callbacks functions that will be called by the
  * #pst_socket_t when some events happen.
@@ -201,6 +224,7 @@ typedef struct
     void (*PseudoTcpWritable)(pst_socket_t * tcp, void * data);
     void (*PseudoTcpClosed)(pst_socket_t * tcp, uint32_t error, void * data);
     pst_wret_e(*WritePacket)(pst_socket_t * tcp, char * buffer, uint32_t len, void * data);
+    void (*FlushPackets)(pst_socket_t * tcp, void * data);
 } pst_callback_t;
 
 /**
@@ -271,6 +295,55 @@ int pst_connect(pst_socket_t * self);
  */
 int32_t  pst_recv(pst_socket_t * self, char * buffer, size_t len);
 
+/**
+ * pst_span_t:
+ * @data: Start of the region, read-only
+ * @len: Length of the region
+ *
+ * A contiguous region of the receive buffer lent by pst_recv_spans().
+ */
+typedef struct
+{
+    const uint8_t * data;
+    uint32_t len;
+} pst_span_t;
+
+/**
+ * pst_recv_spans:
+ * @self: The #pst_socket_t object.
+ * @spans: Filled with the regions holding the received data
+ * @n_spans: Set to the number of regions used, 1 or 2 when the data wraps
+ * around the end of the receive buffer
+ *
+ * Receive data from the socket without copying it: the received data is lent
+ * as read-only views of the receive buffer. It stays in the buffer, and in the
+ * receive window, until pst_recv_release() is called.
+ *
+ <note>
+   <para>
+     Only one set of spans may be outstanding, pst_recv() and
+     pst_recv_spans() fail with EWOULDBLOCK until it is released. The spans
+     stay valid while the socket is not finalized.
+   </para>
+ </note>
+ *
+ * Returns: The number of bytes lent, 0 at the end of the stream or -1 in case
+ * of error, same as pst_recv()
+ * <para> See also: pst_get_error() </para>
+ */
+int32_t pst_recv_spans(pst_socket_t * self, pst_span_t spans[2], uint32_t * n_spans);
+
+/**
+ * pst_recv_release:
+ * @self: The #pst_socket_t object.
+ * @len: Number of bytes consumed from the start of the spans
+ *
+ * Gives back the spans lent by pst_recv_spans(). The first @len bytes are
+ * dropped from the receive buffer and the receive window reopens; bytes past
+ * @len are lent again by the next pst_recv_spans().
+ */
+void pst_recv_release(pst_socket_t * self, uint32_t len);
+
 /**
  * pst_send:
  * @self: The #pst_socket_t object.
@@ -294,6 +367,27 @@ int32_t  pst_recv(pst_socket_t * self, char * buffer, size_t len);
  */
 int32_t pst_send(pst_socket_t * self, const char * buffer, uint32_t len);
 
+/**
+ * pst_send_msgs:
+ * @self: The #pst_socket_t object.
+ * @msgs: (array length=n_msgs): Messages to send, each a scatter-gather
+ * array of #n_outvector_t
+ * @n_msgs: Number of messages in @msgs
+ * @allow_partial: %TRUE to queue as many bytes as fit, %FALSE to queue
+ * whole messages only
+ *
+ * Send several messages on the socket at once. All the vectors are appended
+ * to the send buffer and the data is sent out once at the end, as if it had
+ * been passed to a single pst_send() call.
+ *
+ * Returns: The number of bytes queued if @allow_partial is %TRUE, the number
+ * of messages queued otherwise, or -1 in case of error. As with pst_send(),
+ * the %pst_callback_t:PseudoTcpWritable callback is called once more space
+ * is available if not everything could be queued.
+ * <para> See also: pst_get_error() </para>
+ */
+int32_t pst_send_msgs(pst_socket_t * self, const n_output_msg_t * msgs, uint32_t n_msgs, int allow_partial);
+
 
 /**
  * pst_close:
@@ -547,6 +641,22 @@ int pst_is_closed(pst_socket_t * self);
  */
 int pst_is_closed_remotely(pst_socket_t * self);
 
+/* properties */
+enum
+{
+    PROP_CONVERSATION = 1,
+    PROP_CALLBACKS,
+    PROP_STATE,
+    PROP_ACK_DELAY,
+    PROP_NO_DELAY,
+    PROP_RCV_BUF,
+    PROP_SND_BUF,
+    PROP_SUPPORT_FIN_ACK,
+    PROP_SUPPORT_SACK,      /* int, announce selective acknowledgements (default TRUE) */
+    PROP_CONGESTION_CONTROL, /* pst_cc_e, can be changed at any time */
+    LAST_PROPERTY
+};
+
 void pst_get_property(pst_socket_t * self, uint32_t property_id, void * value);
 void pst_set_property(pst_socket_t * self, uint32_t property_id, void * value);
 
@@ -20,6 +20,7 @@ n_stream_t * stream_new(n_agent_t * agent, uint32_t n_comps)
     n_comp_t * comp;
 
     stream = n_slice_new0(n_stream_t);
+    agent_mutex_init(&stream->mutex);
     for (n = 0; n < n_comps; n++)
     {
         comp = comp_new(n + 1, agent, stream);
@@ -47,9 +48,20 @@ void stream_free(n_stream_t * stream)
 {
     free(stream->name);
     n_slist_free_full(stream->components, (n_destroy_notify) component_free);
+    pthread_mutex_destroy(&stream->mutex);
     n_slice_free(n_stream_t, stream);  
 }
 
+void stream_lock(n_stream_t * stream)
+{
+    pthread_mutex_lock(&stream->mutex);
+}
+
+void stream_unlock(n_stream_t * stream)
+{
+    pthread_mutex_unlock(&stream->mutex);
+}
+
 n_comp_t * stream_find_comp_by_id(const n_stream_t * stream, uint32_t id)
 {
     n_slist_t * l;
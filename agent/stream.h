@@ -27,6 +27,7 @@ struct _stream_st
     char * name;
     uint32_t id;
     uint32_t n_components;
+    pthread_mutex_t mutex;          /* stream lock, see "Locking" in agent-priv.h */
     int initial_binding_request_received;
     n_slist_t * components; /* list of 'n_comp_t' structs */
     n_slist_t * conncheck_list;        /* list of n_cand_chk_pair_t items */
@@ -42,6 +43,8 @@ struct _stream_st
 n_stream_t * stream_new(n_agent_t * agent, uint32_t n_comps);
 void stream_close(n_stream_t * stream);
 void stream_free(n_stream_t * stream);
+void stream_lock(n_stream_t * stream);
+void stream_unlock(n_stream_t * stream);
 int stream_all_components_ready(const n_stream_t * stream);
 n_comp_t * stream_find_comp_by_id(const n_stream_t * stream, uint32_t id);
 void stream_initialize_credentials(n_stream_t * stream, n_rng_t * rng);
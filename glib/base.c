@@ -48,6 +48,36 @@ void atomic_int_inc(volatile int32_t * atomic)
     InterlockedIncrement(atomic);
 }
 
+/* Returns the value before the add */
+int32_t atomic_int_add(volatile int32_t * atomic, int32_t val)
+{
+#ifdef _WIN32
+    return InterlockedExchangeAdd((volatile LONG *)atomic, val);
+#else
+    return __sync_fetch_and_add(atomic, val);
+#endif
+}
+
+/* Returns the value before the or */
+int32_t atomic_int_or(volatile int32_t * atomic, int32_t val)
+{
+#ifdef _WIN32
+    return InterlockedOr((volatile LONG *)atomic, val);
+#else
+    return __sync_fetch_and_or(atomic, val);
+#endif
+}
+
+/* TRUE when *atomic was @oldval and has been replaced by @newval */
+int32_t atomic_int_compare_and_exchange(volatile int32_t * atomic, int32_t oldval, int32_t newval)
+{
+#ifdef _WIN32
+    return InterlockedCompareExchange((volatile LONG *)atomic, newval, oldval) == oldval;
+#else
+    return __sync_bool_compare_and_swap(atomic, oldval, newval);
+#endif
+}
+
 void get_current_time(n_timeval_t * result)
 {
 #ifndef _WIN32
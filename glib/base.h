@@ -62,6 +62,12 @@ void atomic_int_set(volatile int32_t *atomic, int32_t newval);
 
 void atomic_int_inc(volatile int32_t *atomic);
 
+int32_t atomic_int_add(volatile int32_t *atomic, int32_t val);
+
+int32_t atomic_int_or(volatile int32_t *atomic, int32_t val);
+
+int32_t atomic_int_compare_and_exchange(volatile int32_t *atomic, int32_t oldval, int32_t newval);
+
 void get_current_time(n_timeval_t * result);
 
 void time_val_add(n_timeval_t  * _time, int32_t microseconds);
@@ -1,11 +1,11 @@
 ﻿/*
- * FileName:       
+ * FileName:
  * Author:         luny  Version: 1.0  Date: 2016-9-6
- * Description:    
- * Version:        
- * Function List:  
+ * Description:
+ * Version:
+ * Function List:
  *                 1.
- * History:        
+ * History:
  *     <author>   <time>    <version >   <desc>
  */
 
@@ -21,40 +21,103 @@
 #endif
 
 #include "nlist.h"
+#include "nqueue.h"
 #include "pthread.h"
 #include "base.h"
 #include "event.h"
 
+/*
+ * Every handle owns a bounded ring of (event, payload) records. Posting is
+ * lock free for any number of producers (a slot is claimed by a CAS on the
+ * tail and published through its sequence number), the single consumer
+ * drains it in order and only takes the mutex to sleep when the ring is
+ * empty. A full ring rejects the post and counts it as an overflow.
+ */
 typedef struct
 {
-	uint32_t flag; 
-	int32_t n_event; 
+	volatile int32_t seq;
+	int32_t events;
+	void * n_data;
+	int64_t post_time;          /* monotonic usec of the post */
+} EVENT_SLOT_S;
+
+/* Histograms are log2 buckets of usec (or records for the queue depth):
+ * bucket 0 holds 0, bucket i holds [2^(i-1), 2^i), the last one the rest */
+typedef struct
+{
+	volatile int32_t post_wait[EVENT_HIST_BUCKETS];
+	volatile int32_t wakeup_latency[EVENT_HIST_BUCKETS];
+	volatile int32_t record_age[EVENT_HIST_BUCKETS];
+	volatile int32_t queue_depth[EVENT_HIST_BUCKETS];
+	volatile int32_t max_post_wait;
+	volatile int32_t max_wakeup_latency;
+	volatile int32_t max_record_age;
+	volatile int32_t max_queue_depth;
+	volatile int32_t posts;
+} EVENT_STATS_S;
+
+typedef struct
+{
+	uint32_t flag;
+	volatile int32_t tail;      /* next slot claimed by a producer */
+	int32_t head;               /* next slot read by the consumer */
+	int32_t mask;
+	EVENT_SLOT_S * ring;
+	volatile int32_t waiting;   /* consumer sleeps on cond */
+	volatile int32_t overflows; /* posts rejected on a full ring */
+	volatile int32_t overflow_events; /* event bits of the rejected posts */
+	n_queue_t stash;            /* records popped while not wanted, consumer only */
 	pthread_cond_t cond;
-	pthread_mutex_t mutex;	
-	int32_t pst_tm_max[3];   /* post time cost stats (total usr sys)*/
-	void * n_data[32];
+	pthread_mutex_t mutex;
+	int64_t signal_time;        /* usec the sleeping consumer was signalled */
+	EVENT_STATS_S stats;
+	uint32_t post_wait_threshold;   /* usec, 0 disables */
+	uint32_t record_age_threshold;  /* usec, 0 disables */
+	event_threshold_cb threshold_func;
+	void * threshold_data;
 } EVENT_FD_S, *PEVENT_FD_S;
 #define EVENT_FD_S_LEN  sizeof(EVENT_FD_S)
 
 typedef struct
 {
 	uint8_t opened;
-	uint16_t post_cost_threshold;
-	uint8_t reserved;
+	uint8_t reserved[3];
 } EVENT_PARAM_S, *PEVENT_PARAM_S;
 #define EVENT_PARAM_S_LEN   sizeof(EVENT_PARAM_S)
 
 static EVENT_PARAM_S event_param = { 0 };
 
 int32_t event_open(void)
+{
+	return event_open_ring(EVENT_RING_SIZE);
+}
+
+int32_t event_open_ring(uint32_t size)
 {
 	PEVENT_PARAM_S pevent_param = &event_param;
 	PEVENT_FD_S fd = NULL;
+	uint32_t cap = 2, i;
+
+	while (cap < size && cap < (1U << 30))
+	{
+		cap <<= 1;
+	}
 
 	if (NULL == (fd = n_slice_new0(EVENT_FD_S)))
 	{
 		return -1;
 	}
+	if (NULL == (fd->ring = n_slice_alloc(cap * sizeof(EVENT_SLOT_S))))
+	{
+		n_slice_free(EVENT_FD_S, fd);
+		return -1;
+	}
+	for (i = 0; i < cap; i++)
+	{
+		fd->ring[i].seq = i;
+	}
+	fd->mask = cap - 1;
+	n_queue_init(&fd->stash);
 	pthread_mutex_init(&fd->mutex, NULL);
 	pthread_cond_init(&fd->cond, NULL);
 	if (FALSE == pevent_param->opened)
@@ -65,107 +128,305 @@ int32_t event_open(void)
 	return (int32_t)fd;
 }
 
+static int32_t _event_hist_bucket(uint32_t value)
+{
+	int32_t bucket = 0;
+
+	while (value && bucket < EVENT_HIST_BUCKETS - 1)
+	{
+		value >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static void _event_hist_add(volatile int32_t * hist, volatile int32_t * max, int64_t value)
+{
+	int32_t old;
+	uint32_t v = (uint32_t)MIN(MAX(value, 0), G_MAXINT32);
+
+	atomic_int_inc(&hist[_event_hist_bucket(v)]);
+	while ((old = atomic_int_get(max)) < (int32_t)v)
+	{
+		if (atomic_int_compare_and_exchange(max, old, (int32_t)v))
+			break;
+	}
+}
+
+static void _event_threshold(PEVENT_FD_S fd, int32_t kind, uint32_t threshold, int64_t value)
+{
+	event_threshold_cb func = fd->threshold_func;
+
+	if (func && threshold && value > threshold)
+	{
+		func((int32_t)fd, kind, (uint32_t)MIN(value, G_MAXINT32), fd->threshold_data);
+	}
+}
+
+/* Consumer side: next published record or FALSE when the ring is empty */
+static int32_t _event_ring_pop(PEVENT_FD_S fd, n_event_rec_t * rec)
+{
+	EVENT_SLOT_S * slot = &fd->ring[fd->head & fd->mask];
+	int64_t age;
+
+	if (atomic_int_get(&slot->seq) - (fd->head + 1) < 0)
+	{
+		return FALSE;
+	}
+	rec->events = slot->events;
+	rec->n_data = slot->n_data;
+	age = get_monotonic_time() - slot->post_time;
+	atomic_int_set(&slot->seq, fd->head + fd->mask + 1);
+	fd->head++;
+
+	_event_hist_add(fd->stats.record_age, &fd->stats.max_record_age, age);
+	_event_threshold(fd, EVENT_STAT_RECORD_AGE, fd->record_age_threshold, age);
+	return TRUE;
+}
+
+/* Records queued in the ring, sampled by the consumer before it drains */
+static void _event_depth_sample(PEVENT_FD_S fd)
+{
+	int32_t depth = atomic_int_get(&fd->tail) - fd->head;
+
+	_event_hist_add(fd->stats.queue_depth, &fd->stats.max_queue_depth, MAX(depth, 0));
+}
+
+static int32_t _event_ring_ready(PEVENT_FD_S fd)
+{
+	return atomic_int_get(&fd->ring[fd->head & fd->mask].seq) - (fd->head + 1) >= 0;
+}
+
+/* Next record matching @want, earlier stashed records first. Records that
+ * are not wanted are stashed in order for a later wait. */
+static int32_t _event_pop(PEVENT_FD_S fd, int32_t want, n_event_rec_t * rec)
+{
+	n_dlist_t * l;
+	n_event_rec_t * stashed;
+
+	for (l = fd->stash.head; l; l = l->next)
+	{
+		stashed = (n_event_rec_t *)l->data;
+		if (stashed->events & want)
+		{
+			*rec = *stashed;
+			n_queue_delete_link(&fd->stash, l);
+			n_slice_free(n_event_rec_t, stashed);
+			return TRUE;
+		}
+	}
+
+	while (_event_ring_pop(fd, rec))
+	{
+		if (rec->events & want)
+		{
+			return TRUE;
+		}
+		n_queue_push_tail(&fd->stash, n_slice_copy(sizeof(n_event_rec_t), rec));
+	}
+	return FALSE;
+}
+
+static void _event_sleep(PEVENT_FD_S fd)
+{
+	pthread_mutex_lock(&fd->mutex);
+	atomic_int_set(&fd->waiting, 1);
+	fd->signal_time = 0;
+	if (!_event_ring_ready(fd))
+	{
+		pthread_cond_wait(&fd->cond, &fd->mutex);
+	}
+	atomic_int_set(&fd->waiting, 0);
+	if (fd->signal_time)
+	{
+		_event_hist_add(fd->stats.wakeup_latency, &fd->stats.max_wakeup_latency, get_monotonic_time() - fd->signal_time);
+	}
+	pthread_mutex_unlock(&fd->mutex);
+}
+
 int32_t event_wait(int32_t handle, int32_t want, int32_t *events, void ** n_data)
 {
 	PEVENT_FD_S fd = (PEVENT_FD_S)handle;
-	int32_t  idx = 0, i, tmp_events , ret;
+	n_event_rec_t rec;
 
 	if (NULL == events)
 	{
 		printf("unsupported events is NULL\n");
 		return -1;
 	}
-	//if (count == 1) sleep_ms(1000000);
-	//printf("\n[event_wait]: lock want(0x%x) mutex(%p)\n", want, &fd->mutex);
-	pthread_mutex_lock(&fd->mutex);
-	while (0 == (fd->n_event & want) )
+
+	_event_depth_sample(fd);
+	while (!_event_pop(fd, want, &rec))
 	{
-		//printf("\n[cond wait]\n");
-		ret = pthread_cond_wait(&fd->cond, &fd->mutex);
-		//printf("[cond wait] ret = %d\n", ret);
-	}	
-	
-	tmp_events = fd->n_event;
-	for (i = 0; i < 32; i++)
+		_event_sleep(fd);
+		_event_depth_sample(fd);
+	}
+	*events = rec.events;
+	*n_data = rec.n_data;
+
+	return 0;
+}
+
+int32_t event_wait_batch(int32_t handle, int32_t want, n_event_rec_t * recs, int32_t max_recs)
+{
+	PEVENT_FD_S fd = (PEVENT_FD_S)handle;
+	int32_t n = 0;
+
+	if (NULL == recs || max_recs <= 0)
 	{
-		if ((tmp_events >> i) & 1)
-		{
+		printf("unsupported recs(%p) max_recs(%d)\n", recs, max_recs);
+		return -1;
+	}
+
+	_event_depth_sample(fd);
+	while (!_event_pop(fd, want, &recs[0]))
+	{
+		_event_sleep(fd);
+		_event_depth_sample(fd);
+	}
+	for (n = 1; n < max_recs; n++)
+	{
+		if (!_event_pop(fd, want, &recs[n]))
 			break;
+	}
+
+	return n;
+}
+
+int32_t event_post(int32_t handle, int32_t events, void * n_data)
+{
+	PEVENT_FD_S fd = (PEVENT_FD_S)handle;
+	EVENT_SLOT_S * slot;
+	int32_t pos, dif;
+	int64_t begin = get_monotonic_time(), cost;
+
+	pos = atomic_int_get(&fd->tail);
+	for (;;)
+	{
+		slot = &fd->ring[pos & fd->mask];
+		dif = atomic_int_get(&slot->seq) - pos;
+		if (dif == 0)
+		{
+			if (atomic_int_compare_and_exchange(&fd->tail, pos, pos + 1))
+				break;
 		}
-		idx++;
+		else if (dif < 0)
+		{
+			/* ring full, the caller keeps ownership of n_data */
+			atomic_int_inc(&fd->overflows);
+			atomic_int_or(&fd->overflow_events, events);
+			return -1;
+		}
+		pos = atomic_int_get(&fd->tail);
 	}
-	*n_data = fd->n_data[idx];
-	*events = (fd->n_event & want), fd->n_event &= ~want;
-	pthread_mutex_unlock(&fd->mutex);
 
-	//printf("\n[event_wait]: unlock events(0x%x) idx(%d) data(%p)\n", *events, idx, *n_data);
+	slot->events = events;
+	slot->n_data = n_data;
+	slot->post_time = begin;
+	atomic_int_set(&slot->seq, pos + 1);
+
+	/* only the first post after the consumer went to sleep signals it */
+	if (atomic_int_get(&fd->waiting) && atomic_int_compare_and_exchange(&fd->waiting, 1, 0))
+	{
+		pthread_mutex_lock(&fd->mutex);
+		fd->signal_time = begin;
+		pthread_cond_signal(&fd->cond);
+		pthread_mutex_unlock(&fd->mutex);
+	}
+
+	/* time the poster was held up by other producers and the wakeup lock */
+	cost = get_monotonic_time() - begin;
+	atomic_int_inc(&fd->stats.posts);
+	_event_hist_add(fd->stats.post_wait, &fd->stats.max_post_wait, cost);
+	_event_threshold(fd, EVENT_STAT_POST_WAIT, fd->post_wait_threshold, cost);
 
 	return 0;
 }
 
-int32_t event_post(int32_t handle, int32_t events, void * n_data)
+int32_t event_get_overflow(int32_t handle, uint32_t * overflows, int32_t * events)
 {
 	PEVENT_FD_S fd = (PEVENT_FD_S)handle;
-	int32_t pst_tm_cur[3] = { 0 };
-	n_timeval_t  func_start, func_stop;
-	int32_t usec_time = 0, idx = 0, i, tmp_events ;
 
-	
-	if (event_param.post_cost_threshold)
+	if (fd == NULL)
+	{
+		return -1;
+	}
+	if (overflows)
+	{
+		*overflows = (uint32_t)atomic_int_get(&fd->overflows);
+	}
+	if (events)
 	{
-		//runtime_get_msec(&pst_tm_cur[0], &pst_tm_cur[1], &pst_tm_cur[2]);
+		*events = atomic_int_get(&fd->overflow_events);
 	}
-	//printf("\n[event_post]: prelock  fd->event(0x%x) events(0x%x) mutex(%p)\n", fd->n_event, events, &fd->mutex);
+	return 0;
+}
 
-	get_current_time(&func_start);
-	pthread_mutex_lock(&fd->mutex);
-	get_current_time(&func_stop);
+int32_t event_get_stats(int32_t handle, n_event_stats_t * stats, int32_t reset)
+{
+	PEVENT_FD_S fd = (PEVENT_FD_S)handle;
+	EVENT_STATS_S * st;
+	int32_t i;
 
-	usec_time = ((func_stop.tv_sec - func_start.tv_sec) * 1000 * 1000) + (func_stop.tv_usec - func_start.tv_usec);
-	//printf("\n[event_post]: locked usec_time(%d us)\n", usec_time);
-	fd->n_event |= events;
-	tmp_events = events;
-	for (i = 0; i < 32; i++)
+	if (fd == NULL || stats == NULL)
 	{
-		if ((tmp_events >> i) & 1)
-		{
-			break;
-		}
-		idx++;
+		return -1;
 	}
-	fd->n_data[idx] = n_data;
-	pthread_cond_signal(&fd->cond);
-	pthread_mutex_unlock(&fd->mutex);
 
-	get_current_time(&func_start);
-	usec_time = ((func_start.tv_sec - func_stop.tv_sec) * 1000 * 1000) + (func_start.tv_usec - func_stop.tv_usec);
-	//printf("[event_post]: unlock usec_time(%d us)\n", usec_time);
-	//printf("[event_post]: leave event(0x%x) events(0x%x) idx(%d) data(%p)\n", fd->n_event, events, idx, n_data);
+	st = &fd->stats;
+	for (i = 0; i < EVENT_HIST_BUCKETS; i++)
+	{
+		stats->post_wait[i] = (uint32_t)atomic_int_get(&st->post_wait[i]);
+		stats->wakeup_latency[i] = (uint32_t)atomic_int_get(&st->wakeup_latency[i]);
+		stats->record_age[i] = (uint32_t)atomic_int_get(&st->record_age[i]);
+		stats->queue_depth[i] = (uint32_t)atomic_int_get(&st->queue_depth[i]);
+	}
+	stats->max_post_wait = (uint32_t)atomic_int_get(&st->max_post_wait);
+	stats->max_wakeup_latency = (uint32_t)atomic_int_get(&st->max_wakeup_latency);
+	stats->max_record_age = (uint32_t)atomic_int_get(&st->max_record_age);
+	stats->max_queue_depth = (uint32_t)atomic_int_get(&st->max_queue_depth);
+	stats->posts = (uint32_t)atomic_int_get(&st->posts);
+	stats->overflows = (uint32_t)atomic_int_get(&fd->overflows);
+	stats->queued = (uint32_t)MAX(atomic_int_get(&fd->tail) - atomic_int_get(&fd->head), 0);
 
-	/*if (event_param.post_cost_threshold)
+	if (reset)
 	{
-		pst_tm_cur[0] = runtime_get_msec(&pst_tm_cur[0], &pst_tm_cur[1], &pst_tm_cur[2]);
-		fd->pst_tm_max[0] = IMAX(fd->pst_tm_max[0], pst_tm_cur[0]);
-		fd->pst_tm_max[1] = IMAX(fd->pst_tm_max[1], pst_tm_cur[1]);
-		fd->pst_tm_max[2] = IMAX(fd->pst_tm_max[2], pst_tm_cur[2]);
-		if (pst_tm_cur[0] > event_param.post_cost_threshold)
-		{
-			printf("post cost (total %d, usr %d, sys %d), MAX (total %d, usr %d, sys %d)\n",
-				pst_tm_cur[0], pst_tm_cur[1], pst_tm_cur[2], fd->pst_tm_max[0], fd->pst_tm_max[1], fd->pst_tm_max[2]);
-		}
-	}*/
+		/* counters bumped concurrently may survive the reset */
+		memset((void *)st, 0, sizeof(EVENT_STATS_S));
+	}
+	return 0;
+}
 
+int32_t event_set_threshold(int32_t handle, uint32_t post_wait_us, uint32_t record_age_us, event_threshold_cb func, void * user_data)
+{
+	PEVENT_FD_S fd = (PEVENT_FD_S)handle;
+
+	if (fd == NULL)
+	{
+		return -1;
+	}
+	fd->threshold_func = NULL;
+	fd->threshold_data = user_data;
+	fd->post_wait_threshold = post_wait_us;
+	fd->record_age_threshold = record_age_us;
+	fd->threshold_func = func;
 	return 0;
 }
 
 int32_t event_close(int32_t handle)
 {
 	PEVENT_FD_S fd = (PEVENT_FD_S)handle;
+	n_event_rec_t * rec;
 
 	fd->flag = 0;
+	while ((rec = n_queue_pop_head(&fd->stash)) != NULL)
+	{
+		n_slice_free(n_event_rec_t, rec);
+	}
 	pthread_cond_destroy(&fd->cond);
 	pthread_mutex_destroy(&fd->mutex);
-	free(fd);
+	n_slice_free1((fd->mask + 1) * sizeof(EVENT_SLOT_S), fd->ring);
+	n_slice_free(EVENT_FD_S, fd);
 	fd = NULL;
 
 	return 0;
@@ -15,12 +15,67 @@
 
 #define USEC_PER_SEC 1000000
 
+#define EVENT_RING_SIZE  1024   /* default records queued per handle */
+
+typedef struct
+{
+	int32_t events;
+	void * n_data;
+} n_event_rec_t;
+
 int32_t event_open(void);
 
+/* size is rounded up to a power of two */
+int32_t event_open_ring(uint32_t size);
+
+/* Blocks until a record matching want is queued and returns it. Records
+ * come out in post order, unwanted ones are kept for a later wait. */
 int32_t event_wait(int32_t handle, int32_t want, int32_t *events, void ** n_data);
 
+/* Same as event_wait() but drains up to max_recs records in one wakeup,
+ * returns the number of records stored in recs */
+int32_t event_wait_batch(int32_t handle, int32_t want, n_event_rec_t * recs, int32_t max_recs);
+
+/* Lock free, safe from any thread. Returns -1 when the ring is full, the
+ * post is then counted as an overflow and n_data stays with the caller. */
 int32_t event_post(int32_t handle, int32_t events, void * n_data);
 
+/* Number of posts rejected so far and the OR of their event bits */
+int32_t event_get_overflow(int32_t handle, uint32_t * overflows, int32_t * events);
+
+#define EVENT_HIST_BUCKETS  20  /* log2 buckets: 0, [1,2), [2,4) ... [2^18, inf) */
+
+typedef struct
+{
+	uint32_t post_wait[EVENT_HIST_BUCKETS];      /* usec a producer spent in event_post() */
+	uint32_t wakeup_latency[EVENT_HIST_BUCKETS]; /* usec from the waking post to the consumer running */
+	uint32_t record_age[EVENT_HIST_BUCKETS];     /* usec from post to delivery of each record */
+	uint32_t queue_depth[EVENT_HIST_BUCKETS];    /* records queued each time the consumer drains */
+	uint32_t max_post_wait;
+	uint32_t max_wakeup_latency;
+	uint32_t max_record_age;
+	uint32_t max_queue_depth;
+	uint32_t posts;
+	uint32_t overflows;
+	uint32_t queued;                             /* records queued right now */
+} n_event_stats_t;
+
+typedef enum
+{
+	EVENT_STAT_POST_WAIT = 1,
+	EVENT_STAT_RECORD_AGE,
+} EVENT_STAT_E;
+
+/* Called from the posting thread (EVENT_STAT_POST_WAIT) or the waiting
+ * thread (EVENT_STAT_RECORD_AGE) when a sample exceeds its threshold */
+typedef void (*event_threshold_cb)(int32_t handle, int32_t kind, uint32_t value, void * user_data);
+
+/* Copy the per-handle statistics, reset clears the histograms and maxima */
+int32_t event_get_stats(int32_t handle, n_event_stats_t * stats, int32_t reset);
+
+/* Thresholds in usec, 0 disables one; func NULL disables both */
+int32_t event_set_threshold(int32_t handle, uint32_t post_wait_us, uint32_t record_age_us, event_threshold_cb func, void * user_data);
+
 int32_t event_close(int32_t handle);
 
 #endif /* _EVENT_H_ */
@@ -0,0 +1,449 @@
+/*
+ * FileName:       executor.c
+ * Author:
+ * Description:    I/O thread pool
+ * Version:
+ * Function List:
+ *                 1.
+ * History:
+ *     <author>   <time>    <version >   <desc>
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include "pthread.h"
+#include "base.h"
+#include "reactor.h"
+#include "executor.h"
+
+#define EXECUTOR_MAX_EVENTS  64
+
+/*
+ * Every I/O thread blocks in reactor_wait() on its own reactor, so the
+ * number of threads is fixed no matter how many clients are attached.
+ * A thread also watches the read end of a wake pair, executor_stop()
+ * writes one byte to it to get the thread out of reactor_wait(), and so
+ * does the select reactor when the set of sockets changed under it.
+ *
+ * Events are collected before they are handled, so a handler may run for
+ * a registration removed in between. A thread counts its passes so that
+ * executor_quiesce() can wait until it has handled every batch it held
+ * when the registration went away.
+ */
+typedef struct
+{
+	int32_t index;
+	pthread_t tid;
+	volatile int32_t running;
+	volatile int32_t passes;    /* loop passes, bumped before every wait */
+	int32_t reactor;
+	int32_t wake[2];        /* [0] watched by the thread, [1] written to wake it */
+	int32_t clients;        /* clients assigned by executor_pick() */
+	EXECUTOR_STATS_S stats; /* written by the thread only */
+} EXECUTOR_THREAD_S, *PEXECUTOR_THREAD_S;
+
+typedef struct
+{
+	int32_t opened;
+	int32_t started;
+	int32_t policy;
+	int32_t num;
+	int32_t next;           /* round robin cursor */
+	executor_io_cb func;
+	volatile int32_t spin_us;   /* busy poll budget, 0 blocks right away */
+	volatile int32_t sock_us;   /* SO_BUSY_POLL for the clients' sockets */
+	pthread_mutex_t mutex;  /* guards clients and next */
+	EXECUTOR_THREAD_S threads[EXECUTOR_MAX_THREADS];
+} EXECUTOR_S;
+
+static EXECUTOR_S executor = { 0 };
+
+#ifdef _WIN32
+
+/* select() only takes sockets on Win32, wake through a loopback UDP pair */
+static int32_t _executor_wake_open(int32_t wake[2])
+{
+	struct sockaddr_in addr;
+	int addr_len = sizeof(addr);
+	SOCKET rd, wr;
+	u_long nonblock = 1;
+
+	rd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	wr = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (rd == INVALID_SOCKET || wr == INVALID_SOCKET)
+		goto err;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(rd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+		|| getsockname(rd, (struct sockaddr *)&addr, &addr_len) != 0
+		|| connect(wr, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+		goto err;
+	ioctlsocket(rd, FIONBIO, &nonblock);
+
+	wake[0] = (int32_t)rd;
+	wake[1] = (int32_t)wr;
+	return 0;
+err:
+	if (rd != INVALID_SOCKET)
+		closesocket(rd);
+	if (wr != INVALID_SOCKET)
+		closesocket(wr);
+	return -1;
+}
+
+static void _executor_wake_close(int32_t wake[2])
+{
+	closesocket((SOCKET)wake[0]);
+	closesocket((SOCKET)wake[1]);
+}
+
+static void _executor_wake(int32_t wake[2])
+{
+	send((SOCKET)wake[1], "w", 1, 0);
+}
+
+static void _executor_wake_drain(int32_t wake[2])
+{
+	char buf[16];
+
+	while (recv((SOCKET)wake[0], buf, sizeof(buf), 0) > 0)
+		;
+}
+
+#else
+
+static int32_t _executor_wake_open(int32_t wake[2])
+{
+	int fds[2];
+
+	if (pipe(fds) < 0)
+		return -1;
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	wake[0] = fds[0];
+	wake[1] = fds[1];
+	return 0;
+}
+
+static void _executor_wake_close(int32_t wake[2])
+{
+	close(wake[0]);
+	close(wake[1]);
+}
+
+static void _executor_wake(int32_t wake[2])
+{
+	ssize_t ret = write(wake[1], "w", 1);
+
+	(void)ret;
+}
+
+static void _executor_wake_drain(int32_t wake[2])
+{
+	char buf[16];
+
+	while (read(wake[0], buf, sizeof(buf)) > 0)
+		;
+}
+
+#endif
+
+static void _executor_reactor_wake(void * data)
+{
+	_executor_wake(((PEXECUTOR_THREAD_S)data)->wake);
+}
+
+static void _executor_loop(void * arg)
+{
+	PEXECUTOR_THREAD_S th = (PEXECUTOR_THREAD_S)arg;
+	n_reactor_ev_t evs[EXECUTOR_MAX_EVENTS];
+	int64_t spin_until = 0;
+	int32_t n, i, spin;
+	uint32_t dels;
+
+	while (th->running)
+	{
+		/* every batch collected before is handled */
+		atomic_int_add(&th->passes, 1);
+
+		/* busy poll until the budget set after the last events runs out */
+		spin = spin_until != 0 && get_monotonic_time() < spin_until;
+		if (spin_until != 0 && !spin)
+		{
+			th->stats.spin_expired++;
+			spin_until = 0;
+		}
+
+		dels = reactor_del_count(th->reactor);
+		n = reactor_wait(th->reactor, evs, EXECUTOR_MAX_EVENTS, spin ? 0 : -1);
+		if (n < 0)
+		{
+			printf("_executor_loop[%d] wait err = %d\n", th->index, net_errno());
+			sleep_ms(1);
+			continue;
+		}
+		if (n == 0)
+			continue;
+
+		if (spin)
+			th->stats.spin_hits++;
+		else
+			th->stats.wakeups++;
+		if (executor.spin_us > 0)
+			spin_until = get_monotonic_time() + executor.spin_us;
+		else
+			spin_until = 0;
+
+		for (i = 0; i < n && th->running; i++)
+		{
+			if (evs[i].data == th)
+			{
+				_executor_wake_drain(th->wake);
+				continue;
+			}
+			/* a handler before this one may have removed it */
+			if (reactor_del_count(th->reactor) != dels && !reactor_valid(th->reactor, &evs[i]))
+				continue;
+			executor.func(evs[i].fd, evs[i].events, evs[i].data);
+		}
+	}
+	printf("_executor_loop[%d] exit\n", th->index);
+	pthread_exit(NULL);
+}
+
+int32_t executor_open(int32_t threads, int32_t policy, executor_io_cb func)
+{
+	int32_t i;
+
+	if (executor.opened)
+	{
+		printf("executor is opened\n");
+		return -1;
+	}
+	if (threads <= 0 || threads > EXECUTOR_MAX_THREADS || func == NULL)
+		return -1;
+
+	for (i = 0; i < threads; i++)
+	{
+		PEXECUTOR_THREAD_S th = &executor.threads[i];
+
+		memset(th, 0, sizeof(*th));
+		th->index = i;
+		if ((th->reactor = reactor_open()) < 0)
+			break;
+		if (_executor_wake_open(th->wake) < 0)
+		{
+			reactor_close(th->reactor);
+			break;
+		}
+		reactor_add(th->reactor, th->wake[0], REACTOR_IN, th);
+		reactor_set_wake(th->reactor, _executor_reactor_wake, th);
+	}
+	if (i < threads)
+	{
+		while (--i >= 0)
+		{
+			_executor_wake_close(executor.threads[i].wake);
+			reactor_close(executor.threads[i].reactor);
+		}
+		return -1;
+	}
+
+	pthread_mutex_init(&executor.mutex, NULL);
+	executor.policy = policy;
+	executor.func = func;
+	executor.num = threads;
+	executor.next = 0;
+	executor.opened = 1;
+	return 0;
+}
+
+int32_t executor_start(void)
+{
+	int32_t i;
+
+	if (!executor.opened || executor.started)
+		return -1;
+
+	for (i = 0; i < executor.num; i++)
+	{
+		PEXECUTOR_THREAD_S th = &executor.threads[i];
+
+		th->running = 1;
+		if (pthread_create(&th->tid, 0, (void *)_executor_loop, th) != 0)
+		{
+			th->running = 0;
+			break;
+		}
+	}
+	executor.started = 1;
+	if (i < executor.num)
+	{
+		executor_stop();
+		return -1;
+	}
+	printf("executor started (%d threads)\n", executor.num);
+	return 0;
+}
+
+int32_t executor_stop(void)
+{
+	int32_t i;
+
+	if (!executor.started)
+		return -1;
+
+	for (i = 0; i < executor.num; i++)
+	{
+		PEXECUTOR_THREAD_S th = &executor.threads[i];
+
+		if (!th->running)
+			continue;
+		th->running = 0;
+		_executor_wake(th->wake);
+		pthread_join(th->tid, NULL);
+	}
+	executor.started = 0;
+	return 0;
+}
+
+int32_t executor_quiesce(void)
+{
+	int32_t i, passes;
+
+	if (!executor.started)
+		return 0;
+
+	for (i = 0; i < executor.num; i++)
+	{
+		PEXECUTOR_THREAD_S th = &executor.threads[i];
+
+		/* a thread never waits for itself, its own later events are
+		 * checked before they are handled */
+		if (!th->running || pthread_equal(th->tid, pthread_self()))
+			continue;
+		passes = atomic_int_get(&th->passes);
+		_executor_wake(th->wake);
+		while (th->running && atomic_int_get(&th->passes) == passes)
+			sleep_ms(1);
+	}
+	return 0;
+}
+
+int32_t executor_thread_count(void)
+{
+	return executor.opened ? executor.num : 0;
+}
+
+int32_t executor_pick(void)
+{
+	int32_t i, index = 0;
+
+	if (!executor.opened)
+		return -1;
+
+	pthread_mutex_lock(&executor.mutex);
+	if (executor.policy == EXECUTOR_POLICY_ROUND_ROBIN)
+	{
+		index = executor.next;
+		executor.next = (executor.next + 1) % executor.num;
+	}
+	else
+	{
+		for (i = 1; i < executor.num; i++)
+		{
+			if (executor.threads[i].clients < executor.threads[index].clients)
+				index = i;
+		}
+	}
+	executor.threads[index].clients++;
+	pthread_mutex_unlock(&executor.mutex);
+
+	return index;
+}
+
+int32_t executor_release(int32_t index)
+{
+	if (!executor.opened || index < 0 || index >= executor.num)
+		return -1;
+
+	pthread_mutex_lock(&executor.mutex);
+	if (executor.threads[index].clients > 0)
+		executor.threads[index].clients--;
+	pthread_mutex_unlock(&executor.mutex);
+	return 0;
+}
+
+int32_t executor_reactor(int32_t index)
+{
+	if (!executor.opened || index < 0 || index >= executor.num)
+		return 0;
+	return executor.threads[index].reactor;
+}
+
+int32_t executor_set_busy_poll(int32_t spin_us, int32_t sock_us)
+{
+	if (spin_us < 0 || sock_us < 0)
+		return -1;
+	executor.spin_us = spin_us;
+	executor.sock_us = sock_us;
+	return 0;
+}
+
+int32_t executor_sock_busy_poll(void)
+{
+	return executor.sock_us;
+}
+
+int32_t executor_get_stats(EXECUTOR_STATS_S * stats, int32_t reset)
+{
+	int32_t i;
+
+	if (!executor.opened || stats == NULL)
+		return -1;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < executor.num; i++)
+	{
+		PEXECUTOR_THREAD_S th = &executor.threads[i];
+
+		stats->spin_hits += th->stats.spin_hits;
+		stats->spin_expired += th->stats.spin_expired;
+		stats->wakeups += th->stats.wakeups;
+		if (reset)
+			memset(&th->stats, 0, sizeof(th->stats));
+	}
+	return 0;
+}
+
+int32_t executor_close(void)
+{
+	int32_t i;
+
+	if (!executor.opened)
+		return -1;
+
+	executor_stop();
+	for (i = 0; i < executor.num; i++)
+	{
+		_executor_wake_close(executor.threads[i].wake);
+		reactor_close(executor.threads[i].reactor);
+	}
+	pthread_mutex_destroy(&executor.mutex);
+	executor.opened = 0;
+	executor.num = 0;
+	return 0;
+}
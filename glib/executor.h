@@ -0,0 +1,75 @@
+/*
+ * FileName:       executor.h
+ * Author:
+ * Description:    fixed pool of I/O threads, each waiting on its own
+ *                 reactor; clients are spread over the threads by a
+ *                 balancing policy
+ * Version:
+ * Function List:
+ *                 1.
+ * History:
+ *     <author>   <time>    <version >   <desc>
+ */
+#ifndef __EXECUTOR_H__
+#define __EXECUTOR_H__
+
+#include <stdint.h>
+
+#define EXECUTOR_MAX_THREADS  64
+
+typedef enum
+{
+	EXECUTOR_POLICY_LEAST_LOADED = 0,   /* thread with the fewest clients */
+	EXECUTOR_POLICY_ROUND_ROBIN,        /* threads in turn */
+} EXECUTOR_POLICY_E;
+
+typedef struct
+{
+	uint64_t spin_hits;         /* events found while busy polling */
+	uint64_t spin_expired;      /* busy poll budgets that ran out empty */
+	uint64_t wakeups;           /* events found by a blocking wait */
+} EXECUTOR_STATS_S;
+
+/* Called on an I/O thread for every ready socket, data is the pointer
+ * given to reactor_add() on that thread's reactor */
+typedef void (*executor_io_cb)(int32_t fd, uint32_t events, void * data);
+
+/* Creates the reactor of every thread without starting the threads */
+int32_t executor_open(int32_t threads, int32_t policy, executor_io_cb func);
+
+/* Spawns the I/O threads; registrations made while stopped are kept */
+int32_t executor_start(void);
+
+/* Wakes every I/O thread and joins it, reactors stay open */
+int32_t executor_stop(void);
+
+/* Waits until no I/O thread can still be handling an event collected for a
+ * registration removed before the call. Call it without any lock a handler
+ * may take, before freeing what was given to reactor_add(). */
+int32_t executor_quiesce(void);
+
+int32_t executor_thread_count(void);
+
+/* Assigns a client to a thread by the policy and returns the thread index,
+ * executor_release() gives the slot back */
+int32_t executor_pick(void);
+
+int32_t executor_release(int32_t index);
+
+/* Reactor of the thread, clients register their sockets on it */
+int32_t executor_reactor(int32_t index);
+
+/* After handling events a thread keeps polling its reactor without blocking
+ * for spin_us before it blocks again, 0 (the default) blocks right away.
+ * sock_us is the SO_BUSY_POLL time clients should set on their sockets so
+ * the kernel polls the device queue too, 0 leaves the sockets alone. */
+int32_t executor_set_busy_poll(int32_t spin_us, int32_t sock_us);
+
+int32_t executor_sock_busy_poll(void);
+
+/* Sums the counters of every thread */
+int32_t executor_get_stats(EXECUTOR_STATS_S * stats, int32_t reset);
+
+int32_t executor_close(void);
+
+#endif /* __EXECUTOR_H__ */
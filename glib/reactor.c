@@ -0,0 +1,473 @@
+/*
+ * FileName:       reactor.c
+ * Author:
+ * Description:    socket readiness reactor
+ * Version:
+ * Function List:
+ *                 1.
+ * History:
+ *     <author>   <time>    <version >   <desc>
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+/* the Win32 default of 64 sockets per fd_set is far too few for a server,
+ * it has to be raised before the first winsock header */
+#ifndef FD_SETSIZE
+#define FD_SETSIZE 1024
+#endif
+#include <WinSock2.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#endif
+
+#ifdef __linux__
+#define REACTOR_EPOLL 1
+#include <sys/epoll.h>
+#endif
+
+#include "nlist.h"
+#include "pthread.h"
+#include "base.h"
+#include "reactor.h"
+
+typedef struct
+{
+	int32_t fd;
+	uint32_t events;
+	void * data;
+	uint32_t gen;               /* tells a reused fd from the one it replaced */
+} REACTOR_REG_S;
+
+typedef struct
+{
+	pthread_mutex_t mutex;      /* guards the registrations */
+	reactor_wake_cb wake;       /* gets a waiter out of a stale select set */
+	void * wake_data;
+	uint32_t gen;               /* last registration stamp handed out */
+	volatile int32_t dels;      /* reactor_del() calls so far */
+#ifdef REACTOR_EPOLL
+	int32_t epfd;
+	REACTOR_REG_S * slots;      /* registrations indexed by fd, data NULL when free */
+	int32_t n_slots;
+#else
+	REACTOR_REG_S * regs;
+	int32_t n_regs;
+	int32_t max_regs;
+	int32_t waiting;            /* a thread sits in select() on a copy of regs */
+#endif
+} REACTOR_FD_S, *PREACTOR_FD_S;
+
+int32_t reactor_open(void)
+{
+	PREACTOR_FD_S fd = NULL;
+
+	if (NULL == (fd = n_slice_new0(REACTOR_FD_S)))
+	{
+		return -1;
+	}
+#ifdef REACTOR_EPOLL
+	if ((fd->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	{
+		printf("epoll_create1 err = %d\n", errno);
+		n_slice_free(REACTOR_FD_S, fd);
+		return -1;
+	}
+#endif
+	pthread_mutex_init(&fd->mutex, NULL);
+
+	return (int32_t)fd;
+}
+
+int32_t reactor_set_wake(int32_t handle, reactor_wake_cb func, void * data)
+{
+	PREACTOR_FD_S fd = (PREACTOR_FD_S)handle;
+
+	if (fd == NULL)
+		return -1;
+
+	pthread_mutex_lock(&fd->mutex);
+	fd->wake = func;
+	fd->wake_data = data;
+	pthread_mutex_unlock(&fd->mutex);
+	return 0;
+}
+
+uint32_t reactor_del_count(int32_t handle)
+{
+	PREACTOR_FD_S fd = (PREACTOR_FD_S)handle;
+
+	return fd ? (uint32_t)atomic_int_get(&fd->dels) : 0;
+}
+
+/* Caller holds fd->mutex */
+static REACTOR_REG_S * _reactor_find(PREACTOR_FD_S fd, int32_t sock);
+
+int32_t reactor_valid(int32_t handle, const n_reactor_ev_t * ev)
+{
+	PREACTOR_FD_S fd = (PREACTOR_FD_S)handle;
+	REACTOR_REG_S * reg;
+	int32_t ret;
+
+	if (fd == NULL || ev == NULL)
+		return FALSE;
+
+	pthread_mutex_lock(&fd->mutex);
+	reg = _reactor_find(fd, ev->fd);
+	ret = (reg != NULL && reg->gen == ev->gen && reg->data == ev->data);
+	pthread_mutex_unlock(&fd->mutex);
+	return ret;
+}
+
+#ifdef REACTOR_EPOLL
+
+static uint32_t _reactor_to_epoll(uint32_t events)
+{
+	uint32_t ev = 0;
+
+	if (events & REACTOR_IN)
+		ev |= EPOLLIN;
+	if (events & REACTOR_OUT)
+		ev |= EPOLLOUT;
+	return ev;
+}
+
+static uint32_t _reactor_from_epoll(uint32_t ev)
+{
+	uint32_t events = 0;
+
+	if (ev & EPOLLIN)
+		events |= REACTOR_IN;
+	if (ev & EPOLLOUT)
+		events |= REACTOR_OUT;
+	if (ev & (EPOLLERR | EPOLLHUP))
+		events |= REACTOR_ERR;
+	return events;
+}
+
+static REACTOR_REG_S * _reactor_find(PREACTOR_FD_S fd, int32_t sock)
+{
+	if (sock < 0 || sock >= fd->n_slots || fd->slots[sock].data == NULL)
+		return NULL;
+	return &fd->slots[sock];
+}
+
+int32_t reactor_add(int32_t handle, int32_t sock, uint32_t events, void * data)
+{
+	PREACTOR_FD_S fd = (PREACTOR_FD_S)handle;
+	struct epoll_event ev;
+	REACTOR_REG_S * reg;
+	int32_t ret;
+
+	if (fd == NULL || sock < 0)
+		return -1;
+
+	pthread_mutex_lock(&fd->mutex);
+	if (sock >= fd->n_slots)
+	{
+		int32_t len = MAX(fd->n_slots * 2, 64);
+		REACTOR_REG_S * tmp;
+
+		while (len <= sock)
+			len *= 2;
+		tmp = n_slice_alloc0(len * sizeof(REACTOR_REG_S));
+		if (tmp == NULL)
+		{
+			pthread_mutex_unlock(&fd->mutex);
+			return -1;
+		}
+		if (fd->slots)
+		{
+			memcpy(tmp, fd->slots, fd->n_slots * sizeof(REACTOR_REG_S));
+			n_slice_free1(fd->n_slots * sizeof(REACTOR_REG_S), fd->slots);
+		}
+		fd->slots = tmp;
+		fd->n_slots = len;
+	}
+	reg = &fd->slots[sock];
+	/* a new registration, events still queued for an older socket that had
+	 * the same fd must not reach its data */
+	if (reg->data == NULL)
+		reg->gen = ++fd->gen;
+	reg->fd = sock;
+	reg->events = events;
+	reg->data = data;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = _reactor_to_epoll(events);
+	ev.data.u64 = ((uint64_t)reg->gen << 32) | (uint32_t)sock;
+	pthread_mutex_unlock(&fd->mutex);
+
+	ret = epoll_ctl(fd->epfd, EPOLL_CTL_ADD, sock, &ev);
+	if (ret < 0 && errno == EEXIST)
+	{
+		ret = epoll_ctl(fd->epfd, EPOLL_CTL_MOD, sock, &ev);
+	}
+	return ret < 0 ? -1 : 0;
+}
+
+int32_t reactor_del(int32_t handle, int32_t sock)
+{
+	PREACTOR_FD_S fd = (PREACTOR_FD_S)handle;
+	struct epoll_event ev;
+
+	if (fd == NULL || sock < 0)
+		return -1;
+
+	pthread_mutex_lock(&fd->mutex);
+	if (sock < fd->n_slots)
+	{
+		fd->slots[sock].data = NULL;
+	}
+	atomic_int_add(&fd->dels, 1);
+	pthread_mutex_unlock(&fd->mutex);
+
+	/* a non NULL event keeps pre 2.6.9 kernels happy */
+	return epoll_ctl(fd->epfd, EPOLL_CTL_DEL, sock, &ev) < 0 ? -1 : 0;
+}
+
+int32_t reactor_wait(int32_t handle, n_reactor_ev_t * evs, int32_t max_evs, int32_t timeout)
+{
+	PREACTOR_FD_S fd = (PREACTOR_FD_S)handle;
+	struct epoll_event ep[64];
+	int32_t n, i, k = 0;
+
+	if (fd == NULL || evs == NULL || max_evs <= 0)
+		return -1;
+
+	n = epoll_wait(fd->epfd, ep, MIN(max_evs, (int32_t)N_ELEMENTS(ep)), timeout);
+	if (n < 0)
+	{
+		return errno == EINTR ? 0 : -1;
+	}
+
+	pthread_mutex_lock(&fd->mutex);
+	for (i = 0; i < n; i++)
+	{
+		int32_t sock = (int32_t)(uint32_t)ep[i].data.u64;
+		REACTOR_REG_S * reg = _reactor_find(fd, sock);
+
+		/* removed while we were waiting, or its fd is already reused */
+		if (reg == NULL || reg->gen != (uint32_t)(ep[i].data.u64 >> 32))
+			continue;
+		evs[k].fd = sock;
+		evs[k].events = _reactor_from_epoll(ep[i].events);
+		evs[k].data = reg->data;
+		evs[k].gen = reg->gen;
+		k++;
+	}
+	pthread_mutex_unlock(&fd->mutex);
+
+	return k;
+}
+
+#else /* select */
+
+static REACTOR_REG_S * _reactor_find(PREACTOR_FD_S fd, int32_t sock)
+{
+	int32_t i;
+
+	for (i = 0; i < fd->n_regs; i++)
+	{
+		if (fd->regs[i].fd == sock)
+			return &fd->regs[i];
+	}
+	return NULL;
+}
+
+/* The waiter only watches the sockets it copied before select(), make it
+ * rebuild its sets. Caller holds fd->mutex. */
+static void _reactor_kick(PREACTOR_FD_S fd)
+{
+	if (fd->waiting && fd->wake)
+	{
+		fd->waiting = 0;
+		fd->wake(fd->wake_data);
+	}
+}
+
+int32_t reactor_add(int32_t handle, int32_t sock, uint32_t events, void * data)
+{
+	PREACTOR_FD_S fd = (PREACTOR_FD_S)handle;
+	int32_t i;
+
+	if (fd == NULL || sock < 0)
+		return -1;
+
+	pthread_mutex_lock(&fd->mutex);
+	for (i = 0; i < fd->n_regs; i++)
+	{
+		if (fd->regs[i].fd == sock)
+			break;
+	}
+	if (i == fd->n_regs)
+	{
+		if (fd->n_regs >= FD_SETSIZE)
+		{
+			pthread_mutex_unlock(&fd->mutex);
+			return -1;
+		}
+		if (fd->n_regs == fd->max_regs)
+		{
+			int32_t max = MAX(fd->max_regs * 2, 16);
+			REACTOR_REG_S * tmp = n_slice_alloc0(max * sizeof(REACTOR_REG_S));
+
+			if (tmp == NULL)
+			{
+				pthread_mutex_unlock(&fd->mutex);
+				return -1;
+			}
+			if (fd->regs)
+			{
+				memcpy(tmp, fd->regs, fd->n_regs * sizeof(REACTOR_REG_S));
+				n_slice_free1(fd->max_regs * sizeof(REACTOR_REG_S), fd->regs);
+			}
+			fd->regs = tmp;
+			fd->max_regs = max;
+		}
+		fd->n_regs++;
+		fd->regs[i].gen = ++fd->gen;
+	}
+	fd->regs[i].fd = sock;
+	fd->regs[i].events = events;
+	fd->regs[i].data = data;
+	_reactor_kick(fd);
+	pthread_mutex_unlock(&fd->mutex);
+
+	return 0;
+}
+
+int32_t reactor_del(int32_t handle, int32_t sock)
+{
+	PREACTOR_FD_S fd = (PREACTOR_FD_S)handle;
+	int32_t i;
+
+	if (fd == NULL)
+		return -1;
+
+	pthread_mutex_lock(&fd->mutex);
+	for (i = 0; i < fd->n_regs; i++)
+	{
+		if (fd->regs[i].fd == sock)
+		{
+			fd->regs[i] = fd->regs[--fd->n_regs];
+			_reactor_kick(fd);
+			break;
+		}
+	}
+	atomic_int_add(&fd->dels, 1);
+	pthread_mutex_unlock(&fd->mutex);
+
+	return 0;
+}
+
+int32_t reactor_wait(int32_t handle, n_reactor_ev_t * evs, int32_t max_evs, int32_t timeout)
+{
+	PREACTOR_FD_S fd = (PREACTOR_FD_S)handle;
+	REACTOR_REG_S regs[FD_SETSIZE];
+	fd_set read_set, write_set, exception_set;
+	struct timeval tv;
+	int32_t n_regs, i, k = 0, rc, nfds = 0;
+
+	if (fd == NULL || evs == NULL || max_evs <= 0)
+		return -1;
+
+	FD_ZERO(&read_set);
+	FD_ZERO(&write_set);
+	FD_ZERO(&exception_set);
+
+	/* select needs the sets rebuilt, but only from the registration array */
+	pthread_mutex_lock(&fd->mutex);
+	n_regs = fd->n_regs;
+	memcpy(regs, fd->regs, n_regs * sizeof(REACTOR_REG_S));
+	fd->waiting = (n_regs > 0 && timeout != 0);
+	pthread_mutex_unlock(&fd->mutex);
+
+	for (i = 0; i < n_regs; i++)
+	{
+		if (regs[i].events & REACTOR_IN)
+			FD_SET(regs[i].fd, &read_set);
+		if (regs[i].events & REACTOR_OUT)
+			FD_SET(regs[i].fd, &write_set);
+		FD_SET(regs[i].fd, &exception_set);
+		if (regs[i].fd >= nfds)
+			nfds = regs[i].fd + 1;
+	}
+
+	if (n_regs == 0)
+	{
+		/* nothing registered, still honour the timeout */
+		if (timeout > 0)
+			sleep_ms(timeout);
+		return 0;
+	}
+
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = 1000 * (timeout % 1000);
+	rc = select(nfds, &read_set, &write_set, &exception_set, timeout < 0 ? NULL : &tv);
+
+	pthread_mutex_lock(&fd->mutex);
+	fd->waiting = 0;
+	if (rc <= 0)
+	{
+		pthread_mutex_unlock(&fd->mutex);
+		return rc;
+	}
+
+	for (i = 0; i < n_regs && k < max_evs; i++)
+	{
+		uint32_t events = 0;
+		REACTOR_REG_S * reg;
+
+		if (FD_ISSET(regs[i].fd, &read_set))
+			events |= REACTOR_IN;
+		if (FD_ISSET(regs[i].fd, &write_set))
+			events |= REACTOR_OUT;
+		if (FD_ISSET(regs[i].fd, &exception_set))
+			events |= REACTOR_ERR;
+		if (events == 0)
+			continue;
+		/* removed while we were waiting, or its fd is already reused */
+		reg = _reactor_find(fd, regs[i].fd);
+		if (reg == NULL || reg->gen != regs[i].gen)
+			continue;
+		evs[k].fd = reg->fd;
+		evs[k].events = events;
+		evs[k].data = reg->data;
+		evs[k].gen = reg->gen;
+		k++;
+	}
+	pthread_mutex_unlock(&fd->mutex);
+
+	return k;
+}
+
+#endif
+
+int32_t reactor_close(int32_t handle)
+{
+	PREACTOR_FD_S fd = (PREACTOR_FD_S)handle;
+
+	if (fd == NULL)
+		return -1;
+
+#ifdef REACTOR_EPOLL
+	close(fd->epfd);
+	if (fd->slots)
+		n_slice_free1(fd->n_slots * sizeof(REACTOR_REG_S), fd->slots);
+#else
+	if (fd->regs)
+		n_slice_free1(fd->max_regs * sizeof(REACTOR_REG_S), fd->regs);
+#endif
+	pthread_mutex_destroy(&fd->mutex);
+	n_slice_free(REACTOR_FD_S, fd);
+
+	return 0;
+}
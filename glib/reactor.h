@@ -0,0 +1,62 @@
+/*
+ * FileName:       reactor.h
+ * Author:
+ * Description:    socket readiness reactor, epoll on Linux and select
+ *                 elsewhere; sockets are registered once and stay
+ *                 registered until removed
+ * Version:
+ * Function List:
+ *                 1.
+ * History:
+ *     <author>   <time>    <version >   <desc>
+ */
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <stdint.h>
+
+#define REACTOR_IN   0x0001  /* readable */
+#define REACTOR_OUT  0x0002  /* writable */
+#define REACTOR_ERR  0x0004  /* error or hang up */
+
+typedef struct
+{
+	int32_t fd;
+	uint32_t events;
+	void * data;
+	uint32_t gen;       /* registration the event belongs to */
+} n_reactor_ev_t;
+
+/* Wakes a thread blocked in reactor_wait(), see reactor_set_wake() */
+typedef void (*reactor_wake_cb)(void * data);
+
+int32_t reactor_open(void);
+
+/* The select backend waits on a snapshot of the registrations, reactor_add()
+ * and reactor_del() call func to get a blocked waiter to take a new one.
+ * epoll sees changes right away and never calls it. */
+int32_t reactor_set_wake(int32_t handle, reactor_wake_cb func, void * data);
+
+/* Registers fd, or updates events/data if it is already registered. data
+ * must not be NULL. Safe to call from any thread while another one sits in
+ * reactor_wait(). The select backend takes at most FD_SETSIZE sockets per
+ * reactor, raised to 1024 on Win32. */
+int32_t reactor_add(int32_t handle, int32_t fd, uint32_t events, void * data);
+
+int32_t reactor_del(int32_t handle, int32_t fd);
+
+/* Number of reactor_del() calls so far. A waiter handling a batch of
+ * events compares it to know whether the later ones may be stale. */
+uint32_t reactor_del_count(int32_t handle);
+
+/* TRUE while the registration ev was collected for still stands, i.e. its
+ * fd was neither removed nor reused by another registration since */
+int32_t reactor_valid(int32_t handle, const n_reactor_ev_t * ev);
+
+/* Waits up to timeout ms (-1 forever) and returns the number of ready
+ * sockets stored in evs, 0 on timeout, -1 on error */
+int32_t reactor_wait(int32_t handle, n_reactor_ev_t * evs, int32_t max_evs, int32_t timeout);
+
+int32_t reactor_close(int32_t handle);
+
+#endif /* __REACTOR_H__ */
@@ -6,12 +6,11 @@
 
 #ifdef _WIN32
 #include <windows.h>
-#define TIMER_SUB_MSEC  0  /* ms */
 #else
 #include <unistd.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/poll.h>
-#define TIMER_SUB_MSEC  10  /* ms */
 #endif
 
 #include "pthread.h"
@@ -20,15 +19,53 @@
 #include "event.h"
 #include "nlist.h"
 
-#define MAX_TIMER_NUM 64
 #define TIMER_PTHREAD_NAME "timer"
 
-#define TIMER_MIN_MSEC  10  /* ms */
+/*
+ * Hierarchical timing wheel, one tick per millisecond of monotonic time.
+ * The first level resolves the next 256 ms exactly, every further level
+ * covers 64 times the span of the previous one and is cascaded down when
+ * the level below wraps. Start, stop and expiry are O(1) and the number of
+ * timers is only bounded by memory.
+ *
+ * Expiries are kept in usec. The timer thread sleeps on a condition
+ * variable until the earliest pending deadline, timers due within the
+ * current millisecond are fired at their exact deadline, and an idle wheel
+ * blocks without any wakeup until a timer is armed.
+ *
+ * A timer with slack may fire up to slack ms late. Its expiry is rounded
+ * up to the coarsest ms boundary inside that window, so timers whose
+ * windows overlap land on the same tick and are fired in one wakeup.
+ */
+#define TVR_BITS    8
+#define TVN_BITS    6
+#define TVR_SIZE    (1 << TVR_BITS)
+#define TVN_SIZE    (1 << TVN_BITS)
+#define TVR_MASK    (TVR_SIZE - 1)
+#define TVN_MASK    (TVN_SIZE - 1)
+#define TVN_LEVELS  4
+
+#define TIMER_MAX_DELTA  0xffffffffLL  /* ms, ~49 days */
+
+typedef struct _timer_node_st timer_node_t;
+
+struct _timer_node_st
+{
+	timer_node_t * next;
+	timer_node_t * prev;
+};
+
+typedef struct _timer_fd_st n_timer_fd_t;
 
 typedef struct
 {
-	int32_t once, ticks, interval, enable;
-	int64_t mono_ticks;
+	timer_node_t node;      /* must stay first, slots link timers through it */
+	n_timer_fd_t * fd;      /* loop the timer is bound to */
+	int32_t once, interval, enable;
+	uint32_t slack;         /* ms the expiry may be delayed to coalesce */
+	int32_t running;        /* callback in progress on the timer thread */
+	int32_t destroyed;      /* timer_destroy() called from its own callback */
+	int64_t expires;        /* monotonic time (usec) of the next expiry */
 	notifycallback func;
 	void * data;
 	char identify[MAX_ID_LEN];
@@ -36,157 +73,583 @@ typedef struct
 
 #define TIMER_S_ELN sizeof(n_timer_t)
 
-typedef struct
+struct _timer_fd_st
 {
 	int32_t flag;
+	int32_t index;          /* position in timer_fds[] */
 	pthread_t tid, pid;
 	int32_t healthy;
-	int32_t max_num;
 	int32_t running;
-	int32_t count;
-	n_slist_t * timer_list;
-} n_timer_fd_t;
+	int32_t count;          /* timers currently armed in the wheel */
+	int32_t inited;
+	int32_t waiting;        /* thread blocked in _timer_wait() */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int64_t deadline;       /* usec the thread sleeps until, -1 for none */
+	int64_t clk;            /* next wheel tick to be processed (ms) */
+	int64_t cascaded;       /* last tick whose upper levels were cascaded */
+	int64_t loop_cost;      /* usec spent walking the wheel */
+	int64_t loop_passes;
+	timer_node_t tv1[TVR_SIZE];
+	timer_node_t tvn[TVN_LEVELS][TVN_SIZE];
+};
 
 #define TIMER_FD_S_LEN  sizeof(n_timer_fd_t)
 
-static n_timer_fd_t timer_fd = { 0 };
+/* Every loop owns a wheel and a thread, timers only ever run on the loop
+ * they are bound to, so a slow callback on one loop cannot delay the
+ * timers of another. Loop 0 is the default one opened by timer_open(). */
+static n_timer_fd_t timer_fds[TIMER_MAX_LOOPS] = { 0 };
+static int32_t timer_loops = 0;     /* loops opened so far */
+static volatile int32_t timer_loop_next = 0; /* round robin cursor of timer_loop_pick() */
+/* Serialises the lazy setup of a loop, its own mutex is not usable yet */
+static pthread_mutex_t timer_init_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static void _timer_loop(void *arg)
+#define TIMER_TICK(usec)  ((usec) / ONE_MSEC_PER_USEC)
+
+static inline void _node_init(timer_node_t * head)
 {
-	n_timer_fd_t * fd = &timer_fd;
-	n_timer_t * n_timer = NULL;
-	n_slist_t * i;
-	n_timeval_t  tv_now, tv_last;
-	int32_t step = TIMER_MIN_MSEC;
-	int32_t interval = (TIMER_MIN_MSEC - TIMER_SUB_MSEC) * ONE_MSEC_PER_USEC;
+	head->next = head->prev = head;
+}
 
-	get_current_time(&tv_last);
-	tv_last.tv_usec = ((tv_last.tv_usec + 5000) / 10000) * 10000; /* ʱ侫Ϊ10 */
+static inline int32_t _node_empty(timer_node_t * head)
+{
+	return head->next == head;
+}
 
-	fd->running = 1;
-	while (fd->running)
+static inline int32_t _node_linked(timer_node_t * node)
+{
+	return node->next != NULL;
+}
+
+static inline void _node_add_tail(timer_node_t * head, timer_node_t * node)
+{
+	node->prev = head->prev;
+	node->next = head;
+	head->prev->next = node;
+	head->prev = node;
+}
+
+static inline void _node_del(timer_node_t * node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->next = node->prev = NULL;
+}
+
+static inline void _node_splice(timer_node_t * from, timer_node_t * to)
+{
+	_node_init(to);
+	if (!_node_empty(from))
 	{
-		sleep_us(interval);
-		fd->healthy = 0;
+		to->next = from->next;
+		to->prev = from->prev;
+		to->next->prev = to;
+		to->prev->next = to;
+		_node_init(from);
+	}
+}
+
+static void _timer_wheel_init(n_timer_fd_t * fd)
+{
+	int32_t i, j;
+
+	for (i = 0; i < TVR_SIZE; i++)
+		_node_init(&fd->tv1[i]);
+	for (i = 0; i < TVN_LEVELS; i++)
+		for (j = 0; j < TVN_SIZE; j++)
+			_node_init(&fd->tvn[i][j]);
+	fd->clk = TIMER_TICK(get_monotonic_time());
+	fd->cascaded = fd->clk - 1;
+}
+
+static void _timer_ensure_init(n_timer_fd_t * fd)
+{
+	pthread_mutex_lock(&timer_init_mutex);
+	if (!fd->inited)
+	{
+#ifndef _WIN32
+		pthread_condattr_t attr;
 
-		get_current_time(&tv_now);
-		tv_now.tv_usec = ((tv_now.tv_usec + 5000) / 10000) * 10000; /* ʱ侫Ϊ10 */
-		step = ((tv_now.tv_sec - tv_last.tv_sec) * ONE_SEC_PER_MSEC) +
-			((tv_now.tv_usec - tv_last.tv_usec) / ONE_MSEC_PER_USEC); /* ʱ,λΪ */
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&fd->cond, &attr);
+		pthread_condattr_destroy(&attr);
+#else
+		pthread_cond_init(&fd->cond, NULL);
+#endif
+		pthread_mutex_init(&fd->mutex, NULL);
+		fd->deadline = -1;
+		_timer_wheel_init(fd);
+		fd->inited = 1;
+	}
+	pthread_mutex_unlock(&timer_init_mutex);
+}
 
-																	  /* ϵͳʱ޸ĵ,λ<0>1sжϷǷ */
-		step = (((step > ONE_SEC_PER_MSEC) | (step < 0)) ? TIMER_MIN_MSEC : step);
-		tv_last = tv_now;
+/* Caller holds fd->mutex */
+static void _timer_enqueue(n_timer_fd_t * fd, n_timer_t * n_timer)
+{
+	int64_t expires = TIMER_TICK(n_timer->expires);
+	int64_t idx = expires - fd->clk;
+	timer_node_t * slot;
 
-		for (i = fd->timer_list; i; i = i->next)
+	if (idx < 0)
+	{
+		/* already due, fired on the next pass */
+		slot = &fd->tv1[fd->clk & TVR_MASK];
+	}
+	else if (idx < TVR_SIZE)
+	{
+		slot = &fd->tv1[expires & TVR_MASK];
+	}
+	else if (idx < 1LL << (TVR_BITS + TVN_BITS))
+	{
+		slot = &fd->tvn[0][(expires >> TVR_BITS) & TVN_MASK];
+	}
+	else if (idx < 1LL << (TVR_BITS + 2 * TVN_BITS))
+	{
+		slot = &fd->tvn[1][(expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK];
+	}
+	else if (idx < 1LL << (TVR_BITS + 3 * TVN_BITS))
+	{
+		slot = &fd->tvn[2][(expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK];
+	}
+	else
+	{
+		if (idx > TIMER_MAX_DELTA)
 		{
-			n_timer = (n_timer_t *) i->data;
+			expires = fd->clk + TIMER_MAX_DELTA;
+			n_timer->expires = expires * ONE_MSEC_PER_USEC;
+		}
+		slot = &fd->tvn[3][(expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK];
+	}
+	_node_add_tail(slot, &n_timer->node);
+	fd->count++;
+}
 
-			if (n_timer->mono_ticks && n_timer->enable)
-			{
-				if ((get_monotonic_time() - n_timer->mono_ticks <= 0) && n_timer->enable)
-				{
-					n_timer->func(n_timer->data);					
-					n_timer->mono_ticks = 0;
-				}
-			}
-			
-			if (n_timer->ticks && n_timer->enable)
-			{
-				n_timer->ticks -= step;
-			}
-			if (n_timer->ticks <= 0 && n_timer->enable)
-			{
-				n_timer->func(n_timer->data);
+/* Caller holds fd->mutex */
+static void _timer_dequeue(n_timer_fd_t * fd, n_timer_t * n_timer)
+{
+	if (_node_linked(&n_timer->node))
+	{
+		_node_del(&n_timer->node);
+		fd->count--;
+	}
+}
 
-				if (n_timer->once)
-				{
-					timer_stop((int32_t)n_timer);
-				}
-				else
-				{
-					n_timer->ticks += n_timer->interval;
-				}
-			}
+/* Latest ms boundary within [expires, expires + slack] with the most
+ * trailing zero bits, so that overlapping windows pick the same tick */
+static int64_t _timer_apply_slack(n_timer_t * n_timer, int64_t expires)
+{
+	int64_t tick, limit, mask;
+	int32_t bit = 0;
+
+	if (n_timer->slack == 0)
+		return expires;
+
+	tick = (expires + ONE_MSEC_PER_USEC - 1) / ONE_MSEC_PER_USEC;
+	limit = tick + n_timer->slack;
+	for (mask = tick ^ limit; mask; mask >>= 1)
+		bit++;
+	if (bit > 1)
+		limit &= ~((1LL << (bit - 1)) - 1);
+	return limit * ONE_MSEC_PER_USEC;
+}
+
+/* An empty wheel stops its clock, bring it forward to now before the next
+ * timer goes in so the thread does not walk every idle tick. Caller holds
+ * fd->mutex. */
+static void _timer_resync(n_timer_fd_t * fd)
+{
+	int64_t tick;
+
+	if (fd->count != 0)
+		return;
+	tick = TIMER_TICK(get_monotonic_time());
+	if (tick > fd->clk)
+	{
+		fd->clk = tick;
+		fd->cascaded = tick - 1;
+	}
+}
+
+/* Caller holds fd->mutex, wakes the thread up when @expires (usec) comes
+ * before the deadline it currently sleeps until */
+static void _timer_arm(n_timer_fd_t * fd, n_timer_t * n_timer, int64_t expires)
+{
+	expires = _timer_apply_slack(n_timer, expires);
+	_timer_dequeue(fd, n_timer);
+	_timer_resync(fd);
+	n_timer->expires = expires;
+	_timer_enqueue(fd, n_timer);
+	if (fd->waiting && (fd->deadline < 0 || expires < fd->deadline))
+	{
+		fd->waiting = 0;
+		pthread_cond_signal(&fd->cond);
+	}
+}
+
+/* Re-spread one slot of an upper level over the levels below it */
+static int32_t _timer_cascade(n_timer_fd_t * fd, int32_t level, int32_t index)
+{
+	timer_node_t list;
+
+	_node_splice(&fd->tvn[level][index], &list);
+	while (!_node_empty(&list))
+	{
+		n_timer_t * n_timer = (n_timer_t *)list.next;
+
+		_node_del(&n_timer->node);
+		fd->count--;
+		_timer_enqueue(fd, n_timer);
+	}
+	return index;
+}
+
+#define TV_INDEX(fd, n) ((int32_t)(((fd)->clk >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK))
+
+/* Pull the timers of tick fd->clk down from the upper levels, once per tick */
+static void _timer_cascade_tick(n_timer_fd_t * fd)
+{
+	if (fd->cascaded == fd->clk)
+		return;
+	fd->cascaded = fd->clk;
+
+	if (!(fd->clk & TVR_MASK) &&
+		!_timer_cascade(fd, 0, TV_INDEX(fd, 0)) &&
+		!_timer_cascade(fd, 1, TV_INDEX(fd, 1)) &&
+		!_timer_cascade(fd, 2, TV_INDEX(fd, 2)))
+	{
+		_timer_cascade(fd, 3, TV_INDEX(fd, 3));
+	}
+}
+
+/* Run one unlinked timer. Caller holds fd->mutex, it is dropped around the
+ * callback so callbacks may freely use the API, including stopping or
+ * destroying the timer they are called for. */
+static void _timer_fire(n_timer_fd_t * fd, n_timer_t * n_timer)
+{
+	n_timer->running = 1;
+	pthread_mutex_unlock(&fd->mutex);
+	n_timer->func(n_timer->data);
+	pthread_mutex_lock(&fd->mutex);
+	n_timer->running = 0;
+
+	if (n_timer->destroyed)
+	{
+		n_slice_free1(TIMER_S_ELN, n_timer);
+		return;
+	}
+
+	/* the callback re-armed or stopped the timer itself */
+	if (_node_linked(&n_timer->node) || !n_timer->enable)
+		return;
+
+	if (n_timer->once)
+	{
+		n_timer->enable = FALSE;
+	}
+	else
+	{
+		_timer_arm(fd, n_timer, get_monotonic_time() + (int64_t)MAX(n_timer->interval, 1) * ONE_MSEC_PER_USEC);
+	}
+}
+
+/* Fire everything due at @now (usec). Whole ticks before the current
+ * millisecond are drained, the current tick only fires the timers whose
+ * deadline has passed. Caller holds fd->mutex. */
+static void _timer_run(n_timer_fd_t * fd, int64_t now)
+{
+	timer_node_t work, * slot;
+	n_timer_t * n_timer;
+
+	while (fd->clk < TIMER_TICK(now))
+	{
+		_timer_cascade_tick(fd);
+		slot = &fd->tv1[fd->clk & TVR_MASK];
+		fd->clk++;
+
+		_node_splice(slot, &work);
+		while (!_node_empty(&work))
+		{
+			n_timer = (n_timer_t *)work.next;
+			_node_del(&n_timer->node);
+			fd->count--;
+			_timer_fire(fd, n_timer);
+		}
+	}
+
+	_timer_cascade_tick(fd);
+	slot = &fd->tv1[fd->clk & TVR_MASK];
+	_node_splice(slot, &work);
+	while (!_node_empty(&work))
+	{
+		n_timer = (n_timer_t *)work.next;
+		_node_del(&n_timer->node);
+		if (n_timer->expires > now)
+		{
+			_node_add_tail(slot, &n_timer->node);
+			continue;
+		}
+		fd->count--;
+		_timer_fire(fd, n_timer);
+	}
+}
+
+/* Earliest deadline (usec) the thread has to wake up for, -1 when idle.
+ * Timers still parked in an upper level are woken for at the tick their
+ * slot cascades down. Caller holds fd->mutex. */
+static int64_t _timer_next_deadline(n_timer_fd_t * fd)
+{
+	int64_t deadline = -1, base, tick;
+	int32_t i, level, shift;
+	timer_node_t * slot, * node;
+
+	if (fd->count == 0)
+		return -1;
+
+	for (i = 0; i < TVR_SIZE; i++)
+	{
+		slot = &fd->tv1[(fd->clk + i) & TVR_MASK];
+		if (_node_empty(slot))
+			continue;
+		for (node = slot->next; node != slot; node = node->next)
+		{
+			if (deadline < 0 || ((n_timer_t *)node)->expires < deadline)
+				deadline = ((n_timer_t *)node)->expires;
+		}
+		break;
+	}
+
+	for (level = 0; level < TVN_LEVELS; level++)
+	{
+		shift = TVR_BITS + level * TVN_BITS;
+		base = fd->clk >> shift;
+		for (i = 1; i <= TVN_SIZE; i++)
+		{
+			if (_node_empty(&fd->tvn[level][(base + i) & TVN_MASK]))
+				continue;
+			tick = (base + i) << shift;
+			if (deadline < 0 || tick * ONE_MSEC_PER_USEC < deadline)
+				deadline = tick * ONE_MSEC_PER_USEC;
+			break;
 		}
 	}
-	printf("_timer_loop exit\n");
+	return deadline;
+}
+
+/* Block until @deadline (monotonic usec) or until signalled. Caller holds
+ * fd->mutex. */
+static void _timer_wait(n_timer_fd_t * fd, int64_t deadline)
+{
+	struct timespec ts;
+	int64_t abs_us;
+
+	fd->deadline = deadline;
+	fd->waiting = 1;
+	if (deadline < 0)
+	{
+		pthread_cond_wait(&fd->cond, &fd->mutex);
+	}
+	else
+	{
+#ifdef _WIN32
+		n_timeval_t now;
+
+		/* pthreads-win32 only knows the realtime clock */
+		get_current_time(&now);
+		abs_us = (int64_t)now.tv_sec * USEC_PER_SEC + now.tv_usec + (deadline - get_monotonic_time());
+#else
+		abs_us = deadline;
+#endif
+		ts.tv_sec = (time_t)(abs_us / USEC_PER_SEC);
+		ts.tv_nsec = (long)(abs_us % USEC_PER_SEC) * 1000;
+		pthread_cond_timedwait(&fd->cond, &fd->mutex, &ts);
+	}
+	fd->waiting = 0;
+	fd->deadline = -1;
+}
+
+static void _timer_loop(void *arg)
+{
+	n_timer_fd_t * fd = (n_timer_fd_t *)arg;
+	int64_t begin, deadline;
+
+	pthread_mutex_lock(&fd->mutex);
+	fd->running = 1;
+	while (fd->running)
+	{
+		fd->healthy = 0;
+
+		begin = get_monotonic_time();
+		_timer_run(fd, begin);
+		fd->loop_cost += get_monotonic_time() - begin;
+		fd->loop_passes++;
+
+		deadline = _timer_next_deadline(fd);
+		if (fd->running && (deadline < 0 || deadline > get_monotonic_time()))
+		{
+			_timer_wait(fd, deadline);
+		}
+	}
+	pthread_mutex_unlock(&fd->mutex);
+	printf("_timer_loop[%d] exit\n", fd->index);
 	pthread_exit(NULL);
 }
 
-int32_t timer_open()
+static int32_t _timer_loop_start(n_timer_fd_t * fd)
 {
-	n_timer_fd_t * fd = &timer_fd;
 	int32_t rtval;
 
-	memset(fd, 0x00, TIMER_FD_S_LEN);
-	fd->max_num = MAX_TIMER_NUM;
+	_timer_ensure_init(fd);
+	pthread_mutex_lock(&fd->mutex);
+	fd->flag = fd->healthy = 0;
+	fd->loop_cost = fd->loop_passes = 0;
+	_timer_resync(fd);
+	pthread_mutex_unlock(&fd->mutex);
 
-	if (fd->running)
+	if ((rtval = pthread_create(&fd->tid, 0, (void *)_timer_loop, fd)) < 0)
 	{
-		printf("timer thread is started\n");
+		fd->running = 0;
 		return -1;
 	}
 	else
 	{
-		if ((rtval = pthread_create(&fd->tid, 0, (void *)_timer_loop, 0)) < 0)
-		{
-			fd->running = 0;
-			return -1;
-		}
-		else
+		while ((0 == fd->running) && (0 == fd->healthy))
 		{
-			while ((0 == fd->running) && (0 == fd->healthy))
-			{
-				sleep_ms(10);
-			}
+			sleep_ms(10);
 		}
 	}
+	return 0;
+}
+
+static n_timer_fd_t * _timer_loop_get(int32_t loop)
+{
+	if (loop < 0 || loop >= TIMER_MAX_LOOPS)
+		return NULL;
+	timer_fds[loop].index = loop;
+	return &timer_fds[loop];
+}
+
+int32_t timer_open()
+{
+	n_timer_fd_t * fd = _timer_loop_get(0);
+
+	if (fd->running)
+	{
+		printf("timer thread is started\n");
+		return -1;
+	}
+
+	if (_timer_loop_start(fd) < 0)
+		return -1;
+	if (timer_loops == 0)
+		timer_loops = 1;
 	return (int32_t)fd;
 }
 
+int32_t timer_open_loops(int32_t num)
+{
+	int32_t i;
+
+	if (num <= 0 || num > TIMER_MAX_LOOPS)
+		return -1;
+
+	for (i = 0; i < num; i++)
+	{
+		n_timer_fd_t * fd = _timer_loop_get(i);
+
+		if (fd->running)
+			continue;
+		if (_timer_loop_start(fd) < 0)
+			break;
+	}
+	timer_loops = MAX(timer_loops, i);
+	printf("timer loops opened (%d)\n", timer_loops);
+	return i ? i : -1;
+}
+
+int32_t timer_loop_count(void)
+{
+	return timer_loops;
+}
+
+int32_t timer_loop_pick(void)
+{
+	int32_t loops = timer_loops;
+
+	if (loops <= 1)
+		return 0;
+	return (uint32_t)atomic_int_add(&timer_loop_next, 1) % loops;
+}
+
 int32_t timer_create()
 {
-	n_timer_fd_t * fd = &timer_fd;
+	return timer_create_on(0);
+}
+
+int32_t timer_create_on(int32_t loop)
+{
+	n_timer_fd_t * fd = _timer_loop_get(loop);
 	n_timer_t * n_timer = NULL;
 
-	if (fd->count > MAX_TIMER_NUM)
-	{
+	if (fd == NULL)
 		return -1;
-	}
 
-	n_timer = (n_timer_t *)n_slice_alloc(TIMER_S_ELN);
+	n_timer = (n_timer_t *)n_slice_alloc0(TIMER_S_ELN);
 	if (n_timer != NULL)
 	{
+		n_timer->fd = fd;
 		return (int32_t)n_timer;
 	}
 	return -1;
 }
 
+int32_t timer_bind(int32_t handle, int32_t loop)
+{
+	n_timer_fd_t * fd = _timer_loop_get(loop);
+	n_timer_t * n_timer = (n_timer_t *)handle;
+
+	/* a timer only moves while it is idle, never under its old loop */
+	if (n_timer == NULL || fd == NULL || n_timer->enable || n_timer->running)
+		return -1;
+
+	n_timer->fd = fd;
+	return 0;
+}
 int32_t timer_init(int32_t handle, int32_t  once, uint32_t interval, notifycallback func, void * data, char identify[MAX_ID_LEN])
 {
-	n_timer_fd_t * fd = &timer_fd;
+	return timer_init_slack(handle, once, interval, 0, func, data, identify);
+}
+
+int32_t timer_init_slack(int32_t handle, int32_t  once, uint32_t interval, uint32_t slack, notifycallback func, void * data, char identify[MAX_ID_LEN])
+{
 	n_timer_t * n_timer = (n_timer_t *)handle;
+	n_timer_fd_t * fd = n_timer ? n_timer->fd : NULL;
 
 	if (n_timer != NULL && func != NULL)
 	{
+		_timer_ensure_init(fd);
+		pthread_mutex_lock(&fd->mutex);
+		_timer_dequeue(fd, n_timer);
 		n_timer->once = once;
-		n_timer->interval = n_timer->ticks = interval;
-		n_timer->mono_ticks = 0;
+		n_timer->interval = interval;
+		n_timer->slack = slack;
+		n_timer->expires = 0;
 		n_timer->data = data;
 		n_timer->func = func;
 		n_timer->enable = FALSE;
 		if (identify)
 		{
-			strcpy(n_timer->identify, identify);
+			strncpy(n_timer->identify, identify, MAX_ID_LEN - 1);
+			n_timer->identify[MAX_ID_LEN - 1] = '\0';
 		}
 		else
 		{
 			memset(n_timer->identify, 0x00, MAX_ID_LEN);
 		}
-		fd->timer_list = n_slist_append(fd->timer_list, n_timer);
-		fd->count++;
-		printf("identify[%s] once(%d) interval(%d) func(0x%x)\n", identify, once, interval,  (int32_t)func);
+		pthread_mutex_unlock(&fd->mutex);
+		printf("identify[%s] once(%d) interval(%d) slack(%d) func(0x%x)\n", identify, once, interval, slack, (int32_t)func);
 		return 0;
 	}
 	return -1;
@@ -194,73 +657,189 @@ int32_t timer_init(int32_t handle, int32_t  once, uint32_t interval, notifycallb
 
 int32_t timer_start(int32_t handle)
 {
-	n_timer_fd_t * fd = &timer_fd;
 	n_timer_t * n_timer = (n_timer_t *)handle;
+	n_timer_fd_t * fd = n_timer ? n_timer->fd : NULL;
+	int32_t ret = -1;
 
-	if (n_timer != NULL && n_timer->enable == FALSE)
+	if (n_timer != NULL)
 	{
-		n_timer->enable = TRUE;
-		n_timer->ticks = n_timer->interval;
-		printf("[%s] timer is start\n", n_timer->identify);
-		return 0;
+		pthread_mutex_lock(&fd->mutex);
+		if (n_timer->enable == FALSE)
+		{
+			n_timer->enable = TRUE;
+			_timer_arm(fd, n_timer, get_monotonic_time() + (int64_t)n_timer->interval * ONE_MSEC_PER_USEC);
+			ret = 0;
+		}
+		pthread_mutex_unlock(&fd->mutex);
+		if (ret == 0)
+			printf("[%s] timer is start\n", n_timer->identify);
 	}
 
-	return -1;
+	return ret;
 }
 
 int32_t timer_stop(int32_t handle)
 {
-	n_timer_fd_t * fd = &timer_fd;
 	n_timer_t * n_timer = (n_timer_t *)handle;
+	n_timer_fd_t * fd = n_timer ? n_timer->fd : NULL;
+	int32_t ret = -1;
 
-	if (n_timer != NULL && n_timer->enable == TRUE)
+	if (n_timer != NULL)
 	{
-		n_timer->enable = FALSE;
-		n_timer->ticks = n_timer->interval;
-		n_timer->mono_ticks = 0;
-		printf("[%s] timer is stop \n", n_timer->identify);
-		return 0;
+		pthread_mutex_lock(&fd->mutex);
+		if (n_timer->enable == TRUE)
+		{
+			n_timer->enable = FALSE;
+			_timer_dequeue(fd, n_timer);
+			ret = 0;
+		}
+		pthread_mutex_unlock(&fd->mutex);
+		if (ret == 0)
+			printf("[%s] timer is stop \n", n_timer->identify);
 	}
-	return -1;
+	return ret;
 }
 
 int32_t timer_modify(int32_t handle, uint32_t interval)
 {
-	n_timer_fd_t * fd = &timer_fd;
 	n_timer_t * n_timer = (n_timer_t *)handle;
+	n_timer_fd_t * fd = n_timer ? n_timer->fd : NULL;
+	int32_t ret = -1;
 
-	if (n_timer != NULL && n_timer->enable == TRUE)
+	if (n_timer != NULL)
 	{
-		printf("[%s] timer is modify from  %d to %lu\n", n_timer->identify, n_timer->interval, interval);
-		n_timer->ticks = n_timer->interval = interval;		
-		return 0;
+		pthread_mutex_lock(&fd->mutex);
+		if (n_timer->enable == TRUE)
+		{
+			printf("[%s] timer is modify from  %d to %lu\n", n_timer->identify, n_timer->interval, interval);
+			n_timer->interval = interval;
+			_timer_arm(fd, n_timer, get_monotonic_time() + (int64_t)interval * ONE_MSEC_PER_USEC);
+			ret = 0;
+		}
+		pthread_mutex_unlock(&fd->mutex);
 	}
-	return -1;
+	return ret;
 }
 
+/* Re-arm the next expiry at the absolute monotonic time @ticks (usec),
+ * periodic timers resume their interval from there */
 int32_t timer_set_mono(int32_t handle, int64_t ticks)
 {
-	n_timer_fd_t * fd = &timer_fd;
 	n_timer_t * n_timer = (n_timer_t *)handle;
+	n_timer_fd_t * fd = n_timer ? n_timer->fd : NULL;
+	int32_t ret = -1;
 
-	if (n_timer != NULL && n_timer->enable == TRUE)
+	if (n_timer != NULL)
 	{
-		//printf("[%s] timer set monotonic_time %lld\n", n_timer->identify, ticks);
-		n_timer->mono_ticks = ticks;
-		return 0;
+		pthread_mutex_lock(&fd->mutex);
+		if (n_timer->enable == TRUE)
+		{
+			//printf("[%s] timer set monotonic_time %lld\n", n_timer->identify, ticks);
+			_timer_arm(fd, n_timer, ticks);
+			ret = 0;
+		}
+		pthread_mutex_unlock(&fd->mutex);
 	}
-	return -1;
+	return ret;
 }
 
 int32_t timer_destroy(int32_t handle)
 {
+	n_timer_t * n_timer = (n_timer_t *)handle;
+	n_timer_fd_t * fd = n_timer ? n_timer->fd : NULL;
+
+	if (n_timer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&fd->mutex);
+	n_timer->enable = FALSE;
+	_timer_dequeue(fd, n_timer);
+	if (n_timer->running)
+	{
+		/* freed by the timer thread once the callback returns */
+		n_timer->destroyed = 1;
+		n_timer = NULL;
+	}
+	pthread_mutex_unlock(&fd->mutex);
+
+	if (n_timer)
+		n_slice_free1(TIMER_S_ELN, n_timer);
 	return 0;
 }
 
+int32_t timer_ioctrl(int32_t handle, int32_t cmd, void * param)
+{
+	n_timer_t * n_timer = (n_timer_t *)handle;
+	n_timer_fd_t * fd;
+	int32_t i, ret = 0;
+
+	if (param == NULL)
+		return -1;
+
+	switch (cmd)
+	{
+		case TIMER_CMD_GETTMCOUNT:
+		case TIMER_CMD_GETLOOPCOST:
+			/* summed over every loop */
+			if (cmd == TIMER_CMD_GETTMCOUNT)
+				*(int32_t *)param = 0;
+			else
+				((int64_t *)param)[0] = ((int64_t *)param)[1] = 0;
+			for (i = 0; i < TIMER_MAX_LOOPS; i++)
+			{
+				fd = &timer_fds[i];
+				if (!fd->inited)
+					continue;
+				pthread_mutex_lock(&fd->mutex);
+				if (cmd == TIMER_CMD_GETTMCOUNT)
+				{
+					*(int32_t *)param += fd->count;
+				}
+				else
+				{
+					((int64_t *)param)[0] += fd->loop_cost;
+					((int64_t *)param)[1] += fd->loop_passes;
+				}
+				pthread_mutex_unlock(&fd->mutex);
+			}
+			break;
+		case TIMER_CMD_GETTMPASST:
+		case TIMER_CMD_GETTMREACH:
+			if (n_timer == NULL)
+				return -1;
+			fd = n_timer->fd;
+			pthread_mutex_lock(&fd->mutex);
+			if (!_node_linked(&n_timer->node))
+				ret = -1;
+			else if (cmd == TIMER_CMD_GETTMREACH)
+				*(int32_t *)param = (int32_t)MAX(TIMER_TICK(n_timer->expires - get_monotonic_time()), 0);
+			else
+				*(int32_t *)param = (int32_t)MAX(n_timer->interval - TIMER_TICK(n_timer->expires - get_monotonic_time()), 0);
+			pthread_mutex_unlock(&fd->mutex);
+			break;
+		default:
+			ret = -1;
+			break;
+	}
+	return ret;
+}
+
 int32_t timer_close(int32_t handle)
 {
-	n_timer_fd_t * fd = &timer_fd;
-	fd->flag = fd->running = 0;     /* бʶ,ʹ߳Ȼֹ */
-	pthread_join(fd->tid, NULL);    /* ȴֹ߳ */
+	n_timer_fd_t * fd;
+	int32_t i;
+
+	for (i = 0; i < TIMER_MAX_LOOPS; i++)
+	{
+		fd = &timer_fds[i];
+		if (!fd->running)
+			continue;
+		pthread_mutex_lock(&fd->mutex);
+		fd->flag = fd->running = 0;     /* stop flag, the thread exits on its next pass */
+		pthread_cond_signal(&fd->cond);
+		pthread_mutex_unlock(&fd->mutex);
+		pthread_join(fd->tid, NULL);    /* wait for the thread to terminate */
+	}
+	timer_loops = 0;
 	return 0;
-}
\ No newline at end of file
+}
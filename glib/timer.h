@@ -2,6 +2,7 @@
 #define _TIMER_H_
 
 #define MAX_ID_LEN  32
+#define TIMER_MAX_LOOPS  64
 
 
 typedef void(*notifycallback)(void * data);
@@ -22,14 +23,33 @@ typedef enum
     TIMER_CMD_GETTMCOUNT = 1,    /* ȡǰļ,param(int32_t *),channel(˴Ч) */
     TIMER_CMD_GETTMPASST,   /* ȡǰʱѾʱ(ms),param(int32_t *),channel(˴Ч) */
     TIMER_CMD_GETTMREACH,   /* ȡǰʱ뵽ʱ(ms),param(int32_t *),channel(˴Ч) */
+    TIMER_CMD_GETLOOPCOST,  /* timer thread cost, param(int64_t[2]: usec spent walking the wheel, passes),handle ignored */
 } TIMER_CMD_E;
 
 int32_t timer_open();
 
 int32_t timer_create();
 
+/* Timer loops: timer_open() starts loop 0, timer_open_loops() starts loops
+ * 0..num-1, each with its own thread. timer_create() binds to loop 0,
+ * timer_create_on()/timer_bind() to a given loop, timer_loop_pick() hands
+ * out the opened loops round robin. */
+int32_t timer_open_loops(int32_t num);
+
+int32_t timer_loop_count(void);
+
+int32_t timer_loop_pick(void);
+
+int32_t timer_create_on(int32_t loop);
+
+int32_t timer_bind(int32_t handle, int32_t loop);
+
 int32_t timer_init(int32_t handle, int32_t  once, uint32_t interval, notifycallback func, void * data, char identify[MAX_ID_LEN]);
 
+/* Same as timer_init() but the timer may fire up to slack ms late, which
+ * lets timers with overlapping windows fire together in one wakeup */
+int32_t timer_init_slack(int32_t handle, int32_t  once, uint32_t interval, uint32_t slack, notifycallback func, void * data, char identify[MAX_ID_LEN]);
+
 int32_t timer_start(int32_t handle);
 
 int32_t timer_stop(int32_t handle);
@@ -40,6 +60,8 @@ int32_t timer_set_mono(int32_t handle, int64_t ticks);
 
 int32_t timer_destroy(int32_t handle);
 
+int32_t timer_ioctrl(int32_t handle, int32_t cmd, void * param);
+
 int32_t timer_close(int32_t handle);
 
 #endif /* _TIMER_H_ */
@@ -1,5 +1,9 @@
 /* This file is part of the Nice GLib ICE library. */
 
+#ifdef __linux__
+#define _GNU_SOURCE     /* recvmmsg(), sendmmsg() */
+#endif
+
 #include "config.h"
 //#include <glib.h>
 #include "socket.h"
@@ -10,6 +14,28 @@
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+#ifdef __linux__
+#include <errno.h>
+#include <netinet/udp.h>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT  103    /* linux 4.18 */
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP  17
+#endif
+#include <linux/filter.h>
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT  15
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF  51    /* linux 4.5 */
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL  46                /* linux 3.11 */
+#endif
 #endif
 
 struct udp_socket_private_st
@@ -18,7 +44,14 @@ struct udp_socket_private_st
 	struct sockaddr  * gaddr;
 };
 
-n_socket_t * n_socket_new(n_addr_t * addr)
+static void socket_close(n_socket_t * sock)
+{
+	n_slice_free(struct udp_socket_private_st, sock->priv);
+	sock->priv = NULL;
+	closesocket(sock->sock_fd);
+}
+
+static n_socket_t * _socket_new(n_addr_t * addr, int reuseport)
 {
 	union
 	{
@@ -54,6 +87,28 @@ n_socket_t * n_socket_new(n_addr_t * addr)
 		return NULL;
 	}
 
+#ifdef SO_REUSEPORT
+	if (reuseport)
+	{
+		int one = 1;
+
+		if (setsockopt(gsock, SOL_SOCKET, SO_REUSEPORT, (void *)&one, sizeof(one)) < 0)
+		{
+			n_slice_free(n_socket_t, sock);
+			closesocket(gsock);
+			return NULL;
+		}
+	}
+#else
+	if (reuseport)
+	{
+		/* SO_REUSEADDR on Win32 does not spread datagrams over the sockets */
+		n_slice_free(n_socket_t, sock);
+		closesocket(gsock);
+		return NULL;
+	}
+#endif
+
 	/* GSocket: All socket file descriptors are set to be close-on-exec. */
 	/*g_socket_set_blocking(gsock, false);
 	gaddr = g_socket_address_new_from_native(&name.addr, sizeof(name));
@@ -85,11 +140,70 @@ n_socket_t * n_socket_new(n_addr_t * addr)
 	//sock->is_reliable = socket_is_reliable;
 	//sock->can_send = socket_can_send;
 	//sock->set_writable_callback = socket_set_writable_callback;
-	//sock->close = socket_close;
+	sock->close = socket_close;
 
 	return sock;
 }
 
+n_socket_t * n_socket_new(n_addr_t * addr)
+{
+	return _socket_new(addr, FALSE);
+}
+
+n_socket_t * n_socket_new_reuseport(n_addr_t * addr)
+{
+	return _socket_new(addr, TRUE);
+}
+
+int32_t nice_socket_steer_by_source(n_socket_t * sock, uint32_t n_socks)
+{
+#ifdef __linux__
+	/* the program sees the UDP payload, the source address is reached
+	 * through the network header: IPv4 saddr, or the last word of IPv6 */
+	struct sock_filter code[] =
+	{
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + 12 },
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, n_socks },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog = { N_ELEMENTS(code), code };
+
+	if (sock == NULL || n_socks == 0)
+		return -1;
+	if (sock->addr.s.addr.sa_family == AF_INET6)
+		code[0].k = SKF_NET_OFF + 20;
+	if (setsockopt(sock->sock_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+	{
+		nice_debug("[%s]: SO_ATTACH_REUSEPORT_CBPF err = %d", G_STRFUNC, errno);
+		return -1;
+	}
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+int32_t nice_socket_set_busy_poll(n_socket_t * sock, int32_t usec)
+{
+#ifdef __linux__
+	if (setsockopt(sock->sock_fd, SOL_SOCKET, SO_BUSY_POLL, (void *)&usec, sizeof(usec)) < 0)
+	{
+		nice_debug("[%s]: SO_BUSY_POLL err = %d", G_STRFUNC, errno);
+		return -1;
+	}
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+int nice_socket_poll_fd(n_socket_t * sock)
+{
+	if (sock->type == NICE_SOCKET_TYPE_UDP_URING)
+		return nice_udp_uring_poll_fd(sock);
+	return sock->sock_fd;
+}
+
 int32_t n_socket_recv_msgs(n_socket_t * sock, n_input_msg_t * recv_messages, uint32_t n_recv_messages)
 {
     return sock->recv_messages(sock, recv_messages, n_recv_messages);
@@ -121,26 +235,101 @@ int32_t nice_socket_recv(int fd, n_addr_t * from, uint32_t len, char * buf)
     return ret;
 }
 
+#ifdef __linux__
+
+int32_t nice_socket_recv_batch(int fd, n_input_msg_t * msgs, uint32_t n_msgs, uint32_t * n_calls)
+{
+    struct mmsghdr hdrs[NICE_SOCKET_RECV_BATCH];
+    struct iovec iov[NICE_SOCKET_RECV_BATCH];
+    uint32_t i;
+    int ret;
+
+    n_msgs = MIN(n_msgs, NICE_SOCKET_RECV_BATCH);
+    memset(hdrs, 0, n_msgs * sizeof(struct mmsghdr));
+    for (i = 0; i < n_msgs; i++)
+    {
+        iov[i].iov_base = msgs[i].buffers[0].buffer;
+        iov[i].iov_len = msgs[i].buffers[0].size;
+        hdrs[i].msg_hdr.msg_iov = &iov[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_name = &msgs[i].from->s;
+        hdrs[i].msg_hdr.msg_namelen = sizeof(msgs[i].from->s);
+    }
+
+    /* only the first datagram is known to be there, never block for more */
+    ret = recvmmsg(fd, hdrs, n_msgs, MSG_DONTWAIT, NULL);
+    *n_calls = 1;
+    if (ret <= 0)
+        return ret;
+
+    for (i = 0; i < (uint32_t)ret; i++)
+    {
+        msgs[i].length = hdrs[i].msg_len;
+    }
+    return ret;
+}
+
+#else
+
+int32_t nice_socket_recv_batch(int fd, n_input_msg_t * msgs, uint32_t n_msgs, uint32_t * n_calls)
+{
+    uint32_t i, calls = 0;
+    int ret = 0;
+
+    n_msgs = MIN(n_msgs, NICE_SOCKET_RECV_BATCH);
+    for (i = 0; i < n_msgs; i++)
+    {
+        int addr_size = sizeof(msgs[i].from->s);
+
+#ifdef _WIN32
+        /* no MSG_DONTWAIT, only read what is already queued */
+        if (i > 0)
+        {
+            u_long pending = 0;
+
+            calls++;
+            if (ioctlsocket(fd, FIONREAD, &pending) != 0 || pending == 0)
+                break;
+        }
+        ret = recvfrom(fd, msgs[i].buffers[0].buffer, msgs[i].buffers[0].size, 0, &msgs[i].from->s.addr, &addr_size);
+#else
+        ret = recvfrom(fd, msgs[i].buffers[0].buffer, msgs[i].buffers[0].size, i > 0 ? MSG_DONTWAIT : 0,
+                       &msgs[i].from->s.addr, (socklen_t *)&addr_size);
+#endif
+        calls++;
+        if (ret < 0)
+            break;
+        msgs[i].length = ret;
+    }
+
+    *n_calls = calls;
+    return (i == 0 && ret < 0) ? -1 : (int32_t)i;
+}
+
+#endif
+
 int32_t nice_socket_send(n_socket_t * sock, n_addr_t * to, uint32_t len, char * buf)
 {
     struct udp_socket_private_st * priv = sock->priv;
-	int ret = -1;
+    int ret = -1;
 
     /* Socket has been closed: */
     if (priv == NULL)
         return -1;
+    if (sock->type == NICE_SOCKET_TYPE_UDP_URING)
+        return nice_udp_uring_send(sock, to, len, buf);
 
-	if (nice_debug_is_enabled())
-	{
-		char tmpbuf1[INET6_ADDRSTRLEN] = {0};
-		char tmpbuf2[INET6_ADDRSTRLEN] = {0};
-
-		nice_address_to_string(&priv->niceaddr, tmpbuf1);
-		nice_address_to_string(to, tmpbuf2);
-		nice_debug("[%s]: '%s:%u' -> '%s:%u'", G_STRFUNC,
-			tmpbuf1, n_addr_get_port(&priv->niceaddr),
-			tmpbuf2, n_addr_get_port(to));
-	}
+    if (nice_debug_is_enabled())
+    {
+        char tmpbuf1[INET6_ADDRSTRLEN] = {0};
+        char tmpbuf2[INET6_ADDRSTRLEN] = {0};
+
+        nice_address_to_string(&priv->niceaddr, tmpbuf1);
+        nice_address_to_string(to, tmpbuf2);
+        nice_debug("[%s]: '%s:%u' -> '%s:%u'", G_STRFUNC,
+            tmpbuf1, n_addr_get_port(&priv->niceaddr),
+            tmpbuf2, n_addr_get_port(to));
+    }
 
     if (!n_addr_is_valid(&priv->niceaddr) || !nice_address_equal(&priv->niceaddr, to))
     {
@@ -151,17 +340,164 @@ int32_t nice_socket_send(n_socket_t * sock, n_addr_t * to, uint32_t len, char *
         } sa;
 
         nice_address_copy_to_sockaddr(to, &sa.addr);
-		priv->niceaddr = *to;
+        priv->niceaddr = *to;
     }
 
-	ret = sendto(sock->sock_fd, buf, len, 0, &to->s.addr, sizeof(struct sockaddr));
-	if (ret < 0)
-	{
+    ret = sendto(sock->sock_fd, buf, len, 0, &to->s.addr, sizeof(struct sockaddr));
+    if (ret < 0)
+    {
 
-	}
+    }
     return ret;
 }
 
+/* queued on the ring while corked, the whole burst costs one io_uring_enter() */
+static int32_t _socket_send_batch_uring(n_socket_t * sock, const n_addr_t * to, const n_outvector_t * bufs, uint32_t n_bufs, uint32_t * n_calls)
+{
+    uint32_t i;
+
+    n_bufs = MIN(n_bufs, NICE_SOCKET_SEND_BATCH);
+    nice_udp_uring_cork(sock, TRUE);
+    for (i = 0; i < n_bufs; i++)
+    {
+        if (nice_udp_uring_send(sock, to, bufs[i].size, bufs[i].buffer) < 0)
+            break;
+    }
+    nice_udp_uring_cork(sock, FALSE);
+    *n_calls = 1;
+    return (i == 0 && n_bufs > 0) ? -1 : (int32_t)i;
+}
+
+#ifdef __linux__
+
+/* cleared for good the first time the kernel turns UDP_SEGMENT down */
+static volatile int32_t udp_gso_usable = 1;
+
+static int32_t _socket_send_gso(n_socket_t * sock, const n_addr_t * to, const n_outvector_t * bufs, uint32_t n_bufs)
+{
+    struct iovec iov[NICE_SOCKET_SEND_BATCH];
+    struct msghdr hdr;
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } control;
+    struct cmsghdr * cm;
+    uint32_t i;
+    int ret;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memset(&control, 0, sizeof(control));
+    for (i = 0; i < n_bufs; i++)
+    {
+        iov[i].iov_base = (void *)bufs[i].buffer;
+        iov[i].iov_len = bufs[i].size;
+    }
+    hdr.msg_name = (void *)&to->s.addr;
+    hdr.msg_namelen = sizeof(struct sockaddr);
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = n_bufs;
+    hdr.msg_control = control.buf;
+    hdr.msg_controllen = sizeof(control.buf);
+
+    /* the kernel cuts the payload into datagrams of the first buffer's size */
+    cm = CMSG_FIRSTHDR(&hdr);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    *(uint16_t *)CMSG_DATA(cm) = (uint16_t)bufs[0].size;
+
+    ret = sendmsg(sock->sock_fd, &hdr, 0);
+    if (ret < 0 && (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP))
+    {
+        nice_debug("[%s]: UDP GSO unavailable (%d), using sendmmsg", G_STRFUNC, errno);
+        udp_gso_usable = 0;
+    }
+    return ret < 0 ? -1 : (int32_t)n_bufs;
+}
+
+int32_t nice_socket_send_batch(n_socket_t * sock, const n_addr_t * to, const n_outvector_t * bufs, uint32_t n_bufs, uint32_t * n_calls)
+{
+    struct mmsghdr hdrs[NICE_SOCKET_SEND_BATCH];
+    struct iovec iov[NICE_SOCKET_SEND_BATCH];
+    uint32_t i, sent = 0, total = 0;
+    int32_t gso;
+    int ret = 0;
+
+    *n_calls = 0;
+    if (sock->priv == NULL)
+        return -1;
+    if (sock->type == NICE_SOCKET_TYPE_UDP_URING)
+        return _socket_send_batch_uring(sock, to, bufs, n_bufs, n_calls);
+
+    n_bufs = MIN(n_bufs, NICE_SOCKET_SEND_BATCH);
+    if (n_bufs == 0)
+        return 0;
+
+    gso = (n_bufs > 1 && udp_gso_usable);
+    for (i = 0; i < n_bufs; i++)
+    {
+        total += bufs[i].size;
+        if (i > 0 && (bufs[i].size > bufs[0].size || (i < n_bufs - 1 && bufs[i].size != bufs[0].size)))
+            gso = FALSE;
+    }
+    if (gso && total <= 0xffff - 8 - 40)
+    {
+        *n_calls = 1;
+        ret = _socket_send_gso(sock, to, bufs, n_bufs);
+        if (ret >= 0 || udp_gso_usable)
+            return ret;
+    }
+
+    memset(hdrs, 0, n_bufs * sizeof(struct mmsghdr));
+    for (i = 0; i < n_bufs; i++)
+    {
+        iov[i].iov_base = (void *)bufs[i].buffer;
+        iov[i].iov_len = bufs[i].size;
+        hdrs[i].msg_hdr.msg_name = (void *)&to->s.addr;
+        hdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr);
+        hdrs[i].msg_hdr.msg_iov = &iov[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* sendmmsg() may stop short, carry on from where it did */
+    while (sent < n_bufs)
+    {
+        ret = sendmmsg(sock->sock_fd, hdrs + sent, n_bufs - sent, 0);
+        (*n_calls)++;
+        if (ret <= 0)
+            break;
+        sent += ret;
+    }
+    return (sent == 0 && ret < 0) ? -1 : (int32_t)sent;
+}
+
+#else
+
+int32_t nice_socket_send_batch(n_socket_t * sock, const n_addr_t * to, const n_outvector_t * bufs, uint32_t n_bufs, uint32_t * n_calls)
+{
+    uint32_t i;
+    int ret = 0;
+
+    *n_calls = 0;
+    if (sock->priv == NULL)
+        return -1;
+    if (sock->type == NICE_SOCKET_TYPE_UDP_URING)
+        return _socket_send_batch_uring(sock, to, bufs, n_bufs, n_calls);
+
+    n_bufs = MIN(n_bufs, NICE_SOCKET_SEND_BATCH);
+    for (i = 0; i < n_bufs; i++)
+    {
+        ret = sendto(sock->sock_fd, bufs[i].buffer, bufs[i].size, 0, &to->s.addr, sizeof(struct sockaddr));
+        (*n_calls)++;
+        if (ret < 0)
+            break;
+    }
+    return (i == 0 && ret < 0) ? -1 : (int32_t)i;
+}
+
+#endif
+
 /*
 int nice_socket_is_reliable(n_socket_t * sock)
 {
@@ -35,7 +35,8 @@ typedef enum
     NICE_SOCKET_TYPE_UDP_TURN_OVER_TCP,
     NICE_SOCKET_TYPE_TCP_ACTIVE,
     NICE_SOCKET_TYPE_TCP_PASSIVE,
-    NICE_SOCKET_TYPE_TCP_SO
+    NICE_SOCKET_TYPE_TCP_SO,
+    NICE_SOCKET_TYPE_UDP_URING
 } NiceSocketType;
 
 typedef void (*NiceSocketWritableCb)(n_socket_t * sock, void * user_data);
@@ -60,11 +61,45 @@ struct _socket_st
 };
 
 n_socket_t * n_socket_new(n_addr_t * addr);
+
+/* Like n_socket_new() with SO_REUSEPORT set before binding, so more sockets
+ * can bind the same address and the kernel spreads datagrams over them.
+ * Returns NULL where the platform cannot balance a port over sockets. */
+n_socket_t * n_socket_new_reuseport(n_addr_t * addr);
+
+/* Attaches a classic BPF program to the SO_REUSEPORT group of sock that
+ * picks the group member by source address modulo n_socks, so one peer is
+ * always read from the same socket. Linux only, returns 0 or -1. */
+int32_t nice_socket_steer_by_source(n_socket_t * sock, uint32_t n_socks);
+
+/* Sets SO_BUSY_POLL: a read on an empty socket polls the device queue for up
+ * to usec before it gives up. Linux only, returns 0 or -1. */
+int32_t nice_socket_set_busy_poll(n_socket_t * sock, int32_t usec);
+
+/* The fd a reactor has to wait on to learn that sock has data, sock_fd
+ * except for backends that complete reads elsewhere */
+int nice_socket_poll_fd(n_socket_t * sock);
 int32_t n_socket_recv_msgs(n_socket_t * sock, n_input_msg_t * recv_messages, uint32_t n_recv_messages);
 int32_t nice_socket_send_messages(n_socket_t * sock, const n_addr_t * addr, const n_output_msg_t * messages, uint32_t n_messages);
 int32_t nice_socket_send_messages_reliable(n_socket_t * sock, const n_addr_t * addr, const n_output_msg_t * messages, uint32_t n_messages);
 int32_t nice_socket_recv(int fd, n_addr_t * from, uint32_t len, char * buf);
+
+#define NICE_SOCKET_RECV_BATCH  32
+
+/* Receives up to n_msgs (at most NICE_SOCKET_RECV_BATCH) queued datagrams,
+ * one per message into buffers[0], without blocking once the first one is
+ * read. Sets from and length of each message, returns the number of
+ * datagrams or -1; n_calls is set to the number of syscalls it took. */
+int32_t nice_socket_recv_batch(int fd, n_input_msg_t * msgs, uint32_t n_msgs, uint32_t * n_calls);
 int32_t nice_socket_send(n_socket_t * sock, n_addr_t * to, uint32_t len, char * buf);
+
+#define NICE_SOCKET_SEND_BATCH  32
+
+/* Sends n_bufs datagrams (at most NICE_SOCKET_SEND_BATCH), one per buffer,
+ * all to the same address. Uses UDP GSO when every buffer but the last has
+ * the same size, sendmmsg() otherwise. Returns the number of datagrams sent
+ * or -1; n_calls is set to the number of syscalls it took. */
+int32_t nice_socket_send_batch(n_socket_t * sock, const n_addr_t * to, const n_outvector_t * bufs, uint32_t n_bufs, uint32_t * n_calls);
 //int32_t nice_socket_send_reliable(n_socket_t * sock, const n_addr_t * addr, uint32_t len, const char * buf);
 int nice_socket_is_reliable(n_socket_t * sock);
 int nice_socket_can_send(n_socket_t * sock, n_addr_t * addr);
@@ -79,6 +114,7 @@ void nice_socket_free(n_socket_t * sock);
 //#include "socks5.h"
 //#include "http.h"
 #include "udp-turn.h"
+#include "udp-uring.h"
 //#include "udp-turn-over-tcp.h"
 
 #endif /* _SOCKET_H */
@@ -0,0 +1,633 @@
+/* This file is part of the Nice GLib ICE library. */
+
+/*
+ * Implementation of the UDP socket interface on top of io_uring. The
+ * kernel receives into a registered buffer ring through one multishot
+ * recvmsg, the agent reads the datagrams where they landed; sends are
+ * copied into send slots and submitted in batches.
+ */
+#include "config.h"
+#include <string.h>
+#include <errno.h>
+
+#include "udp-uring.h"
+#include "base.h"
+#include "agent-priv.h"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "pthread.h"
+
+#define URING_ENTRIES   256
+#define URING_BGID      0
+#define URING_TAG_RECV  0xffffffffffffffffULL   /* user_data of the multishot recv */
+#define URING_TAG_CANCEL 0xfffffffffffffffeULL
+
+typedef struct
+{
+    uint16_t bid;
+    uint32_t len;
+} uring_ready_t;
+
+struct uring_socket_private_st
+{
+    int ring_fd;
+    pthread_mutex_t mutex;          /* the rings are shared by senders and the reader */
+
+    uint8_t * sq_ring;
+    size_t sq_ring_len;
+    uint8_t * cq_ring;
+    size_t cq_ring_len;
+    struct io_uring_sqe * sqes;
+    size_t sqes_len;
+    uint32_t * sq_head;
+    uint32_t * sq_tail;
+    uint32_t * sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t * cq_head;
+    uint32_t * cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe * cqes;
+    uint32_t to_submit;             /* SQEs queued since the last enter */
+
+    struct io_uring_buf_ring * br;  /* registered buffer ring of recv_bufs */
+    size_t br_len;
+    uint8_t * recv_bufs;
+    struct msghdr recv_hdr;         /* template of the multishot recvmsg */
+    int32_t recv_armed;
+    int32_t recv_err;               /* errno that ended the multishot recv, it is not re-armed then */
+    uring_ready_t ready[NICE_URING_RECV_BUFS];  /* completed, not handed out yet */
+    uint32_t ready_head;
+    uint32_t ready_count;
+    uint16_t lent[NICE_URING_RECV_BUFS];        /* handed out until recv_done */
+    uint32_t n_lent;
+
+    uint8_t * send_bufs;
+    struct msghdr send_hdrs[NICE_URING_SEND_SLOTS];
+    struct iovec send_iov[NICE_URING_SEND_SLOTS];
+    struct sockaddr_storage send_to[NICE_URING_SEND_SLOTS];
+    uint32_t free_slots[NICE_URING_SEND_SLOTS];
+    uint32_t n_free;
+    int32_t corked;                 /* nesting depth of cork calls */
+
+    uint64_t sends;
+    uint64_t enters;
+};
+
+static void socket_close(n_socket_t * sock);
+
+static int _uring_setup(unsigned entries, struct io_uring_params * p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int _uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int _uring_register(int fd, unsigned opcode, void * arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* The kernel has to know the opcodes this socket submits; multishot and
+ * provided buffer rings are checked when they are first used */
+static int32_t _uring_probe(struct uring_socket_private_st * priv)
+{
+    union
+    {
+        struct io_uring_probe probe;
+        uint8_t raw[sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op)];
+    } u;
+
+    memset(&u, 0, sizeof(u));
+    if (_uring_register(priv->ring_fd, IORING_REGISTER_PROBE, &u.probe, 256) < 0)
+        return -1;
+    if (u.probe.ops_len <= MAX(IORING_OP_RECVMSG, IORING_OP_SENDMSG)
+        || !(u.probe.ops[IORING_OP_RECVMSG].flags & IO_URING_OP_SUPPORTED)
+        || !(u.probe.ops[IORING_OP_SENDMSG].flags & IO_URING_OP_SUPPORTED)
+        || !(u.probe.ops[IORING_OP_ASYNC_CANCEL].flags & IO_URING_OP_SUPPORTED))
+    {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    return 0;
+}
+
+static int32_t _uring_map(struct uring_socket_private_st * priv)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    uint32_t i;
+
+    memset(&p, 0, sizeof(p));
+    if ((priv->ring_fd = _uring_setup(URING_ENTRIES, &p)) < 0 || _uring_probe(priv) < 0)
+        return -1;
+
+    priv->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    priv->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        priv->sq_ring_len = priv->cq_ring_len = MAX(priv->sq_ring_len, priv->cq_ring_len);
+
+    priv->sq_ring = mmap(NULL, priv->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         priv->ring_fd, IORING_OFF_SQ_RING);
+    if (priv->sq_ring == MAP_FAILED)
+        return -1;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        priv->cq_ring = priv->sq_ring;
+    else
+        priv->cq_ring = mmap(NULL, priv->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             priv->ring_fd, IORING_OFF_CQ_RING);
+    if (priv->cq_ring == MAP_FAILED)
+        return -1;
+    priv->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    priv->sqes = mmap(NULL, priv->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      priv->ring_fd, IORING_OFF_SQES);
+    if (priv->sqes == MAP_FAILED)
+        return -1;
+
+    priv->sq_head = (uint32_t *)(priv->sq_ring + p.sq_off.head);
+    priv->sq_tail = (uint32_t *)(priv->sq_ring + p.sq_off.tail);
+    priv->sq_array = (uint32_t *)(priv->sq_ring + p.sq_off.array);
+    priv->sq_mask = *(uint32_t *)(priv->sq_ring + p.sq_off.ring_mask);
+    priv->sq_entries = p.sq_entries;
+    priv->cq_head = (uint32_t *)(priv->cq_ring + p.cq_off.head);
+    priv->cq_tail = (uint32_t *)(priv->cq_ring + p.cq_off.tail);
+    priv->cq_mask = *(uint32_t *)(priv->cq_ring + p.cq_off.ring_mask);
+    priv->cqes = (struct io_uring_cqe *)(priv->cq_ring + p.cq_off.cqes);
+
+    /* receive buffers, registered once and recycled through the ring */
+    priv->br_len = NICE_URING_RECV_BUFS * sizeof(struct io_uring_buf);
+    priv->br = mmap(NULL, priv->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    priv->recv_bufs = mmap(NULL, NICE_URING_RECV_BUFS * NICE_URING_RECV_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    priv->send_bufs = mmap(NULL, NICE_URING_SEND_SLOTS * NICE_URING_SEND_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (priv->br == MAP_FAILED || priv->recv_bufs == MAP_FAILED || priv->send_bufs == MAP_FAILED)
+        return -1;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)priv->br;
+    reg.ring_entries = NICE_URING_RECV_BUFS;
+    reg.bgid = URING_BGID;
+    if (_uring_register(priv->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return -1;
+
+    for (i = 0; i < NICE_URING_RECV_BUFS; i++)
+    {
+        priv->br->bufs[i].addr = (uint64_t)(uintptr_t)(priv->recv_bufs + i * NICE_URING_RECV_SIZE);
+        priv->br->bufs[i].len = NICE_URING_RECV_SIZE;
+        priv->br->bufs[i].bid = (uint16_t)i;
+    }
+    __atomic_store_n(&priv->br->tail, (uint16_t)NICE_URING_RECV_BUFS, __ATOMIC_RELEASE);
+
+    for (i = 0; i < NICE_URING_SEND_SLOTS; i++)
+        priv->free_slots[i] = NICE_URING_SEND_SLOTS - 1 - i;
+    priv->n_free = NICE_URING_SEND_SLOTS;
+    return 0;
+}
+
+static void _uring_unmap(struct uring_socket_private_st * priv)
+{
+    if (priv->sqes && priv->sqes != MAP_FAILED)
+        munmap(priv->sqes, priv->sqes_len);
+    if (priv->cq_ring && priv->cq_ring != MAP_FAILED && priv->cq_ring != priv->sq_ring)
+        munmap(priv->cq_ring, priv->cq_ring_len);
+    if (priv->sq_ring && priv->sq_ring != MAP_FAILED)
+        munmap(priv->sq_ring, priv->sq_ring_len);
+    if (priv->ring_fd >= 0)
+        close(priv->ring_fd);
+    /* the ring is gone, the kernel no longer touches the buffers */
+    if (priv->br && priv->br != MAP_FAILED)
+        munmap(priv->br, priv->br_len);
+    if (priv->recv_bufs && priv->recv_bufs != MAP_FAILED)
+        munmap(priv->recv_bufs, NICE_URING_RECV_BUFS * NICE_URING_RECV_SIZE);
+    if (priv->send_bufs && priv->send_bufs != MAP_FAILED)
+        munmap(priv->send_bufs, NICE_URING_SEND_SLOTS * NICE_URING_SEND_SIZE);
+}
+
+static void _uring_submit(struct uring_socket_private_st * priv)
+{
+    int ret;
+
+    if (priv->to_submit == 0)
+        return;
+    ret = _uring_enter(priv->ring_fd, priv->to_submit, 0, 0);
+    priv->enters++;
+    if (ret > 0)
+        priv->to_submit -= MIN((uint32_t)ret, priv->to_submit);
+    else if (ret < 0)
+        nice_debug("[%s]: io_uring_enter err = %d", G_STRFUNC, errno);
+}
+
+/* Next free SQE, the queue is submitted first if it is full */
+static struct io_uring_sqe * _uring_get_sqe(struct uring_socket_private_st * priv)
+{
+    uint32_t tail = *priv->sq_tail;
+    struct io_uring_sqe * sqe;
+
+    if (tail - __atomic_load_n(priv->sq_head, __ATOMIC_ACQUIRE) >= priv->sq_entries)
+    {
+        _uring_submit(priv);
+        if (tail - __atomic_load_n(priv->sq_head, __ATOMIC_ACQUIRE) >= priv->sq_entries)
+            return NULL;
+    }
+    sqe = &priv->sqes[tail & priv->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void _uring_commit_sqe(struct uring_socket_private_st * priv)
+{
+    uint32_t tail = *priv->sq_tail;
+
+    priv->sq_array[tail & priv->sq_mask] = tail & priv->sq_mask;
+    __atomic_store_n(priv->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    priv->to_submit++;
+}
+
+static void _uring_arm_recv(n_socket_t * sock, struct uring_socket_private_st * priv)
+{
+    struct io_uring_sqe * sqe = _uring_get_sqe(priv);
+
+    if (sqe == NULL)
+        return;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sock->sock_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&priv->recv_hdr;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = URING_TAG_RECV;
+    _uring_commit_sqe(priv);
+    priv->recv_armed = TRUE;
+}
+
+static void _uring_return_buf(struct uring_socket_private_st * priv, uint16_t bid)
+{
+    uint16_t tail = priv->br->tail;
+    struct io_uring_buf * buf = &priv->br->bufs[tail & (NICE_URING_RECV_BUFS - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(priv->recv_bufs + bid * NICE_URING_RECV_SIZE);
+    buf->len = NICE_URING_RECV_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&priv->br->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+/* Moves completions off the CQ: finished sends back to the free slots,
+ * received buffers to the ready queue until it holds max_ready. What stays
+ * on the CQ keeps the ring fd readable, so the reactor comes back for it. */
+static void _uring_reap(struct uring_socket_private_st * priv, uint32_t max_ready)
+{
+    uint32_t head = *priv->cq_head;
+    uint32_t tail = __atomic_load_n(priv->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        struct io_uring_cqe * cqe = &priv->cqes[head & priv->cq_mask];
+
+        if (cqe->user_data == URING_TAG_RECV)
+        {
+            if ((cqe->flags & IORING_CQE_F_BUFFER) && priv->ready_count >= max_ready)
+                break;
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                priv->recv_armed = FALSE;
+            /* running out of buffers ends it too, it is re-armed once they
+             * come back; any other error is final */
+            if (cqe->res < 0 && cqe->res != -ENOBUFS && priv->recv_err == 0)
+            {
+                priv->recv_err = -cqe->res;
+                nice_debug("[%s]: multishot recvmsg err = %d", G_STRFUNC, priv->recv_err);
+            }
+            if (cqe->flags & IORING_CQE_F_BUFFER)
+            {
+                uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+                if (cqe->res > 0 && priv->ready_count < NICE_URING_RECV_BUFS)
+                {
+                    uring_ready_t * r = &priv->ready[(priv->ready_head + priv->ready_count) % NICE_URING_RECV_BUFS];
+
+                    r->bid = bid;
+                    r->len = cqe->res;
+                    priv->ready_count++;
+                }
+                else
+                {
+                    _uring_return_buf(priv, bid);
+                }
+            }
+        }
+        else if (cqe->user_data < NICE_URING_SEND_SLOTS)
+        {
+            if (cqe->res < 0)
+                nice_debug("[%s]: send slot %u err = %d", G_STRFUNC, (uint32_t)cqe->user_data, -cqe->res);
+            priv->free_slots[priv->n_free++] = (uint32_t)cqe->user_data;
+        }
+        head++;
+    }
+    __atomic_store_n(priv->cq_head, head, __ATOMIC_RELEASE);
+}
+
+n_socket_t * n_udp_uring_socket_new(n_addr_t * addr)
+{
+    union
+    {
+        struct sockaddr_storage storage;
+        struct sockaddr addr;
+    } name;
+    socklen_t name_len = sizeof(name);
+    n_socket_t * sock;
+    struct uring_socket_private_st * priv;
+    int gsock;
+
+    if (addr != NULL)
+    {
+        nice_address_copy_to_sockaddr(addr, &name.addr);
+    }
+    else
+    {
+        memset(&name, 0, sizeof(name));
+        name.storage.ss_family = AF_INET;
+    }
+
+    gsock = socket(name.storage.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (gsock < 0)
+        return NULL;
+    if (bind(gsock, &name.addr, name.storage.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) < 0
+        || getsockname(gsock, &name.addr, &name_len) < 0)
+    {
+        close(gsock);
+        return NULL;
+    }
+
+    sock = n_slice_new0(n_socket_t);
+    priv = sock->priv = n_slice_new0(struct uring_socket_private_st);
+    priv->ring_fd = -1;
+    sock->sock_fd = gsock;
+    sock->type = NICE_SOCKET_TYPE_UDP_URING;
+    sock->close = socket_close;
+    n_addr_set_from_sock(&sock->addr, &name.addr);
+    pthread_mutex_init(&priv->mutex, NULL);
+
+    if (_uring_map(priv) < 0)
+    {
+        nice_debug("[%s]: io_uring not usable, err = %d", G_STRFUNC, errno);
+        socket_close(sock);
+        n_slice_free(n_socket_t, sock);
+        return NULL;
+    }
+
+    /* the buffer holds an io_uring_recvmsg_out, the source address and the
+     * payload, in that order */
+    priv->recv_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+    _uring_arm_recv(sock, priv);
+    _uring_submit(priv);
+
+    /* a kernel without multishot recvmsg or buffer selection for it fails
+     * the request inline, the caller falls back to a plain UDP socket */
+    _uring_reap(priv, 0);
+    if (!priv->recv_armed || priv->recv_err != 0)
+    {
+        nice_debug("[%s]: multishot recvmsg not usable, err = %d", G_STRFUNC, priv->recv_err);
+        socket_close(sock);
+        n_slice_free(n_socket_t, sock);
+        return NULL;
+    }
+
+    return sock;
+}
+
+static void socket_close(n_socket_t * sock)
+{
+    struct uring_socket_private_st * priv = sock->priv;
+    int32_t i;
+
+    if (priv == NULL)
+        return;
+
+    if (priv->ring_fd >= 0 && priv->sqes != NULL && priv->sqes != MAP_FAILED)
+    {
+        struct io_uring_sqe * sqe;
+
+        /* wait for the multishot recv to be cancelled before its buffers go */
+        pthread_mutex_lock(&priv->mutex);
+        if ((sqe = _uring_get_sqe(priv)) != NULL)
+        {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = URING_TAG_RECV;
+            sqe->user_data = URING_TAG_CANCEL;
+            _uring_commit_sqe(priv);
+        }
+        for (i = 0; i < 100 && (priv->recv_armed || priv->n_free < NICE_URING_SEND_SLOTS); i++)
+        {
+            _uring_enter(priv->ring_fd, priv->to_submit, 1, IORING_ENTER_GETEVENTS);
+            priv->to_submit = 0;
+            priv->ready_count = 0;
+            _uring_reap(priv, NICE_URING_RECV_BUFS);
+        }
+        pthread_mutex_unlock(&priv->mutex);
+    }
+    pthread_mutex_destroy(&priv->mutex);
+    _uring_unmap(priv);
+    if (sock->sock_fd >= 0)
+        close(sock->sock_fd);
+    sock->sock_fd = -1;
+
+    n_slice_free(struct uring_socket_private_st, priv);
+    sock->priv = NULL;
+}
+
+int32_t nice_udp_uring_recv(n_socket_t * sock, n_input_msg_t * msgs, uint32_t n_msgs)
+{
+    struct uring_socket_private_st * priv = sock->priv;
+    uint32_t n = 0;
+
+    if (priv == NULL || sock->type != NICE_SOCKET_TYPE_UDP_URING)
+        return -1;
+
+    pthread_mutex_lock(&priv->mutex);
+    _uring_reap(priv, MIN(n_msgs, NICE_URING_RECV_BUFS));
+    if (priv->ready_count == 0 && priv->recv_err != 0)
+    {
+        /* nothing is received on this socket any more */
+        errno = priv->recv_err;
+        pthread_mutex_unlock(&priv->mutex);
+        return -1;
+    }
+    while (n < n_msgs && priv->ready_count > 0)
+    {
+        uring_ready_t * r = &priv->ready[priv->ready_head];
+        uint8_t * buf = priv->recv_bufs + r->bid * NICE_URING_RECV_SIZE;
+        struct io_uring_recvmsg_out * out = (struct io_uring_recvmsg_out *)buf;
+        uint32_t hdr_len = sizeof(*out) + priv->recv_hdr.msg_namelen + priv->recv_hdr.msg_controllen;
+
+        priv->ready_head = (priv->ready_head + 1) % NICE_URING_RECV_BUFS;
+        priv->ready_count--;
+        priv->lent[priv->n_lent++] = r->bid;
+
+        /* a datagram larger than the buffer was cut, drop it */
+        if (r->len < hdr_len || (out->flags & MSG_TRUNC) || out->payloadlen > r->len - hdr_len)
+            continue;
+
+        if (msgs[n].from != NULL)
+            n_addr_set_from_sock(msgs[n].from, (struct sockaddr *)(buf + sizeof(*out)));
+        msgs[n].buffers[0].buffer = buf + hdr_len;
+        msgs[n].buffers[0].size = out->payloadlen;
+        msgs[n].length = out->payloadlen;
+        n++;
+    }
+    pthread_mutex_unlock(&priv->mutex);
+
+    return (int32_t)n;
+}
+
+void nice_udp_uring_recv_done(n_socket_t * sock)
+{
+    struct uring_socket_private_st * priv = sock->priv;
+    uint32_t i;
+
+    if (priv == NULL)
+        return;
+
+    pthread_mutex_lock(&priv->mutex);
+    for (i = 0; i < priv->n_lent; i++)
+        _uring_return_buf(priv, priv->lent[i]);
+    priv->n_lent = 0;
+    /* the multishot recv stops when it ran out of buffers */
+    if (!priv->recv_armed && priv->recv_err == 0)
+        _uring_arm_recv(sock, priv);
+    if (!priv->corked)
+        _uring_submit(priv);
+    pthread_mutex_unlock(&priv->mutex);
+}
+
+int32_t nice_udp_uring_send(n_socket_t * sock, const n_addr_t * to, uint32_t len, const char * buf)
+{
+    struct uring_socket_private_st * priv = sock->priv;
+    struct io_uring_sqe * sqe = NULL;
+    uint32_t slot;
+    int32_t ret = (int32_t)len;
+
+    if (priv == NULL)
+        return -1;
+
+    pthread_mutex_lock(&priv->mutex);
+    _uring_reap(priv, 0);
+    if (len <= NICE_URING_SEND_SIZE && priv->n_free > 0)
+        sqe = _uring_get_sqe(priv);
+
+    if (sqe == NULL)
+    {
+        /* no room in the ring, keep the order and send it ourselves */
+        _uring_submit(priv);
+        ret = sendto(sock->sock_fd, buf, len, 0, &to->s.addr,
+                     to->s.addr.sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+        pthread_mutex_unlock(&priv->mutex);
+        return ret;
+    }
+
+    slot = priv->free_slots[--priv->n_free];
+    memcpy(priv->send_bufs + slot * NICE_URING_SEND_SIZE, buf, len);
+    nice_address_copy_to_sockaddr(to, (struct sockaddr *)&priv->send_to[slot]);
+    priv->send_iov[slot].iov_base = priv->send_bufs + slot * NICE_URING_SEND_SIZE;
+    priv->send_iov[slot].iov_len = len;
+    memset(&priv->send_hdrs[slot], 0, sizeof(struct msghdr));
+    priv->send_hdrs[slot].msg_name = &priv->send_to[slot];
+    priv->send_hdrs[slot].msg_namelen = to->s.addr.sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    priv->send_hdrs[slot].msg_iov = &priv->send_iov[slot];
+    priv->send_hdrs[slot].msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = sock->sock_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&priv->send_hdrs[slot];
+    sqe->len = 1;
+    sqe->user_data = slot;
+    _uring_commit_sqe(priv);
+    priv->sends++;
+
+    if (!priv->corked)
+        _uring_submit(priv);
+    pthread_mutex_unlock(&priv->mutex);
+
+    return ret;
+}
+
+void nice_udp_uring_cork(n_socket_t * sock, int32_t cork)
+{
+    struct uring_socket_private_st * priv = sock->priv;
+
+    if (priv == NULL)
+        return;
+
+    pthread_mutex_lock(&priv->mutex);
+    if (cork)
+    {
+        priv->corked++;
+    }
+    else if (priv->corked > 0 && --priv->corked == 0)
+    {
+        _uring_submit(priv);
+    }
+    pthread_mutex_unlock(&priv->mutex);
+}
+
+void nice_udp_uring_get_stats(n_socket_t * sock, uint64_t * sends, uint64_t * enters)
+{
+    struct uring_socket_private_st * priv = sock->priv;
+
+    *sends = priv ? priv->sends : 0;
+    *enters = priv ? priv->enters : 0;
+}
+
+int nice_udp_uring_poll_fd(n_socket_t * sock)
+{
+    struct uring_socket_private_st * priv = sock->priv;
+
+    return priv ? priv->ring_fd : -1;
+}
+
+#else
+
+n_socket_t * n_udp_uring_socket_new(n_addr_t * addr)
+{
+    return NULL;
+}
+
+int32_t nice_udp_uring_recv(n_socket_t * sock, n_input_msg_t * msgs, uint32_t n_msgs)
+{
+    return -1;
+}
+
+void nice_udp_uring_recv_done(n_socket_t * sock)
+{
+}
+
+int32_t nice_udp_uring_send(n_socket_t * sock, const n_addr_t * to, uint32_t len, const char * buf)
+{
+    return -1;
+}
+
+void nice_udp_uring_cork(n_socket_t * sock, int32_t cork)
+{
+}
+
+void nice_udp_uring_get_stats(n_socket_t * sock, uint64_t * sends, uint64_t * enters)
+{
+    *sends = 0;
+    *enters = 0;
+}
+
+int nice_udp_uring_poll_fd(n_socket_t * sock)
+{
+    return -1;
+}
+
+#endif
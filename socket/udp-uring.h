@@ -0,0 +1,49 @@
+/* This file is part of the Nice GLib ICE library */
+
+#ifndef _UDP_URING_H
+#define _UDP_URING_H
+
+#include "socket.h"
+
+/* Receive buffers handed to the kernel, each holds one datagram */
+#define NICE_URING_RECV_BUFS   256
+#define NICE_URING_RECV_SIZE   2048
+
+/* Send slots, a datagram that does not fit one goes out with sendto() */
+#define NICE_URING_SEND_SLOTS  64
+#define NICE_URING_SEND_SIZE   2048
+
+/* UDP socket read and written through an io_uring (Linux 6.0 or later).
+ * One multishot recvmsg stays armed on the socket and fills buffers of a
+ * registered buffer ring; sends are queued as SQEs and submitted together.
+ * sock_fd is the UDP socket, the reactor has to wait on
+ * nice_socket_poll_fd(). Returns NULL where io_uring, multishot recvmsg or
+ * provided buffer rings are not available. */
+n_socket_t * n_udp_uring_socket_new(n_addr_t * addr);
+
+/* Hands out up to n_msgs received datagrams: buffers[0] of every message is
+ * pointed at the ring buffer holding it, no copy is made. The buffers stay
+ * valid until nice_udp_uring_recv_done(). Returns the number of messages,
+ * 0 if none is ready, -1 with errno set once the multishot recvmsg failed
+ * for good and everything received before has been handed out. */
+int32_t nice_udp_uring_recv(n_socket_t * sock, n_input_msg_t * msgs, uint32_t n_msgs);
+
+/* Gives every buffer handed out by nice_udp_uring_recv() back to the kernel */
+void nice_udp_uring_recv_done(n_socket_t * sock);
+
+/* Queues one datagram, it is submitted right away unless the socket is
+ * corked. Returns len, or -1 if the datagram could not be sent. */
+int32_t nice_udp_uring_send(n_socket_t * sock, const n_addr_t * to, uint32_t len, const char * buf);
+
+/* While corked sends only queue up, uncorking submits them with one
+ * io_uring_enter(); used around the handling of one readiness event.
+ * Corks nest, the submit happens when the outermost one is released. */
+void nice_udp_uring_cork(n_socket_t * sock, int32_t cork);
+
+/* The ring fd, readable whenever completions are waiting */
+int nice_udp_uring_poll_fd(n_socket_t * sock);
+
+/* SQEs submitted and io_uring_enter() calls made so far */
+void nice_udp_uring_get_stats(n_socket_t * sock, uint64_t * sends, uint64_t * enters);
+
+#endif /* _UDP_URING_H */
@@ -0,0 +1,434 @@
+/* This file is part of the Nice GLib ICE library. */
+/*
+ * In-process end-to-end benchmark: creates N agent pairs bound to
+ * 127.0.0.1, hands credentials and candidates from one agent to the other
+ * directly, then measures time to READY, pseudo-TCP throughput per pair and
+ * in total, one-way message latency and CPU time per Gbit. The result is
+ * written as one JSON object, to stdout or the given file, so runs can be
+ * compared by a script.
+ *
+ * Build together with the library sources:
+ *   loopback_bench [pairs] [seconds] [io threads] [json file]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <agent.h>
+#include "agent-priv.h"
+#include "event.h"
+#include "pthread.h"
+#include "timer.h"
+#include "executor.h"
+
+#define BENCH_DEFAULT_PAIRS    4
+#define BENCH_DEFAULT_SECONDS  5
+#define BENCH_DEFAULT_THREADS  2
+#define BENCH_MAX_PAIRS        256
+#define BENCH_MSG_SIZE         1024     /* every message starts with its send time */
+#define BENCH_CHUNK            (64 * BENCH_MSG_SIZE)
+#define BENCH_LAT_MSGS         2000     /* paced messages per pair for the latency run */
+#define BENCH_LAT_GAP_US       500
+#define BENCH_READY_MS         10000
+#define BENCH_DRAIN_MS         5000
+#define BENCH_MIN_PORT         20000
+#define BENCH_MAX_PORT         40000
+
+typedef struct
+{
+    n_agent_t * agent;
+    uint32_t stream_id;
+    pthread_t loop_tid;
+    volatile int32_t gathered;
+    volatile int32_t ready;
+    volatile int32_t failed;
+    int64_t ready_at;
+
+    /* receive side, written by the I/O thread only */
+    volatile uint64_t rx_bytes;
+    uint32_t msg_off;               /* offset in the message being received */
+    uint8_t stamp[8];
+    uint32_t * lat;                 /* one-way latencies, usec */
+    volatile uint32_t n_lat;
+} bench_peer_t;
+
+typedef struct
+{
+    bench_peer_t a;                 /* controlling, sends */
+    bench_peer_t b;                 /* controlled, receives */
+    int64_t started;
+    pthread_t send_tid;
+    uint64_t tx_bytes;
+    uint64_t bulk_bytes;            /* received in the throughput run */
+    int64_t deadline;
+    int32_t latency;                /* send paced stamped messages instead of bulk */
+} bench_pair_t;
+
+static bench_pair_t * pairs;
+static int32_t n_pairs = BENCH_DEFAULT_PAIRS;
+
+static void bench_event_loop(void * data)
+{
+    bench_peer_t * peer = data;
+    n_event_rec_t recs[16];
+    int32_t n, i;
+
+    for (;;)
+    {
+        if ((n = event_wait_batch(peer->agent->n_event, 0xFFFFFFFF, recs, N_ELEMENTS(recs))) < 0)
+        {
+            sleep_ms(10);
+            continue;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            if (recs[i].events & N_EVENT_CAND_GATHERING_DONE)
+                peer->gathered = TRUE;
+
+            if (recs[i].events & N_EVENT_COMP_STATE_CHANGED)
+            {
+                ev_state_changed_t * ev = recs[i].n_data;
+
+                if (ev->state == COMP_STATE_READY && !peer->ready)
+                {
+                    peer->ready_at = get_monotonic_time();
+                    peer->ready = TRUE;
+                }
+                else if (ev->state == COMP_STATE_FAILED)
+                {
+                    peer->failed = TRUE;
+                }
+            }
+            n_free(recs[i].n_data);
+        }
+    }
+}
+
+/* Messages are BENCH_MSG_SIZE bytes, the first 8 hold the send time or 0
+ * for bulk data; pseudo-TCP may split them anywhere */
+static void bench_recv(n_agent_t * agent, uint32_t stream_id, uint32_t component_id, uint32_t len, char * buf, void * data)
+{
+    bench_peer_t * peer = data;
+    uint32_t off = 0, n;
+
+    peer->rx_bytes += len;
+    while (off < len)
+    {
+        if (peer->msg_off < sizeof(peer->stamp))
+        {
+            n = MIN(len - off, sizeof(peer->stamp) - peer->msg_off);
+            memcpy(peer->stamp + peer->msg_off, buf + off, n);
+            peer->msg_off += n;
+            off += n;
+            if (peer->msg_off == sizeof(peer->stamp))
+            {
+                int64_t sent;
+
+                memcpy(&sent, peer->stamp, sizeof(sent));
+                if (sent != 0 && peer->n_lat < BENCH_LAT_MSGS)
+                    peer->lat[peer->n_lat++] = (uint32_t)(get_monotonic_time() - sent);
+            }
+            continue;
+        }
+        n = MIN(len - off, BENCH_MSG_SIZE - peer->msg_off);
+        peer->msg_off += n;
+        off += n;
+        if (peer->msg_off == BENCH_MSG_SIZE)
+            peer->msg_off = 0;
+    }
+}
+
+static int32_t bench_peer_open(bench_peer_t * peer, int32_t controlling)
+{
+    n_addr_t local;
+
+    memset(peer, 0, sizeof(*peer));
+    if ((peer->lat = calloc(BENCH_LAT_MSGS, sizeof(uint32_t))) == NULL)
+        return -1;
+    if ((peer->agent = n_agent_new()) == NULL)
+        return -1;
+    peer->agent->controlling_mode = controlling;
+
+    nice_address_init(&local);
+    nice_address_set_from_string(&local, "127.0.0.1");
+    n_agent_add_local_addr(peer->agent, &local);
+
+    if ((peer->agent->n_event = event_open()) < 0)
+        return -1;
+    if (pthread_create(&peer->loop_tid, 0, (void *)bench_event_loop, peer) != 0)
+        return -1;
+
+    if ((peer->stream_id = n_agent_add_stream(peer->agent, 1)) == 0)
+        return -1;
+    /* like the demo: host sockets bound to port 0 do not learn their port */
+    agent_set_port_range(peer->agent, peer->stream_id, 1, BENCH_MIN_PORT, BENCH_MAX_PORT);
+    n_agent_attach_recv(peer->agent, peer->stream_id, 1, bench_recv, peer);
+    n_agent_dispatcher(peer->agent, peer->stream_id, 1);
+    if (!n_agent_gather_cands(peer->agent, peer->stream_id))
+        return -1;
+    return 0;
+}
+
+/* What the demo has the user paste by hand: credentials and candidates */
+static int32_t bench_peer_exchange(bench_peer_t * from, bench_peer_t * to)
+{
+    char * ufrag = NULL, * pwd = NULL;
+    n_slist_t * cands;
+    int32_t ret = -1;
+
+    if (!n_agent_get_local_credentials(from->agent, from->stream_id, &ufrag, &pwd))
+        return -1;
+    cands = n_agent_get_local_cands(from->agent, from->stream_id, 1);
+    if (cands != NULL
+            && n_agent_set_remote_credentials(to->agent, to->stream_id, ufrag, pwd)
+            && n_agent_set_remote_cands(to->agent, to->stream_id, 1, cands) > 0)
+        ret = 0;
+
+    if (cands)
+        n_slist_free_full(cands, (n_destroy_notify)&n_cand_free);
+    free(ufrag);
+    free(pwd);
+    return ret;
+}
+
+static void bench_sender(void * data)
+{
+    bench_pair_t * pair = data;
+    static char bulk[BENCH_CHUNK];
+    char msg[BENCH_MSG_SIZE];
+    uint32_t off = 0, i;
+    int32_t n;
+
+    if (pair->latency)
+    {
+        memset(msg, 0, sizeof(msg));
+        for (i = 0; i < BENCH_LAT_MSGS; i++)
+        {
+            int64_t now = get_monotonic_time();
+
+            memcpy(msg, &now, sizeof(now));
+            if (n_agent_send_all(pair->a.agent, pair->a.stream_id, 1, sizeof(msg), msg, BENCH_DRAIN_MS) != sizeof(msg))
+                break;
+            pair->tx_bytes += sizeof(msg);
+            sleep_us(BENCH_LAT_GAP_US);
+        }
+        return;
+    }
+
+    /* bulk data carries no stamp; a chunk cut by the deadline is finished
+     * so the receiver stays in step with the message boundaries */
+    while (get_monotonic_time() < pair->deadline || off != 0)
+    {
+        n = n_agent_send_all(pair->a.agent, pair->a.stream_id, 1, BENCH_CHUNK - off, bulk + off, 100);
+        if (n > 0)
+        {
+            pair->tx_bytes += n;
+            off = (off + n) % BENCH_CHUNK;
+        }
+        else if (n != N_AGENT_SEND_WOULDBLOCK)
+        {
+            break;
+        }
+    }
+}
+
+/* Runs the senders of every ready pair and waits until the receivers have
+ * everything, returns the usec from start to the last byte */
+static int64_t bench_run(int32_t latency, int32_t seconds)
+{
+    int64_t begin = get_monotonic_time(), drain;
+    int32_t i, pending;
+
+    for (i = 0; i < n_pairs; i++)
+    {
+        bench_pair_t * pair = &pairs[i];
+
+        if (!pair->a.ready || !pair->b.ready)
+            continue;
+        pair->latency = latency;
+        pair->tx_bytes = 0;
+        pair->b.rx_bytes = 0;
+        pair->deadline = begin + (int64_t)seconds * USEC_PER_SEC;
+        pthread_create(&pair->send_tid, 0, (void *)bench_sender, pair);
+    }
+    for (i = 0; i < n_pairs; i++)
+    {
+        if (pairs[i].a.ready && pairs[i].b.ready)
+            pthread_join(pairs[i].send_tid, NULL);
+    }
+
+    drain = get_monotonic_time() + BENCH_DRAIN_MS * 1000;
+    do
+    {
+        pending = 0;
+        for (i = 0; i < n_pairs; i++)
+        {
+            if (pairs[i].a.ready && pairs[i].b.ready && pairs[i].b.rx_bytes < pairs[i].tx_bytes)
+                pending++;
+        }
+        if (pending)
+            sleep_ms(1);
+    } while (pending && get_monotonic_time() < drain);
+
+    return get_monotonic_time() - begin;
+}
+
+/* usec of CPU time the whole process has used */
+static int64_t bench_cpu_time(void)
+{
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    ULARGE_INTEGER k, u;
+
+    GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (int64_t)((k.QuadPart + u.QuadPart) / 10);
+#else
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (int64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * USEC_PER_SEC
+           + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#endif
+}
+
+static int bench_cmp_u32(const void * a, const void * b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* pct of a sorted array */
+static uint32_t bench_pct(const uint32_t * v, uint32_t n, uint32_t pct)
+{
+    if (n == 0)
+        return 0;
+    return v[MIN(n - 1, (uint64_t)n * pct / 100)];
+}
+
+int main(int argc, char * argv[])
+{
+    int32_t seconds = BENCH_DEFAULT_SECONDS, threads = BENCH_DEFAULT_THREADS;
+    uint32_t ready_us[BENCH_MAX_PAIRS], n_ready = 0, n_lat = 0, * lat;
+    int64_t deadline, usec, cpu;
+    uint64_t total = 0;
+    FILE * out = stdout;
+    int32_t i, waiting;
+
+    if (argc > 1)
+        n_pairs = atoi(argv[1]);
+    if (argc > 2)
+        seconds = atoi(argv[2]);
+    if (argc > 3)
+        threads = atoi(argv[3]);
+    if (n_pairs <= 0 || n_pairs > BENCH_MAX_PAIRS || seconds <= 0 || threads <= 0 || threads > EXECUTOR_MAX_THREADS)
+    {
+        fprintf(stderr, "usage: %s [pairs] [seconds] [io threads] [json file]\n", argv[0]);
+        return 1;
+    }
+
+    n_networking_init();
+#ifdef _WIN32
+    clock_win32_init();
+#endif
+    timer_open();
+    if (n_agent_io_start(threads, EXECUTOR_POLICY_LEAST_LOADED) < 0)
+        return 1;
+
+    if ((pairs = calloc(n_pairs, sizeof(bench_pair_t))) == NULL)
+        return 1;
+    for (i = 0; i < n_pairs; i++)
+    {
+        if (bench_peer_open(&pairs[i].a, TRUE) < 0 || bench_peer_open(&pairs[i].b, FALSE) < 0)
+        {
+            fprintf(stderr, "pair %d: agent setup failed\n", i);
+            return 1;
+        }
+    }
+
+    /* host candidates only, gathering ends right away */
+    deadline = get_monotonic_time() + BENCH_READY_MS * 1000;
+    for (i = 0; i < n_pairs; i++)
+    {
+        while ((!pairs[i].a.gathered || !pairs[i].b.gathered) && get_monotonic_time() < deadline)
+            sleep_ms(1);
+        pairs[i].started = get_monotonic_time();
+        if (bench_peer_exchange(&pairs[i].a, &pairs[i].b) < 0 || bench_peer_exchange(&pairs[i].b, &pairs[i].a) < 0)
+            fprintf(stderr, "pair %d: candidate exchange failed\n", i);
+    }
+
+    do
+    {
+        waiting = 0;
+        for (i = 0; i < n_pairs; i++)
+        {
+            bench_pair_t * pair = &pairs[i];
+
+            if (!pair->a.failed && !pair->b.failed && (!pair->a.ready || !pair->b.ready))
+                waiting++;
+        }
+        if (waiting)
+            sleep_ms(1);
+    } while (waiting && get_monotonic_time() < deadline);
+
+    for (i = 0; i < n_pairs; i++)
+    {
+        bench_pair_t * pair = &pairs[i];
+
+        if (pair->a.ready && pair->b.ready)
+            ready_us[n_ready++] = (uint32_t)(MAX(pair->a.ready_at, pair->b.ready_at) - pair->started);
+    }
+    qsort(ready_us, n_ready, sizeof(uint32_t), bench_cmp_u32);
+
+    cpu = bench_cpu_time();
+    usec = bench_run(FALSE, seconds);
+    cpu = bench_cpu_time() - cpu;
+    for (i = 0; i < n_pairs; i++)
+    {
+        pairs[i].bulk_bytes = pairs[i].b.rx_bytes;
+        total += pairs[i].bulk_bytes;
+    }
+
+    bench_run(TRUE, seconds);
+    if ((lat = malloc(sizeof(uint32_t) * BENCH_LAT_MSGS * n_pairs)) == NULL)
+        return 1;
+    for (i = 0; i < n_pairs; i++)
+    {
+        memcpy(lat + n_lat, pairs[i].b.lat, pairs[i].b.n_lat * sizeof(uint32_t));
+        n_lat += pairs[i].b.n_lat;
+    }
+    qsort(lat, n_lat, sizeof(uint32_t), bench_cmp_u32);
+
+    /* the library logs to stdout, a file keeps the JSON clean */
+    if (argc > 4 && (out = fopen(argv[4], "w")) == NULL)
+        out = stdout;
+    fprintf(out, "{\n");
+    fprintf(out, "  \"pairs\": %d, \"ready_pairs\": %u, \"seconds\": %d, \"io_threads\": %d,\n", n_pairs, n_ready, seconds, threads);
+    fprintf(out, "  \"ready_us\": { \"p50\": %u, \"p99\": %u, \"max\": %u },\n",
+            bench_pct(ready_us, n_ready, 50), bench_pct(ready_us, n_ready, 99), n_ready ? ready_us[n_ready - 1] : 0);
+    fprintf(out, "  \"throughput_mbps\": { \"aggregate\": %.1f, \"per_pair\": [", usec > 0 ? total * 8.0 / usec : 0.0);
+    for (i = 0; i < n_pairs; i++)
+        fprintf(out, "%s%.1f", i ? ", " : "", usec > 0 ? pairs[i].bulk_bytes * 8.0 / usec : 0.0);
+    fprintf(out, "] },\n");
+    fprintf(out, "  \"cpu_sec_per_gbit\": %.3f,\n", total > 0 ? (cpu / 1e6) / (total * 8.0 / 1e9) : 0.0);
+    fprintf(out, "  \"latency_us\": { \"samples\": %u, \"p50\": %u, \"p99\": %u, \"max\": %u }\n",
+            n_lat, bench_pct(lat, n_lat, 50), bench_pct(lat, n_lat, 99), n_lat ? lat[n_lat - 1] : 0);
+    fprintf(out, "}\n");
+    if (out != stdout)
+        fclose(out);
+
+    /* the agents and their event threads go away with the process */
+    n_agent_io_stop();
+    return 0;
+}
@@ -23,6 +23,7 @@
 #include "event.h"
 #include "pthread.h"
 #include "timer.h"
+#include "executor.h"
 
 //static GMainLoop * gloop;
 static char * stun_addr = "118.178.231.92";
@@ -53,6 +54,7 @@ void nice_event_loop(void * data)
 {
 	int32_t  ret = 0, i = 0, events = 0;
 	n_agent_t  * agent = (n_agent_t  *)data;
+	n_event_rec_t recs[16];
 	void * n_data;
 
 	agent->n_event = event_open();
@@ -64,50 +66,56 @@ void nice_event_loop(void * data)
 
 	while (1)
 	{
-		if ((ret = event_wait(agent->n_event, 0xFFFFFFFF, &events, &n_data)) < 0)
+		if ((ret = event_wait_batch(agent->n_event, 0xFFFFFFFF, recs, N_ELEMENTS(recs))) < 0)
 		{
 			sleep_us(10 * 1000);
 			continue;
 		}
-		
-		if (events & N_EVENT_CAND_GATHERING_DONE)
+
+		for (i = 0; i < ret; i++)
 		{
-			uint32_t * id = (uint32_t *) n_data;
+			events = recs[i].events;
+			n_data = recs[i].n_data;
 
-			nice_debug("[CB_CAND_GATHERING_DONE] events(0x%x)  stream_id(%d)\n", events, *id);
+			if (events & N_EVENT_CAND_GATHERING_DONE)
+			{
+				uint32_t * id = (uint32_t *) n_data;
 
-			cb_cand_gathering_done(agent, *id, NULL);
-		}
+				nice_debug("[CB_CAND_GATHERING_DONE] events(0x%x)  stream_id(%d)\n", events, *id);
 
+				cb_cand_gathering_done(agent, *id, NULL);
+			}
 
-		if (events & N_EVENT_NEW_SELECTED_PAIR)
-		{
-			ev_new_pair_t * ev_new_pair = (ev_new_pair_t *)n_data;
 
-			cb_new_selected_pair(agent, ev_new_pair->stream_id, ev_new_pair->component_id, 
-												ev_new_pair->lfoundation, ev_new_pair->rfoundation, NULL);
-		}
+			if (events & N_EVENT_NEW_SELECTED_PAIR)
+			{
+				ev_new_pair_t * ev_new_pair = (ev_new_pair_t *)n_data;
 
-		if (events & N_EVENT_COMP_STATE_CHANGED)
-		{
-			ev_state_changed_t * ev_state_changed = (ev_state_changed_t *)n_data;
-			cb_comp_state_changed(agent, ev_state_changed->stream_id, ev_state_changed->comp_id, ev_state_changed->state, NULL);
-			nice_debug("\n[CB_COMP_STATE_CHANGED] events(0x%x)  state(%d)\n", events, ev_state_changed->state);
-		}
+				cb_new_selected_pair(agent, ev_new_pair->stream_id, ev_new_pair->component_id, 
+													ev_new_pair->lfoundation, ev_new_pair->rfoundation, NULL);
+			}
 
-		if (events & N_EVENT_NEW_CAND)
-		{
-			ev_new_cand_t * ev_new_cand = (ev_new_cand_t *)n_data;
-			nice_debug("\n[CB_NEW_CAND] events(0x%x)  foundation(%s)\n", events, ev_new_cand->foundation);
-		}
+			if (events & N_EVENT_COMP_STATE_CHANGED)
+			{
+				ev_state_changed_t * ev_state_changed = (ev_state_changed_t *)n_data;
+				cb_comp_state_changed(agent, ev_state_changed->stream_id, ev_state_changed->comp_id, ev_state_changed->state, NULL);
+				nice_debug("\n[CB_COMP_STATE_CHANGED] events(0x%x)  state(%d)\n", events, ev_state_changed->state);
+			}
 
-		if (events & N_EVENT_NEW_CAND_FULL)
-		{
-			n_cand_t * cand = (n_cand_t *)n_data;
-			nice_debug("\n[CB_NEW_CAND_FULL] events(0x%x)  foundation(%s)\n", events, cand->foundation);
-		}
+			if (events & N_EVENT_NEW_CAND)
+			{
+				ev_new_cand_t * ev_new_cand = (ev_new_cand_t *)n_data;
+				nice_debug("\n[CB_NEW_CAND] events(0x%x)  foundation(%s)\n", events, ev_new_cand->foundation);
+			}
 
-		n_free(n_data);
+			if (events & N_EVENT_NEW_CAND_FULL)
+			{
+				n_cand_t * cand = (n_cand_t *)n_data;
+				nice_debug("\n[CB_NEW_CAND_FULL] events(0x%x)  foundation(%s)\n", events, cand->foundation);
+			}
+
+			n_free(n_data);
+		}
 	}
 }
 
@@ -261,13 +269,12 @@ void nice_thread(void * data)
 			numread = fread(snd_buf, 2048, 1, file_fp);
 			if (numread > 0)
 			{
-resend:				
-				numsend = n_agent_send(agent, stream_id, 1, 2048, snd_buf);
-				if (numsend < 0)
+				/* sleeps while the send buffer is full */
+				numsend = n_agent_send_all(agent, stream_id, 1, 2048, snd_buf, -1);
+				if (numsend < 2048)
 				{
 					//nice_debug("send err!");
-					sleep_us(500);
-					goto resend;
+					goto end;
 				}
 				else
 				{
@@ -559,6 +566,7 @@ int main(int argc, char * argv[])
 	}
 
 	ret = timer_open();
+	ret = n_agent_io_start(2, EXECUTOR_POLICY_LEAST_LOADED);
 
 	ret = pthread_create(&tid, 0, (void *)nice_thread, NULL);
 
@@ -579,6 +587,7 @@ int main(int argc, char * argv[])
 	exit_thread = TRUE;
 
 	pthread_join(tid, NULL);
+	n_agent_io_stop();
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,289 @@
+/* This file is part of the Nice GLib ICE library. */
+/*
+ * Pseudo-TCP reordering benchmark: two sockets talk over a simulated link
+ * driven by a virtual clock, data segments are held back at random to
+ * arrive out of order (and optionally dropped), ACKs come back in order.
+ * A segment can also be dropped at a fixed interval, each such hole keeps
+ * a whole window of data out of order until it is retransmitted. Every loss
+ * can take a burst of consecutive segments with it, several holes in one
+ * window are what selective acknowledgements recover from in one round
+ * trip; turning them off on both sockets shows what the same losses cost a
+ * peer that does not negotiate them. Both sockets run the congestion
+ * control named last, newreno, cubic or bbr.
+ * Reports the goodput over virtual time and the CPU time the receiver
+ * spends in pst_notify_packet(), where out-of-order data is reassembled.
+ *
+ * Build together with agent/pseudotcp.c, agent/debug.c, glib/base.c,
+ * glib/nlist.c and glib/nqueue.c:
+ *   reorder_bench [MB] [reorder %] [loss %] [window KB] [drop every Nth segment] [sack 0|1]
+ *                 [segments per loss] [congestion control]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "base.h"
+#include "pseudotcp.h"
+
+#define BENCH_DEFAULT_MB       32
+#define BENCH_DEFAULT_REORDER  10
+#define BENCH_DEFAULT_LOSS     0
+#define BENCH_DEFAULT_WINDOW   1024     /* KB, far above the 60 KB default */
+#define BENCH_MTU              1400
+#define BENCH_DELAY_MS         40       /* one way */
+#define BENCH_REORDER_MS       20       /* extra delay of a held back segment */
+#define BENCH_RATE             12500    /* bytes per ms, 100 Mbit/s */
+#define BENCH_MAX_PACKETS      16384
+#define BENCH_START_MS         1000     /* 0 would make the sockets use the real clock */
+
+typedef struct
+{
+    uint32_t at;                    /* virtual ms of arrival */
+    uint32_t order;                 /* ties leave in send order */
+    pst_socket_t * to;
+    uint32_t len;
+    char data[BENCH_MTU];
+} bench_packet_t;
+
+typedef struct
+{
+    pst_socket_t * tx, * rx;
+    bench_packet_t * heap[BENCH_MAX_PACKETS];
+    bench_packet_t * pool[BENCH_MAX_PACKETS];
+    uint32_t n_heap, n_pool, order;
+    uint32_t now;
+    uint64_t link_free;             /* virtual usec the data direction is busy until */
+    uint32_t reorder, loss;         /* percent */
+    uint32_t hole;                  /* drop every hole-th segment, 0 for none */
+    uint32_t burst, burst_left;     /* segments dropped per loss */
+    uint64_t segments, reordered, dropped;
+    int64_t rx_usec;                /* spent in the receiver's pst_notify_packet() */
+} bench_link_t;
+
+static int bench_before(const bench_packet_t * a, const bench_packet_t * b)
+{
+    return a->at < b->at || (a->at == b->at && a->order < b->order);
+}
+
+static void bench_push(bench_link_t * link, bench_packet_t * p)
+{
+    uint32_t i = link->n_heap++;
+
+    while (i > 0 && bench_before(p, link->heap[(i - 1) / 2]))
+    {
+        link->heap[i] = link->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    link->heap[i] = p;
+}
+
+static bench_packet_t * bench_pop(bench_link_t * link)
+{
+    bench_packet_t * top = link->heap[0], * last = link->heap[--link->n_heap];
+    uint32_t i = 0, c;
+
+    while ((c = 2 * i + 1) < link->n_heap)
+    {
+        if (c + 1 < link->n_heap && bench_before(link->heap[c + 1], link->heap[c]))
+            c++;
+        if (!bench_before(link->heap[c], last))
+            break;
+        link->heap[i] = link->heap[c];
+        i = c;
+    }
+    link->heap[i] = last;
+    return top;
+}
+
+static pst_wret_e bench_write(pst_socket_t * sock, char * buf, uint32_t len, void * data)
+{
+    bench_link_t * link = data;
+    bench_packet_t * p;
+
+    if (len > BENCH_MTU)
+        return WR_TOO_LARGE;
+    if (link->n_pool == 0)
+        return WR_FAIL;
+
+    p = link->pool[--link->n_pool];
+    memcpy(p->data, buf, len);
+    p->len = len;
+    p->order = link->order++;
+    if (sock == link->tx)
+    {
+        /* the data direction is rate limited, segments queue behind each other */
+        link->link_free = MAX(link->link_free, (uint64_t)link->now * 1000) + (uint64_t)len * 1000 / BENCH_RATE;
+        p->at = (uint32_t)((link->link_free + 999) / 1000) + BENCH_DELAY_MS;
+        p->to = link->rx;
+        link->segments++;
+        if (link->burst_left > 0)
+        {
+            link->burst_left--;
+            link->dropped++;
+            link->pool[link->n_pool++] = p;
+            return WR_SUCCESS;
+        }
+        if ((uint32_t)(rand() % 100) < link->loss || (link->hole > 0 && link->segments % link->hole == 0))
+        {
+            link->burst_left = link->burst - 1;
+            link->dropped++;
+            link->pool[link->n_pool++] = p;
+            return WR_SUCCESS;
+        }
+        if ((uint32_t)(rand() % 100) < link->reorder)
+        {
+            p->at += 1 + rand() % BENCH_REORDER_MS;
+            link->reordered++;
+        }
+    }
+    else
+    {
+        p->at = link->now + BENCH_DELAY_MS;
+        p->to = link->tx;
+    }
+    bench_push(link, p);
+    return WR_SUCCESS;
+}
+
+static void bench_set_time(bench_link_t * link, uint32_t now)
+{
+    link->now = now;
+    pst_set_time(link->tx, now);
+    pst_set_time(link->rx, now);
+}
+
+/* earliest of the next arrival and both clocks */
+static uint32_t bench_next(bench_link_t * link)
+{
+    uint64_t t, next = (uint64_t)link->now + 1000;
+
+    if (link->n_heap > 0)
+        next = MIN(next, link->heap[0]->at);
+    if (pst_get_next_clock(link->tx, (t = next, &t)))
+        next = MIN(next, t);
+    if (pst_get_next_clock(link->rx, (t = next, &t)))
+        next = MIN(next, t);
+    return (uint32_t)MAX(next, (uint64_t)link->now + 1);
+}
+
+static const char * bench_cc_names[] = { "newreno", "cubic", "bbr" };
+
+static pst_socket_t * bench_socket(bench_link_t * link, uint32_t window, int sack, pst_cc_e cc)
+{
+    pst_callback_t cb = { link, NULL, NULL, NULL, NULL, bench_write, NULL };
+    pst_socket_t * sock = pst_new(0x8989, &cb);
+
+    pst_set_property(sock, PROP_RCV_BUF, &window);
+    pst_set_property(sock, PROP_SND_BUF, &window);
+    pst_set_property(sock, PROP_SUPPORT_SACK, &sack);
+    pst_set_property(sock, PROP_CONGESTION_CONTROL, &cc);
+    pst_notify_mtu(sock, BENCH_MTU);
+    return sock;
+}
+
+int main(int argc, char * argv[])
+{
+    int32_t mb = BENCH_DEFAULT_MB, reorder = BENCH_DEFAULT_REORDER, loss = BENCH_DEFAULT_LOSS;
+    int32_t window = BENCH_DEFAULT_WINDOW, hole = 0, sack = 1, burst = 1;
+    pst_cc_e cc = PST_CC_NEWRENO;
+    static bench_link_t link;
+    static char buf[64 * 1024];
+    uint64_t total, sent = 0, got = 0;
+    int64_t begin, usec;
+    uint32_t i, start;
+    double secs;
+
+    if (argc > 1)
+        mb = atoi(argv[1]);
+    if (argc > 2)
+        reorder = atoi(argv[2]);
+    if (argc > 3)
+        loss = atoi(argv[3]);
+    if (argc > 4)
+        window = atoi(argv[4]);
+    if (argc > 5)
+        hole = atoi(argv[5]);
+    if (argc > 6)
+        sack = atoi(argv[6]);
+    if (argc > 7)
+        burst = atoi(argv[7]);
+    if (argc > 8)
+    {
+        for (cc = PST_CC_NEWRENO; cc <= PST_CC_BBR; cc++)
+        {
+            if (strcmp(argv[8], bench_cc_names[cc]) == 0)
+                break;
+        }
+    }
+    if (mb <= 0 || reorder < 0 || reorder > 100 || loss < 0 || loss >= 100 || window <= 0 || hole < 0 || burst <= 0 ||
+            cc > PST_CC_BBR)
+    {
+        printf("usage: %s [MB] [reorder %%] [loss %%] [window KB] [drop every Nth segment] [sack 0|1] "
+               "[segments per loss] [newreno|cubic|bbr]\n", argv[0]);
+        return 1;
+    }
+
+    for (i = 0; i < BENCH_MAX_PACKETS; i++)
+    {
+        if ((link.pool[i] = malloc(sizeof(bench_packet_t))) == NULL)
+            return 1;
+    }
+    link.n_pool = BENCH_MAX_PACKETS;
+    link.reorder = reorder;
+    link.loss = loss;
+    link.hole = hole;
+    link.burst = burst;
+    srand(1);
+
+    link.tx = bench_socket(&link, window * 1024, sack != 0, cc);
+    link.rx = bench_socket(&link, window * 1024, sack != 0, cc);
+    bench_set_time(&link, BENCH_START_MS);
+    pst_connect(link.tx);
+
+    total = (uint64_t)mb * 1024 * 1024;
+    memset(buf, 0x5a, sizeof(buf));
+    begin = get_monotonic_time();
+    start = link.now;
+    while (got < total && link.now - start < 3600 * 1000)
+    {
+        int32_t n;
+
+        while (link.n_heap > 0 && link.heap[0]->at <= link.now)
+        {
+            bench_packet_t * p = bench_pop(&link);
+
+            if (p->to == link.rx)
+            {
+                int64_t t = get_monotonic_time();
+
+                pst_notify_packet(link.rx, p->data, p->len);
+                link.rx_usec += get_monotonic_time() - t;
+            }
+            else
+            {
+                pst_notify_packet(link.tx, p->data, p->len);
+            }
+            link.pool[link.n_pool++] = p;
+        }
+        pst_notify_clock(link.tx);
+        pst_notify_clock(link.rx);
+
+        while (sent < total && (n = pst_send(link.tx, buf, (uint32_t)MIN(total - sent, sizeof(buf)))) > 0)
+            sent += n;
+        while ((n = pst_recv(link.rx, buf, sizeof(buf))) > 0)
+            got += n;
+
+        bench_set_time(&link, bench_next(&link));
+    }
+    usec = get_monotonic_time() - begin;
+
+    secs = (link.now - start) / 1000.0;
+    printf("%d MB, window %d KB, %d%% reordered, %d%% lost in bursts of %d, SACK %s, %s: %s\n", mb, window, reorder,
+           loss, burst, sack ? "on" : "off", bench_cc_names[cc], got >= total ? "complete" : "timed out");
+    printf("goodput       : %8.1f Mbit/s over %.1f virtual s\n", secs > 0 ? got * 8 / secs / 1e6 : 0.0, secs);
+    printf("segments      : %llu sent, %llu reordered, %llu dropped\n", (unsigned long long)link.segments,
+           (unsigned long long)link.reordered, (unsigned long long)link.dropped);
+    printf("receiver      : %8.1f usec/MB in pst_notify_packet()\n", got > 0 ? link.rx_usec / (got / 1048576.0) : 0.0);
+    printf("wall          : %8.1f usec/MB\n", got > 0 ? usec / (got / 1048576.0) : 0.0);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/* This file is part of the Nice GLib ICE library. */
+/*
+ * Transmit batching benchmark: pushes the same amount of pseudo-TCP sized
+ * datagrams over loopback once with one nice_socket_send() per segment, as
+ * pst_write_packet() used to, and once in bursts through
+ * nice_socket_send_batch(), then reports syscalls and time per MB.
+ *
+ * Build together with socket/socket.c, agent/address.c, agent/debug.c,
+ * glib/base.c and glib/nlist.c:
+ *   send_batch_bench [MB] [segment bytes]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "base.h"
+#include "address.h"
+#include "socket.h"
+
+#define BENCH_DEFAULT_MB       64
+#define BENCH_DEFAULT_SEGMENT  1200   /* a pseudo-TCP segment on a 1280 MTU */
+
+typedef struct
+{
+    uint64_t syscalls;
+    uint64_t bytes;
+    int64_t usec;
+} bench_result_t;
+
+static void bench_print(const char * name, bench_result_t * res)
+{
+    double mb = (double)res->bytes / (1024 * 1024);
+
+    printf("%-12s: %8.1f syscalls/MB  %8.1f usec/MB  (%llu syscalls)\n", name,
+           mb > 0 ? res->syscalls / mb : 0.0, mb > 0 ? res->usec / mb : 0.0,
+           (unsigned long long)res->syscalls);
+}
+
+int main(int argc, char * argv[])
+{
+    int32_t mb = BENCH_DEFAULT_MB, seg = BENCH_DEFAULT_SEGMENT;
+    n_outvector_t bufs[NICE_SOCKET_SEND_BATCH];
+    bench_result_t single = { 0 }, batch = { 0 };
+    n_socket_t * tx, * rx;
+    n_addr_t local, to;
+    struct sockaddr_in name;
+    int name_len = sizeof(name);
+    uint64_t total;
+    char * data;
+    int64_t begin;
+    uint32_t i, n_calls;
+
+    if (argc > 1)
+        mb = atoi(argv[1]);
+    if (argc > 2)
+        seg = atoi(argv[2]);
+    if (mb <= 0 || seg <= 0 || seg * NICE_SOCKET_SEND_BATCH > 65000)
+    {
+        printf("usage: %s [MB] [segment bytes]\n", argv[0]);
+        return 1;
+    }
+
+#ifdef _WIN32
+    {
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+    }
+#endif
+
+    nice_address_init(&local);
+    nice_address_set_from_string(&local, "127.0.0.1");
+    tx = n_socket_new(&local);
+    rx = n_socket_new(&local);
+    data = malloc(seg * NICE_SOCKET_SEND_BATCH);
+    if (tx == NULL || rx == NULL || data == NULL)
+        return 1;
+    memset(data, 0x5a, seg * NICE_SOCKET_SEND_BATCH);
+    /* bound to port 0, ask which one we got */
+    if (getsockname(rx->sock_fd, (struct sockaddr *)&name, (void *)&name_len) != 0)
+        return 1;
+    n_addr_set_from_sock(&to, (struct sockaddr *)&name);
+    total = (uint64_t)mb * 1024 * 1024;
+
+    /* nobody reads rx, loopback drops what does not fit its buffer */
+    begin = get_monotonic_time();
+    while (single.bytes < total)
+    {
+        if (nice_socket_send(tx, &to, seg, data) < 0)
+            break;
+        single.syscalls++;
+        single.bytes += seg;
+    }
+    single.usec = get_monotonic_time() - begin;
+
+    for (i = 0; i < NICE_SOCKET_SEND_BATCH; i++)
+    {
+        bufs[i].buffer = data + i * seg;
+        bufs[i].size = seg;
+    }
+    begin = get_monotonic_time();
+    while (batch.bytes < total)
+    {
+        int32_t ret = nice_socket_send_batch(tx, &to, bufs, NICE_SOCKET_SEND_BATCH, &n_calls);
+
+        batch.syscalls += n_calls;
+        if (ret <= 0)
+            break;
+        batch.bytes += (uint64_t)ret * seg;
+    }
+    batch.usec = get_monotonic_time() - begin;
+
+    printf("%d MB in %d byte segments, %d per burst\n", mb, seg, NICE_SOCKET_SEND_BATCH);
+    bench_print("per segment", &single);
+    bench_print("batched", &batch);
+
+    free(data);
+    closesocket(tx->sock_fd);
+    closesocket(rx->sock_fd);
+    return 0;
+}
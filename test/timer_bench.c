@@ -0,0 +1,86 @@
+/* This file is part of the Nice GLib ICE library. */
+/*
+ * Timer wheel benchmark: arms a large number of timers with intervals
+ * spread over a few ms up to several minutes, then reports the average
+ * cost of one timer thread pass and of a start/stop pair.
+ *
+ * Build together with glib/timer.c, glib/base.c and glib/nlist.c:
+ *   timer_bench [timers] [seconds]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "base.h"
+#include "timer.h"
+
+#define BENCH_DEFAULT_TIMERS   10000
+#define BENCH_DEFAULT_SECONDS  5
+
+static volatile int32_t fired = 0;
+
+static void bench_cb(void * data)
+{
+    fired++;
+}
+
+int main(int argc, char * argv[])
+{
+    int32_t num = BENCH_DEFAULT_TIMERS, seconds = BENCH_DEFAULT_SECONDS;
+    int32_t * handles, i, armed = 0;
+    int64_t cost[2] = { 0 }, base_cost[2] = { 0 }, begin, churn;
+
+    if (argc > 1)
+        num = atoi(argv[1]);
+    if (argc > 2)
+        seconds = atoi(argv[2]);
+    if (num <= 0 || seconds <= 0)
+    {
+        printf("usage: %s [timers] [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    handles = malloc(num * sizeof(int32_t));
+    if (handles == NULL || timer_open() < 0)
+        return 1;
+
+    for (i = 0; i < num; i++)
+    {
+        /* mostly short protocol timers, with a tail of long refresh ones */
+        uint32_t interval = (i % 10) ? 20 + (i % 500) : 1000 + (i * 37) % 300000;
+
+        handles[i] = timer_create();
+        timer_init(handles[i], 0, interval, bench_cb, NULL, "bench");
+        timer_start(handles[i]);
+    }
+    timer_ioctrl(0, TIMER_CMD_GETTMCOUNT, &armed);
+
+    timer_ioctrl(0, TIMER_CMD_GETLOOPCOST, base_cost);
+    sleep_ms(seconds * 1000);
+    timer_ioctrl(0, TIMER_CMD_GETLOOPCOST, cost);
+    cost[0] -= base_cost[0];
+    cost[1] -= base_cost[1];
+
+    begin = get_monotonic_time();
+    for (i = 0; i < num; i++)
+    {
+        timer_stop(handles[i]);
+        timer_start(handles[i]);
+    }
+    churn = get_monotonic_time() - begin;
+
+    printf("timers armed      : %d\n", armed);
+    printf("callbacks fired   : %d in %d s\n", fired, seconds);
+    printf("timer passes      : %lld\n", (long long)cost[1]);
+    printf("usec per pass     : %.2f\n", cost[1] ? (double)cost[0] / cost[1] : 0.0);
+    printf("usec per stop+start: %.3f\n", (double)churn / num);
+
+    for (i = 0; i < num; i++)
+    {
+        timer_stop(handles[i]);
+        timer_destroy(handles[i]);
+    }
+    timer_close(0);
+    free(handles);
+    return 0;
+}
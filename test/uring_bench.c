@@ -0,0 +1,235 @@
+/* This file is part of the Nice GLib ICE library. */
+/*
+ * io_uring receive/transmit benchmark: pushes bursts of pseudo-TCP sized
+ * datagrams over loopback and reads them back, once through the plain UDP
+ * socket (sendmmsg/GSO out, recvmmsg in) and once through two io_uring
+ * sockets, then reports syscalls and time per MB delivered.
+ *
+ * Build together with socket/socket.c, socket/udp-uring.c, agent/address.c,
+ * agent/debug.c, glib/base.c and glib/nlist.c:
+ *   uring_bench [MB] [segment bytes]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "base.h"
+#include "address.h"
+#include "socket.h"
+
+#ifdef __linux__
+
+#include <poll.h>
+
+#define BENCH_DEFAULT_MB       64
+#define BENCH_DEFAULT_SEGMENT  1200   /* a pseudo-TCP segment on a 1280 MTU */
+#define BENCH_WAIT_MS          100    /* a burst that is not complete by then was dropped */
+
+typedef struct
+{
+    uint64_t syscalls;
+    uint64_t bytes;
+    uint64_t lost;
+    int64_t usec;
+} bench_result_t;
+
+static void bench_print(const char * name, bench_result_t * res)
+{
+    double mb = (double)res->bytes / (1024 * 1024);
+
+    printf("%-10s: %8.1f syscalls/MB  %8.1f usec/MB  (%llu syscalls, %llu lost)\n", name,
+           mb > 0 ? res->syscalls / mb : 0.0, mb > 0 ? res->usec / mb : 0.0,
+           (unsigned long long)res->syscalls, (unsigned long long)res->lost);
+}
+
+static int32_t bench_wait(int fd, bench_result_t * res)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    res->syscalls++;
+    return poll(&pfd, 1, BENCH_WAIT_MS);
+}
+
+static void bench_plain(n_socket_t * tx, n_socket_t * rx, n_addr_t * to, n_outvector_t * bufs,
+                        uint64_t total, bench_result_t * res)
+{
+    n_input_msg_t msgs[NICE_SOCKET_RECV_BATCH];
+    n_invector_t vecs[NICE_SOCKET_RECV_BATCH];
+    static uint8_t rbufs[NICE_SOCKET_RECV_BATCH][NICE_URING_RECV_SIZE];
+    int64_t begin;
+    uint32_t i, n_calls;
+
+    for (i = 0; i < NICE_SOCKET_RECV_BATCH; i++)
+    {
+        vecs[i].buffer = rbufs[i];
+        vecs[i].size = sizeof(rbufs[i]);
+        msgs[i].buffers = &vecs[i];
+        msgs[i].n_buffers = 1;
+        msgs[i].from = NULL;
+        msgs[i].length = 0;
+    }
+
+    begin = get_monotonic_time();
+    while (res->bytes < total)
+    {
+        int32_t sent = nice_socket_send_batch(tx, to, bufs, NICE_SOCKET_SEND_BATCH, &n_calls);
+        int32_t got = 0;
+
+        res->syscalls += n_calls;
+        if (sent <= 0)
+            break;
+        while (got < sent)
+        {
+            int32_t n = nice_socket_recv_batch(rx->sock_fd, msgs, NICE_SOCKET_RECV_BATCH, &n_calls);
+
+            res->syscalls += n_calls;
+            if (n < 0)
+                break;
+            if (n == 0 && bench_wait(rx->sock_fd, res) <= 0)
+                break;
+            for (i = 0; i < (uint32_t)n; i++)
+                res->bytes += msgs[i].length;
+            got += n;
+        }
+        res->lost += sent - MIN(got, sent);
+    }
+    res->usec = get_monotonic_time() - begin;
+}
+
+static void bench_uring(n_socket_t * tx, n_socket_t * rx, n_addr_t * to, n_outvector_t * bufs,
+                        uint64_t total, bench_result_t * res)
+{
+    n_input_msg_t msgs[NICE_SOCKET_RECV_BATCH];
+    n_invector_t vecs[NICE_SOCKET_RECV_BATCH];
+    uint64_t sends, tx_enters, rx_enters;
+    int64_t begin;
+    uint32_t i, n_calls;
+
+    for (i = 0; i < NICE_SOCKET_RECV_BATCH; i++)
+    {
+        msgs[i].buffers = &vecs[i];
+        msgs[i].n_buffers = 1;
+        msgs[i].from = NULL;
+        msgs[i].length = 0;
+    }
+
+    begin = get_monotonic_time();
+    while (res->bytes < total)
+    {
+        int32_t sent, got = 0;
+
+        /* the completions of the last burst give its send slots back */
+        nice_udp_uring_recv(tx, msgs, 0);
+        sent = nice_socket_send_batch(tx, to, bufs, NICE_SOCKET_SEND_BATCH, &n_calls);
+        if (sent <= 0)
+            break;
+        while (got < sent)
+        {
+            int32_t n = nice_udp_uring_recv(rx, msgs, NICE_SOCKET_RECV_BATCH);
+
+            if (n < 0)
+                break;
+            if (n == 0 && bench_wait(nice_socket_poll_fd(rx), res) <= 0)
+                break;
+            for (i = 0; i < (uint32_t)n; i++)
+                res->bytes += msgs[i].length;
+            nice_udp_uring_recv_done(rx);
+            got += n;
+        }
+        res->lost += sent - MIN(got, sent);
+    }
+    res->usec = get_monotonic_time() - begin;
+
+    nice_udp_uring_get_stats(tx, &sends, &tx_enters);
+    nice_udp_uring_get_stats(rx, &sends, &rx_enters);
+    res->syscalls += tx_enters + rx_enters;
+}
+
+static int32_t bench_local_addr(n_socket_t * sock, n_addr_t * to)
+{
+    struct sockaddr_in name;
+    socklen_t name_len = sizeof(name);
+
+    /* bound to port 0, ask which one we got */
+    if (getsockname(sock->sock_fd, (struct sockaddr *)&name, &name_len) != 0)
+        return -1;
+    n_addr_set_from_sock(to, (struct sockaddr *)&name);
+    return 0;
+}
+
+int main(int argc, char * argv[])
+{
+    int32_t mb = BENCH_DEFAULT_MB, seg = BENCH_DEFAULT_SEGMENT;
+    n_outvector_t bufs[NICE_SOCKET_SEND_BATCH];
+    bench_result_t plain = { 0 }, uring = { 0 };
+    n_socket_t * tx, * rx;
+    n_addr_t local, to;
+    uint64_t total;
+    char * data;
+    uint32_t i;
+
+    if (argc > 1)
+        mb = atoi(argv[1]);
+    if (argc > 2)
+        seg = atoi(argv[2]);
+    if (mb <= 0 || seg <= 0 || seg > NICE_URING_SEND_SIZE || seg * NICE_SOCKET_SEND_BATCH > 65000)
+    {
+        printf("usage: %s [MB] [segment bytes]\n", argv[0]);
+        return 1;
+    }
+
+    data = malloc(seg * NICE_SOCKET_SEND_BATCH);
+    if (data == NULL)
+        return 1;
+    memset(data, 0x5a, seg * NICE_SOCKET_SEND_BATCH);
+    for (i = 0; i < NICE_SOCKET_SEND_BATCH; i++)
+    {
+        bufs[i].buffer = data + i * seg;
+        bufs[i].size = seg;
+    }
+    total = (uint64_t)mb * 1024 * 1024;
+    nice_address_init(&local);
+    nice_address_set_from_string(&local, "127.0.0.1");
+
+    printf("%d MB in %d byte segments, %d per burst\n", mb, seg, NICE_SOCKET_SEND_BATCH);
+
+    tx = n_socket_new(&local);
+    rx = n_socket_new(&local);
+    if (tx == NULL || rx == NULL || bench_local_addr(rx, &to) < 0)
+        return 1;
+    bench_plain(tx, rx, &to, bufs, total, &plain);
+    bench_print("recvmmsg", &plain);
+    closesocket(tx->sock_fd);
+    closesocket(rx->sock_fd);
+
+    tx = n_udp_uring_socket_new(&local);
+    rx = n_udp_uring_socket_new(&local);
+    if (tx == NULL || rx == NULL || bench_local_addr(rx, &to) < 0)
+    {
+        printf("%-10s: not available\n", "io_uring");
+    }
+    else
+    {
+        bench_uring(tx, rx, &to, bufs, total, &uring);
+        bench_print("io_uring", &uring);
+    }
+    if (tx)
+        nice_socket_free(tx);
+    if (rx)
+        nice_socket_free(rx);
+
+    free(data);
+    return 0;
+}
+
+#else
+
+int main(int argc, char * argv[])
+{
+    printf("io_uring is only available on Linux\n");
+    return 0;
+}
+
+#endif